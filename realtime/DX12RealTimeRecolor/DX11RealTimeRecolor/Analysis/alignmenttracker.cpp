@@ -0,0 +1,271 @@
+#include "alignmenttracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace RTR;
+
+namespace {
+    template<bool Bilinear>
+    float aligned_correlation_impl(const GrayImage& image480, const GrayImage& image2160, const SimilarityTransform& transform, float minOverlap) {
+        const auto toSrc = transform.inverse();
+        double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+        u32 n = 0;
+        for (u32 y = 0; y < image480.height; y++) {
+            for (u32 x = 0; x < image480.width; x++) {
+                float sx, sy;
+                toSrc.apply((float)x, (float)y, sx, sy);
+                float b;
+                if constexpr (Bilinear) {
+                    if (!image2160.sample(sx, sy, b))
+                        continue;
+                }
+                else {
+                    int ix = (int)(sx + 0.5f), iy = (int)(sy + 0.5f);
+                    if (ix < 0 || iy < 0 || ix >= (int)image2160.width || iy >= (int)image2160.height)
+                        continue;
+                    b = image2160.at(ix, iy);
+                }
+                float a = image480.at(x, y);
+                sumA += a; sumB += b;
+                sumAA += a * a; sumBB += b * b; sumAB += a * b;
+                n++;
+            }
+        }
+        if (n == 0 || n < minOverlap * image480.width * image480.height)
+            return -1.0f;
+        const double varA = sumAA - sumA * sumA / n;
+        const double varB = sumBB - sumB * sumB / n;
+        const double cov = sumAB - sumA * sumB / n;
+        if (varA <= 0 || varB <= 0)
+            return -1.0f; // Flat images (title cards, fades to black) can't tell us anything
+        return (float)(cov / std::sqrt(varA * varB));
+    }
+
+    // Title cards and fades to black can't confirm or refute an alignment
+    bool is_flat(const GrayImage& image) {
+        constexpr double MIN_VARIANCE = 4.0;
+        double sum = 0, sumSq = 0;
+        for (u8 p : image.pixels) {
+            sum += p;
+            sumSq += (double)p * p;
+        }
+        const double n = (double)image.pixels.size();
+        return n == 0 || (sumSq - sum * sum / n) / n < MIN_VARIANCE;
+    }
+
+    GrayImage thumbnail_of(const GrayImage& image) {
+        return downscale_area(image,
+            std::max(1u, image.width / AlignmentTracker::THUMBNAIL_FACTOR),
+            std::max(1u, image.height / AlignmentTracker::THUMBNAIL_FACTOR));
+    }
+}
+
+float RTR::aligned_correlation(const GrayImage& image480, const GrayImage& image2160, const SimilarityTransform& transform, float minOverlap) {
+    return aligned_correlation_impl<true>(image480, image2160, transform, minOverlap);
+}
+
+float RTR::aligned_correlation(const GrayImage& image480, const GrayImage& warped2160, const RemapTable& table, float minOverlap) {
+    if (image480.width != table.width || image480.height != table.height || warped2160.pixels.size() != image480.pixels.size())
+        throw std::invalid_argument("Images don't match the remap table");
+    const u32 n = table.validCount;
+    if (n == 0 || n < minOverlap * table.outputArea.width * table.outputArea.height)
+        return -1.0f;
+    // Integer sums are exact and much cheaper than the doubles the sampling version needs
+    u64 sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+    const auto& bounds = table.bounds;
+    for (u32 y = bounds.y; y < bounds.y + bounds.height; y++) {
+        const size_t rowStart = (size_t)y * table.width;
+        for (size_t i = rowStart + bounds.x; i < rowStart + bounds.x + bounds.width; i++) {
+            if (!table.valid[i])
+                continue;
+            const u64 a = image480.pixels[i], b = warped2160.pixels[i];
+            sumA += a; sumB += b;
+            sumAA += a * a; sumBB += b * b; sumAB += a * b;
+        }
+    }
+    const double varA = (double)sumAA - (double)sumA * sumA / n;
+    const double varB = (double)sumBB - (double)sumB * sumB / n;
+    const double cov = (double)sumAB - (double)sumA * sumB / n;
+    if (varA <= 0 || varB <= 0)
+        return -1.0f;
+    return (float)(cov / std::sqrt(varA * varB));
+}
+
+std::optional<SimilarityTransform> RTR::search_scale_translation(const GrayImage& image480, const GrayImage& image2160) {
+    constexpr u32 NUM_SCALES = 13;
+    constexpr float SCALE_RANGE = 1.3f; // search [nominal / range, nominal * range]
+    constexpr float MIN_OVERLAP = 0.7f;
+    constexpr float MIN_ACCEPTED_CORRELATION = 0.5f;
+
+    const auto thumb480 = thumbnail_of(image480);
+    const auto thumb2160 = thumbnail_of(image2160);
+    // The exhaustive part runs at half the thumbnail resolution again
+    const auto coarse480 = downscale_area(thumb480, std::max(1u, thumb480.width / 2), std::max(1u, thumb480.height / 2));
+    const auto coarse2160 = downscale_area(thumb2160, std::max(1u, thumb2160.width / 2), std::max(1u, thumb2160.height / 2));
+
+    // Coarse search at whole-pixel translations with nearest sampling
+    const float nominalScale = (float)coarse480.width / (float)coarse2160.width;
+    float bestScore = -1.0f;
+    SimilarityTransform best;
+    for (u32 i = 0; i < NUM_SCALES; i++) {
+        const float scale = nominalScale * std::pow(SCALE_RANGE, 2.0f * i / (NUM_SCALES - 1) - 1.0f);
+        const float warpedWidth = coarse2160.width * scale, warpedHeight = coarse2160.height * scale;
+        // Slide the warped image over every offset where it could still cover enough of the 480p image
+        const float slackX = coarse480.width * (1.0f - MIN_OVERLAP), slackY = coarse480.height * (1.0f - MIN_OVERLAP);
+        const int txMin = (int)std::floor(std::min(0.0f, coarse480.width - warpedWidth) - slackX);
+        const int txMax = (int)std::ceil(std::max(0.0f, coarse480.width - warpedWidth) + slackX);
+        const int tyMin = (int)std::floor(std::min(0.0f, coarse480.height - warpedHeight) - slackY);
+        const int tyMax = (int)std::ceil(std::max(0.0f, coarse480.height - warpedHeight) + slackY);
+        for (int ty = tyMin; ty <= tyMax; ty++) {
+            for (int tx = txMin; tx <= txMax; tx++) {
+                auto candidate = SimilarityTransform{ .a = scale, .b = 0, .tx = (float)tx, .ty = (float)ty };
+                float score = aligned_correlation_impl<false>(coarse480, coarse2160, candidate, MIN_OVERLAP);
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = candidate;
+                }
+            }
+        }
+    }
+    if (bestScore < MIN_ACCEPTED_CORRELATION)
+        return std::nullopt;
+
+    // Refine on the full thumbnails with bilinear sampling, by pattern search with shrinking steps
+    best = best.downscaled(0.5f, 0.5f);
+    bestScore = aligned_correlation_impl<true>(thumb480, thumb2160, best, MIN_OVERLAP);
+    float scaleStep = std::pow(SCALE_RANGE, 1.0f / (NUM_SCALES - 1));
+    float translationStep = 1.0f;
+    while (translationStep > 0.05f) {
+        bool improved = false;
+        const SimilarityTransform candidates[] = {
+            { .a = best.a * scaleStep, .b = 0, .tx = best.tx, .ty = best.ty },
+            { .a = best.a / scaleStep, .b = 0, .tx = best.tx, .ty = best.ty },
+            { .a = best.a, .b = 0, .tx = best.tx + translationStep, .ty = best.ty },
+            { .a = best.a, .b = 0, .tx = best.tx - translationStep, .ty = best.ty },
+            { .a = best.a, .b = 0, .tx = best.tx, .ty = best.ty + translationStep },
+            { .a = best.a, .b = 0, .tx = best.tx, .ty = best.ty - translationStep },
+        };
+        for (const auto& candidate : candidates) {
+            float score = aligned_correlation_impl<true>(thumb480, thumb2160, candidate, MIN_OVERLAP);
+            if (score > bestScore) {
+                bestScore = score;
+                best = candidate;
+                improved = true;
+            }
+        }
+        if (!improved) {
+            scaleStep = std::sqrt(scaleStep);
+            translationStep *= 0.5f;
+        }
+    }
+
+    // Thumbnail space -> analysis image space
+    const float factor = (float)AlignmentTracker::THUMBNAIL_FACTOR;
+    return best.downscaled(1.0f / factor, 1.0f / factor);
+}
+
+bool AlignmentTracker::detectShotCut(const GrayImage& thumb2160, std::optional<float> codecChangedFraction) {
+    std::array<float, HISTOGRAM_BINS> histogram = {};
+    for (u8 p : thumb2160.pixels) {
+        histogram[p * HISTOGRAM_BINS / 256] += 1.0f;
+    }
+    for (auto& bin : histogram) {
+        bin /= (float)thumb2160.pixels.size();
+    }
+
+    bool cut = false;
+    if (hasPreviousHistogram) {
+        float distance = 0;
+        for (u32 i = 0; i < HISTOGRAM_BINS; i++) {
+            distance += std::abs(histogram[i] - previousHistogram[i]);
+        }
+        cut = distance > SHOT_CUT_HISTOGRAM_DISTANCE;
+    }
+    if (codecChangedFraction && *codecChangedFraction > SHOT_CUT_CHANGED_FRACTION) {
+        cut = true;
+    }
+
+    previousHistogram = histogram;
+    hasPreviousHistogram = true;
+    return cut;
+}
+
+void AlignmentTracker::estimate(const GrayImage& image480, const GrayImage& image2160, const GrayImage& thumb480, const GrayImage& thumb2160,
+    u32 frameWidth2160, u32 frameHeight2160) {
+    stats.estimations++;
+    transform = estimator(image480, image2160);
+    if (transform) {
+        // Measured exactly the way the drift check will measure later frames, or the two aren't comparable
+        baselineCorrelation = activeAreaCorrelation(image480, thumb480, thumb2160, frameWidth2160, frameHeight2160);
+    }
+    else {
+        stats.failedEstimations++;
+    }
+}
+
+float AlignmentTracker::activeAreaCorrelation(const GrayImage& image480, const GrayImage& thumb480, const GrayImage& thumb2160,
+    u32 frameWidth2160, u32 frameHeight2160) {
+    // Black bars would only dilute the correlation, so it's over the active areas alone
+    const float factor = (float)THUMBNAIL_FACTOR;
+    const auto area480 = activeArea480.empty() ? PixelRect::whole(thumb480.width, thumb480.height)
+        : activeArea480.resizedInward(image480.width, image480.height, thumb480.width, thumb480.height);
+    const auto area2160 = activeArea2160.empty() ? PixelRect::whole(thumb2160.width, thumb2160.height)
+        : activeArea2160.resizedInward(frameWidth2160, frameHeight2160, thumb2160.width, thumb2160.height);
+    const auto& table = driftWarp.tableFor(transform->downscaled(factor, factor).inverse(), thumb2160.width, thumb2160.height, thumb480.width, thumb480.height, area480, area2160);
+    stats.warpTableBuilds = driftWarp.builds;
+    return aligned_correlation(thumb480, warp(thumb2160, table), table, MIN_OVERLAP);
+}
+
+std::optional<SimilarityTransform> AlignmentTracker::update(const GrayImage& image480, const GrayImage& image2160, std::optional<float> codecChangedFraction) {
+    return update(image480, image2160, thumbnail_of(image2160), image2160.width, image2160.height, codecChangedFraction);
+}
+
+std::optional<SimilarityTransform> AlignmentTracker::update(const GrayImage& image480, const ImagePyramid& pyramid2160, u32 analysisLevel2160, std::optional<float> codecChangedFraction) {
+    return update(image480, pyramid2160.level(analysisLevel2160), pyramid2160.level(analysisLevel2160 + THUMBNAIL_LEVELS),
+        pyramid2160.base().width, pyramid2160.base().height, codecChangedFraction);
+}
+
+std::optional<SimilarityTransform> AlignmentTracker::update(const GrayImage& image480, const GrayImage& image2160, const GrayImage& thumb2160,
+    u32 frameWidth2160, u32 frameHeight2160, std::optional<float> codecChangedFraction) {
+    stats.frames++;
+
+    const auto thumb480 = thumbnail_of(image480);
+
+    if (detectShotCut(thumb2160, codecChangedFraction)) {
+        stats.shotCuts++;
+        estimate(image480, image2160, thumb480, thumb2160, frameWidth2160, frameHeight2160);
+        return transform;
+    }
+    if (!transform) {
+        // Either the first frame, or the last estimation failed - keep trying
+        estimate(image480, image2160, thumb480, thumb2160, frameWidth2160, frameHeight2160);
+        return transform;
+    }
+
+    if (is_flat(thumb480) || is_flat(thumb2160)) {
+        return transform;
+    }
+
+    // Cheapest first: a few dozen textured patches at analysis resolution. Flat or ambiguous frames, or ones where the
+    // patches disagree, fall back to the thumbnail check rather than straight to re-estimating.
+    const auto patchArea480 = activeArea480.empty() ? PixelRect::whole(image480.width, image480.height) : activeArea480;
+    const auto patchArea2160 = activeArea2160.empty() ? PixelRect::whole(image2160.width, image2160.height)
+        : activeArea2160.resizedInward(frameWidth2160, frameHeight2160, image2160.width, image2160.height);
+    const auto patches = verify_alignment_patches(image480, image2160, *transform, patchArea480, patchArea2160);
+    stats.patchChecks++;
+    stats.patchCheckMs += patches.ms;
+    if (patches.aligned()) {
+        stats.patchCheckPasses++;
+        return transform;
+    }
+
+    // Drift check: does the cached transform still line the thumbnails up as well as it did?
+    float correlation = activeAreaCorrelation(image480, thumb480, thumb2160, frameWidth2160, frameHeight2160);
+    if (correlation < MIN_CORRELATION || correlation < baselineCorrelation - MAX_CORRELATION_DROP) {
+        stats.driftDetections++;
+        estimate(image480, image2160, thumb480, thumb2160, frameWidth2160, frameHeight2160);
+    }
+    return transform;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// Keeps the 2160p -> 480p alignment across frames, so the (expensive) estimator only runs on shot cuts or when the
+// alignment visibly drifts. Within a shot the crop and scale between the two cuts never change.
+
+#include "image.h"
+#include "letterbox.h"
+#include "patchverify.h"
+#include "pyramid.h"
+#include "transform.h"
+#include "warp.h"
+
+#include <array>
+#include <bit>
+#include <functional>
+#include <optional>
+
+namespace RTR {
+    // Estimates the transform mapping pixels of the 2160p analysis image onto the 480p analysis image, or nothing if it can't.
+    using AlignmentEstimator = std::function<std::optional<SimilarityTransform>(const GrayImage& image480, const GrayImage& image2160)>;
+
+    // Brute force scale + translation search on small thumbnails, maximizing zero-mean normalized cross-correlation.
+    // Assumes no rotation and roughly the same horizontal framing. Tens of milliseconds, so only suitable per-shot.
+    std::optional<SimilarityTransform> search_scale_translation(const GrayImage& image480, const GrayImage& image2160);
+
+    // Zero-mean normalized cross-correlation between image480 and image2160 mapped through transform, over their overlap.
+    // Returns -1 if they overlap on less than minOverlap of image480.
+    float aligned_correlation(const GrayImage& image480, const GrayImage& image2160, const SimilarityTransform& transform, float minOverlap);
+    // Same, for image2160 already warped into image480's geometry through table, over the table's valid pixels.
+    // minOverlap is relative to the table's output area.
+    float aligned_correlation(const GrayImage& image480, const GrayImage& warped2160, const RemapTable& table, float minOverlap);
+
+    struct AlignmentTrackerStats {
+        u64 frames = 0;
+        u64 estimations = 0;
+        u64 failedEstimations = 0;
+        u64 shotCuts = 0;
+        u64 driftDetections = 0;
+        // Most frames are confirmed by verify_alignment_patches, only the rest need the thumbnail drift check
+        u64 patchChecks = 0;
+        u64 patchCheckPasses = 0;
+        double patchCheckMs = 0.0;
+        // Drift checks warp the 2160p thumbnail through a remap table that only changes with the transform
+        u64 warpTableBuilds = 0;
+    };
+
+    struct AlignmentTracker {
+        // The cheap per-frame checks run on the analysis images downscaled by this much
+        static constexpr u32 THUMBNAIL_FACTOR = 8;
+        static_assert(std::has_single_bit(THUMBNAIL_FACTOR), "Thumbnails must be a whole number of pyramid levels down");
+        static constexpr u32 THUMBNAIL_LEVELS = std::countr_zero(THUMBNAIL_FACTOR);
+        static constexpr u32 HISTOGRAM_BINS = 32;
+        // L1 distance (in [0, 2]) between consecutive normalized luma histograms above which we call it a shot cut
+        static constexpr float SHOT_CUT_HISTOGRAM_DISTANCE = 0.6f;
+        // If the codec's motion vectors say more than this fraction of the frame is new, call it a shot cut
+        static constexpr float SHOT_CUT_CHANGED_FRACTION = 0.9f;
+        // Re-estimate if the aligned correlation drops this far below what it was right after estimating...
+        static constexpr float MAX_CORRELATION_DROP = 0.15f;
+        // ...or below this, regardless of the baseline
+        static constexpr float MIN_CORRELATION = 0.5f;
+        static constexpr float MIN_OVERLAP = 0.5f;
+
+        AlignmentEstimator estimator;
+
+        std::optional<SimilarityTransform> transform;
+        AlignmentTrackerStats stats;
+        // Inside the letterbox bars of the frames passed to update, in image480 pixels and full 2160p frame pixels.
+        // Empty means the whole frame.
+        PixelRect activeArea480, activeArea2160;
+
+        // Call once per frame pair. Pass MotionField::recomputeFraction() as codecChangedFraction if the 2160p frame had motion vectors.
+        // Returns the transform for this frame pair, if there is one.
+        std::optional<SimilarityTransform> update(const GrayImage& image480, const GrayImage& image2160, std::optional<float> codecChangedFraction = std::nullopt);
+        // Same, with the 2160p analysis image (and its thumbnail, THUMBNAIL_LEVELS further down) coming from a shared pyramid
+        std::optional<SimilarityTransform> update(const GrayImage& image480, const ImagePyramid& pyramid2160, u32 analysisLevel2160, std::optional<float> codecChangedFraction = std::nullopt);
+
+    private:
+        float baselineCorrelation = 0;
+        std::array<float, HISTOGRAM_BINS> previousHistogram = {};
+        bool hasPreviousHistogram = false;
+        RemapCache driftWarp;
+
+        std::optional<SimilarityTransform> update(const GrayImage& image480, const GrayImage& image2160, const GrayImage& thumb2160,
+            u32 frameWidth2160, u32 frameHeight2160, std::optional<float> codecChangedFraction);
+        bool detectShotCut(const GrayImage& thumb2160, std::optional<float> codecChangedFraction);
+        void estimate(const GrayImage& image480, const GrayImage& image2160, const GrayImage& thumb480, const GrayImage& thumb2160,
+            u32 frameWidth2160, u32 frameHeight2160);
+        // Correlation of the thumbnails' active areas lined up by transform, for the drift check and its baseline alike
+        float activeAreaCorrelation(const GrayImage& image480, const GrayImage& thumb480, const GrayImage& thumb2160,
+            u32 frameWidth2160, u32 frameHeight2160);
+    };
+}
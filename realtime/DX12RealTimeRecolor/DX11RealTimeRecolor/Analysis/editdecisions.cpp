@@ -0,0 +1,219 @@
+#include "editdecisions.h"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace RTR;
+
+namespace {
+    // Cost of a flat frame (black, fade) against another flat frame. They probably match, but don't say much.
+    constexpr float FLAT_FRAME_COST = 0.25f;
+
+    float frame_cost(const FrameFingerprint& a, const FrameFingerprint& b) {
+        if (!a.informative || !b.informative)
+            return (a.informative == b.informative) ? FLAT_FRAME_COST : 1.0f;
+        // Unrelated frames are ~32 bits apart, so saturate there
+        return (float)std::min(std::popcount(a.hash ^ b.hash), 32) / 32.0f;
+    }
+
+    enum Step : u8 {
+        Diagonal = 0, // from (i-1, j-1)
+        Vertical = 1, // from (i-1, j): 2160p frame i shows the same 480p frame as i-1
+        Horizontal = 2, // from (i, j-1): 480p frame j-1 is skipped
+    };
+
+    // Two bits per cell, four cells per byte
+    struct PackedSteps {
+        std::vector<u8> bytes;
+
+        void resize(u64 cells) { bytes.assign((cells + 3) / 4, 0); }
+        void set(u64 cell, Step step) { bytes[cell / 4] |= (u8)(step << ((cell % 4) * 2)); }
+        Step get(u64 cell) const { return (Step)((bytes[cell / 4] >> ((cell % 4) * 2)) & 3); }
+    };
+
+    // For every 2160p frame, roughly which 480p frame it should map to.
+    // Built from the longest chain of fingerprint index matches that moves forward in both cuts, interpolated in between.
+    std::vector<i64> guide_path(std::span<const FrameFingerprint> fingerprints2160, std::span<const FrameFingerprint> fingerprints480, u64& numAnchors) {
+        const i64 n = (i64)fingerprints2160.size(), m = (i64)fingerprints480.size();
+
+        FingerprintIndex index;
+        for (i64 j = 0; j < m; j++) {
+            index.add((u64)j, fingerprints480[j]);
+        }
+        std::vector<std::pair<i64, i64>> matches;
+        for (i64 i = 0; i < n; i++) {
+            if (auto match = index.find(fingerprints2160[i])) {
+                matches.emplace_back(i, (i64)match->frameNumber);
+            }
+        }
+
+        // Longest strictly increasing subsequence of 480p frames (2160p frames are already increasing).
+        // Throws away matches to repeated shots, recaps etc. which would send the band backwards.
+        std::vector<size_t> tails; // tails[k] = index into matches of the smallest tail of an increasing chain of length k+1
+        std::vector<i64> previous(matches.size(), -1);
+        for (size_t k = 0; k < matches.size(); k++) {
+            auto it = std::lower_bound(tails.begin(), tails.end(), matches[k].second,
+                [&](size_t t, i64 j) { return matches[t].second < j; });
+            if (it != tails.begin()) {
+                previous[k] = (i64)*(it - 1);
+            }
+            if (it == tails.end()) {
+                tails.push_back(k);
+            }
+            else {
+                *it = k;
+            }
+        }
+        std::vector<std::pair<i64, i64>> anchors;
+        for (i64 k = tails.empty() ? -1 : (i64)tails.back(); k >= 0; k = previous[k]) {
+            // Keep the corners themselves out of the chain, they're added below
+            if (matches[k].first > 0 && matches[k].first < n - 1 && matches[k].second > 0 && matches[k].second < m - 1) {
+                anchors.push_back(matches[k]);
+            }
+        }
+        numAnchors = anchors.size();
+        anchors.emplace_back(0, 0);
+        std::reverse(anchors.begin(), anchors.end());
+        anchors.emplace_back(n - 1, m - 1);
+
+        std::vector<i64> guide(n);
+        for (size_t a = 0; a + 1 < anchors.size(); a++) {
+            const auto [i0, j0] = anchors[a];
+            const auto [i1, j1] = anchors[a + 1];
+            for (i64 i = i0; i <= i1; i++) {
+                guide[i] = (i1 == i0) ? j1 : j0 + (j1 - j0) * (i - i0) / (i1 - i0);
+            }
+        }
+        return guide;
+    }
+}
+
+EditDecisionList RTR::align_cuts(std::span<const FrameFingerprint> fingerprints2160, std::span<const FrameFingerprint> fingerprints480,
+    const BandedDtwOptions& options) {
+    EditDecisionList edl;
+    const i64 n = (i64)fingerprints2160.size(), m = (i64)fingerprints480.size();
+    if (n == 0)
+        return edl;
+    if (m == 0) {
+        edl.frame480For2160.assign(n, -1);
+        edl.segments.push_back(EditSegment{ .start2160 = 0, .length = (u64)n, .start480 = -1 });
+        return edl;
+    }
+
+    const auto guide = guide_path(fingerprints2160, fingerprints480, edl.stats.anchors);
+
+    // Row i of the band covers 480p frames [lo[i], hi[i]]. Widening each row to reach the previous and next guide
+    // values keeps the band connected even where the guide jumps (a chunk of the 480p cut removed).
+    const i64 radius = (i64)options.bandRadius;
+    std::vector<i64> lo(n), hi(n);
+    std::vector<u64> rowOffset(n + 1);
+    for (i64 i = 0; i < n; i++) {
+        lo[i] = std::max<i64>(0, std::min(guide[i], guide[std::max<i64>(i - 1, 0)]) - radius);
+        hi[i] = std::min<i64>(m - 1, std::max(guide[i], guide[std::min(i + 1, n - 1)]) + radius);
+    }
+    // The path has to start and end in the corners
+    lo[0] = 0;
+    hi[n - 1] = m - 1;
+    for (i64 i = 0; i < n; i++) {
+        rowOffset[i + 1] = rowOffset[i] + (u64)(hi[i] - lo[i] + 1);
+    }
+
+    // Only two rows of accumulated cost are alive at a time, the backpointers are the only per-cell storage
+    PackedSteps steps;
+    steps.resize(rowOffset[n]);
+    edl.stats.cellsEvaluated = rowOffset[n];
+    edl.stats.backpointerBytes = steps.bytes.size();
+
+    constexpr double INF = std::numeric_limits<double>::infinity();
+    i64 maxWidth = 0;
+    for (i64 i = 0; i < n; i++) {
+        maxWidth = std::max(maxWidth, hi[i] - lo[i] + 1);
+    }
+    std::vector<double> previousRow(maxWidth, INF), currentRow(maxWidth, INF);
+
+    for (i64 i = 0; i < n; i++) {
+        for (i64 j = lo[i]; j <= hi[i]; j++) {
+            double best = INF;
+            Step step = Diagonal;
+            if (i == 0 && j == 0) {
+                best = 0;
+            }
+            if (i > 0) {
+                if (j - 1 >= lo[i - 1] && j - 1 <= hi[i - 1] && previousRow[j - 1 - lo[i - 1]] < best) {
+                    best = previousRow[j - 1 - lo[i - 1]];
+                    step = Diagonal;
+                }
+                if (j >= lo[i - 1] && j <= hi[i - 1] && previousRow[j - lo[i - 1]] + options.stepPenalty < best) {
+                    best = previousRow[j - lo[i - 1]] + options.stepPenalty;
+                    step = Vertical;
+                }
+            }
+            if (j > lo[i] && currentRow[j - 1 - lo[i]] + options.stepPenalty < best) {
+                best = currentRow[j - 1 - lo[i]] + options.stepPenalty;
+                step = Horizontal;
+            }
+            currentRow[j - lo[i]] = best + frame_cost(fingerprints2160[i], fingerprints480[j]);
+            steps.set(rowOffset[i] + (u64)(j - lo[i]), step);
+        }
+        std::swap(previousRow, currentRow);
+    }
+
+    // Walk back from the end, keeping the cheapest 480p frame the path visits for each 2160p frame
+    edl.frame480For2160.assign(n, -1);
+    std::vector<float> bestCost(n, std::numeric_limits<float>::infinity());
+    i64 i = n - 1, j = m - 1;
+    while (true) {
+        const float cost = frame_cost(fingerprints2160[i], fingerprints480[j]);
+        if (cost < bestCost[i]) {
+            bestCost[i] = cost;
+            edl.frame480For2160[i] = j;
+        }
+        if (i == 0 && j == 0)
+            break;
+        switch (steps.get(rowOffset[i] + (u64)(j - lo[i]))) {
+        case Diagonal: i--; j--; break;
+        case Vertical: i--; break;
+        case Horizontal: j--; break;
+        }
+    }
+    for (i64 k = 0; k < n; k++) {
+        if (bestCost[k] > options.maxMatchCost) {
+            edl.frame480For2160[k] = -1;
+        }
+    }
+
+    // Collapse runs of consecutive frames into segments
+    for (i64 k = 0; k < n; k++) {
+        const i64 j480 = edl.frame480For2160[k];
+        if (!edl.segments.empty()) {
+            auto& last = edl.segments.back();
+            const bool continuesUnmatched = last.start480 < 0 && j480 < 0;
+            const bool continuesMatched = last.start480 >= 0 && j480 == last.start480 + (i64)last.length;
+            if (continuesUnmatched || continuesMatched) {
+                last.length++;
+                continue;
+            }
+        }
+        edl.segments.push_back(EditSegment{ .start2160 = (u64)k, .length = 1, .start480 = j480 < 0 ? -1 : j480 });
+    }
+    return edl;
+}
+
+void EditDecisionList::write(const std::filesystem::path& path) const {
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Couldn't open " + path.string() + " for writing");
+    out << "# 2160p_first 2160p_last 480p_first (- if no counterpart)\n";
+    for (const auto& segment : segments) {
+        out << segment.start2160 << ' ' << (segment.start2160 + segment.length - 1) << ' ';
+        if (segment.start480 < 0) {
+            out << "-\n";
+        }
+        else {
+            out << segment.start480 << '\n';
+        }
+    }
+}
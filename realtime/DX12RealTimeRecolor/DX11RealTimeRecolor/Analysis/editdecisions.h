@@ -0,0 +1,52 @@
+#pragma once
+
+// Offline mapping of every 2160p frame to its 480p counterpart, for when the two releases are different cuts
+// (extended vs theatrical, PAL vs NTSC) and frames have been inserted, removed or retimed.
+// Runs banded dynamic time warping over the per-frame fingerprints of both files.
+
+#include "fingerprint.h"
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace RTR {
+    struct EditSegment {
+        // [start2160, start2160 + length) in the 2160p cut...
+        u64 start2160;
+        u64 length;
+        // ...shows frames [start480, start480 + length) of the 480p cut, or has no counterpart if start480 < 0.
+        i64 start480;
+    };
+
+    struct BandedDtwStats {
+        u64 anchors = 0; // 2160p frames whose fingerprint match was used to steer the band
+        u64 cellsEvaluated = 0;
+        u64 backpointerBytes = 0;
+    };
+
+    struct EditDecisionList {
+        std::vector<EditSegment> segments;
+        // Per 2160p frame, the matching 480p frame or -1 if it has no counterpart
+        std::vector<i64> frame480For2160;
+        BandedDtwStats stats;
+
+        // Plain text, one segment per line: "<first 2160p frame> <last 2160p frame> <first 480p frame>|-"
+        void write(const std::filesystem::path& path) const;
+    };
+
+    struct BandedDtwOptions {
+        // How far (in 480p frames) either side of the guide path the warping path may stray.
+        // Memory is (number of 2160p frames) * (band width) * 2 bits.
+        u32 bandRadius = 512;
+        // Added to the cost of every non-diagonal step, so the path only holds or skips frames when it has to
+        float stepPenalty = 0.1f;
+        // A 2160p frame whose best frame on the path costs more than this has no counterpart
+        float maxMatchCost = 0.4f;
+    };
+
+    // The band is centered on a guide path through fingerprint index matches of 2160p frames in the 480p cut,
+    // so long insertions/removals don't need a huge band.
+    EditDecisionList align_cuts(std::span<const FrameFingerprint> fingerprints2160, std::span<const FrameFingerprint> fingerprints480,
+        const BandedDtwOptions& options = {});
+}
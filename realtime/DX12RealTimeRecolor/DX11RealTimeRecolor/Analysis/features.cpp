@@ -0,0 +1,389 @@
+#include "features.h"
+#include "ransac.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <random>
+
+using namespace RTR;
+
+namespace {
+    // Orientation is measured over a circle of this radius, descriptor samples stay inside it whatever the rotation
+    constexpr int PATCH_RADIUS = 15;
+    constexpr int SAMPLE_RADIUS = 13;
+    constexpr int BLUR_RADIUS = 2;
+    constexpr int EDGE = PATCH_RADIUS + 1;
+    constexpr u32 ANGLE_BINS = 30;
+    constexpr u32 DESCRIPTOR_BITS = 256;
+
+    constexpr u32 MIN_MATCH_COUNT = 10; // Same as align.py
+    constexpr u32 MIN_INLIERS = 8;
+    // Below this the consensus is as likely to be a repeated pattern as the real alignment
+    constexpr float MIN_INLIER_RATIO = 0.25f;
+    // Descriptors further apart than this are unrelated, however they rank
+    constexpr u32 MAX_MATCH_DISTANCE = 80;
+
+    // Bresenham circle of radius 3, clockwise from the top
+    constexpr int FAST_CIRCLE[16][2] = {
+        { 0, -3 }, { 1, -3 }, { 2, -2 }, { 3, -1 }, { 3, 0 }, { 3, 1 }, { 2, 2 }, { 1, 3 },
+        { 0, 3 }, { -1, 3 }, { -2, 2 }, { -3, 1 }, { -3, 0 }, { -3, -1 }, { -2, -2 }, { -1, -3 },
+    };
+
+    struct SamplePair {
+        i32 x1, y1, x2, y2;
+    };
+    using SamplePattern = std::array<SamplePair, DESCRIPTOR_BITS>;
+
+    // BRIEF's isotropic Gaussian test locations, pre-rotated into ANGLE_BINS orientations.
+    // Any fixed pattern works as long as both images use the same one.
+    const std::array<SamplePattern, ANGLE_BINS>& steered_patterns() {
+        static const auto patterns = [] {
+            std::mt19937 rng(31337);
+            std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            const float sigma = (2 * PATCH_RADIUS + 1) / 5.0f;
+            auto gaussian_point = [&](float& x, float& y) {
+                do {
+                    // Box-Muller, rejecting anything that wouldn't stay in the patch when rotated
+                    const float r = sigma * std::sqrt(-2.0f * std::log(std::max(uniform(rng), 1e-7f)));
+                    const float theta = 2.0f * std::numbers::pi_v<float> * uniform(rng);
+                    x = r * std::cos(theta);
+                    y = r * std::sin(theta);
+                } while (x * x + y * y > SAMPLE_RADIUS * SAMPLE_RADIUS);
+            };
+            std::array<std::array<float, 4>, DESCRIPTOR_BITS> base;
+            for (auto& pair : base) {
+                gaussian_point(pair[0], pair[1]);
+                gaussian_point(pair[2], pair[3]);
+            }
+
+            std::array<SamplePattern, ANGLE_BINS> rotated;
+            for (u32 bin = 0; bin < ANGLE_BINS; bin++) {
+                const float angle = 2.0f * std::numbers::pi_v<float> * bin / ANGLE_BINS;
+                const float c = std::cos(angle), s = std::sin(angle);
+                for (u32 i = 0; i < DESCRIPTOR_BITS; i++) {
+                    const auto& p = base[i];
+                    rotated[bin][i] = SamplePair{
+                        .x1 = (i32)std::lround(c * p[0] - s * p[1]),
+                        .y1 = (i32)std::lround(s * p[0] + c * p[1]),
+                        .x2 = (i32)std::lround(c * p[2] - s * p[3]),
+                        .y2 = (i32)std::lround(s * p[2] + c * p[3]),
+                    };
+                }
+            }
+            return rotated;
+        }();
+        return patterns;
+    }
+
+    // Half-width of each row of the orientation circle
+    const std::array<int, PATCH_RADIUS + 1>& circle_half_widths() {
+        static const auto widths = [] {
+            std::array<int, PATCH_RADIUS + 1> w;
+            for (int v = 0; v <= PATCH_RADIUS; v++) {
+                w[v] = (int)std::floor(std::sqrt((float)(PATCH_RADIUS * PATCH_RADIUS - v * v)) + 0.5f);
+            }
+            return w;
+        }();
+        return widths;
+    }
+
+    // Descriptor tests compare small box sums rather than single noisy pixels, like ORB does. Box sums come from an integral image.
+    struct IntegralImage {
+        u32 width, height; // One larger than the image in each dimension
+        std::vector<u32> sums;
+
+        explicit IntegralImage(const GrayImage& image) : width(image.width + 1), height(image.height + 1), sums(width * height, 0) {
+            for (u32 y = 0; y < image.height; y++) {
+                const u8* in = image.row(y);
+                u32 rowSum = 0;
+                for (u32 x = 0; x < image.width; x++) {
+                    rowSum += in[x];
+                    sums[(y + 1) * width + (x + 1)] = sums[y * width + (x + 1)] + rowSum;
+                }
+            }
+        }
+        // Sum of the (2 * BLUR_RADIUS + 1)^2 box centered on (x, y)
+        u32 box(int x, int y) const {
+            const u32 x0 = (u32)(x - BLUR_RADIUS), y0 = (u32)(y - BLUR_RADIUS);
+            const u32 x1 = (u32)(x + BLUR_RADIUS + 1), y1 = (u32)(y + BLUR_RADIUS + 1);
+            return sums[y1 * width + x1] - sums[y0 * width + x1] - sums[y1 * width + x0] + sums[y0 * width + x0];
+        }
+    };
+
+    // Any arc of 9 covers at least two of the four compass points, so anything without two compass points
+    // brighter or two darker than the center can't be a corner. Returns a bitmask of the n (<= 32) pixels from (x, y)
+    // which pass that test.
+    u32 fast_candidates(const GrayImage& image, int x, int y, int n, int threshold) {
+        const u8* up = image.row(y - 3);
+        const u8* mid = image.row(y);
+        const u8* down = image.row(y + 3);
+        u32 mask = 0;
+        int i = 0;
+#if RTR_SSE2
+        const __m128i t = _mm_set1_epi8((char)threshold);
+        const __m128i one = _mm_set1_epi8(1);
+        for (; i + 16 <= n; i += 16) {
+            const __m128i c = _mm_loadu_si128((const __m128i*)(mid + x + i));
+            const __m128i hi = _mm_adds_epu8(c, t);
+            const __m128i lo = _mm_subs_epu8(c, t);
+            const __m128i compass[4] = {
+                _mm_loadu_si128((const __m128i*)(up + x + i)),
+                _mm_loadu_si128((const __m128i*)(mid + x + i + 3)),
+                _mm_loadu_si128((const __m128i*)(down + x + i)),
+                _mm_loadu_si128((const __m128i*)(mid + x + i - 3)),
+            };
+            __m128i brighter = _mm_setzero_si128(), darker = _mm_setzero_si128();
+            const __m128i zero = _mm_setzero_si128();
+            for (const auto& p : compass) {
+                // p > hi <=> p - hi (saturating) != 0. Subtracting the 0xFF comparison masks counts up.
+                brighter = _mm_sub_epi8(brighter, _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(p, hi), zero), _mm_set1_epi8(-1)));
+                darker = _mm_sub_epi8(darker, _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(lo, p), zero), _mm_set1_epi8(-1)));
+            }
+            const __m128i pass = _mm_or_si128(_mm_cmpgt_epi8(brighter, one), _mm_cmpgt_epi8(darker, one));
+            mask |= (u32)_mm_movemask_epi8(pass) << i;
+        }
+#endif
+        for (; i < n; i++) {
+            const int c = mid[x + i];
+            const int hi = c + threshold, lo = c - threshold;
+            const int compass[4] = { up[x + i], mid[x + i + 3], down[x + i], mid[x + i - 3] };
+            int brighter = 0, darker = 0;
+            for (int p : compass) {
+                brighter += p > hi;
+                darker += p < lo;
+            }
+            if (brighter >= 2 || darker >= 2) {
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
+    // FAST-9 score at (x, y), or 0 if it isn't a corner
+    u32 fast_score(const GrayImage& image, int x, int y, int threshold) {
+        const int c = image.at(x, y);
+        const int hi = c + threshold, lo = c - threshold;
+
+        u32 brightMask = 0, darkMask = 0;
+        u32 brightSum = 0, darkSum = 0;
+        for (u32 i = 0; i < 16; i++) {
+            const int p = image.at(x + FAST_CIRCLE[i][0], y + FAST_CIRCLE[i][1]);
+            if (p > hi) {
+                brightMask |= 1u << i;
+                brightSum += p - hi;
+            }
+            else if (p < lo) {
+                darkMask |= 1u << i;
+                darkSum += lo - p;
+            }
+        }
+        auto has_arc = [](u32 mask) {
+            // Unroll the circle so arcs crossing bit 15 -> 0 are contiguous, then AND it with shifted copies of itself
+            u32 run = mask | (mask << 16);
+            for (int i = 1; i < 9; i++) {
+                run &= (mask | (mask << 16)) >> i;
+            }
+            return run != 0;
+        };
+        u32 score = 0;
+        if (has_arc(brightMask)) {
+            score = std::max(score, brightSum);
+        }
+        if (has_arc(darkMask)) {
+            score = std::max(score, darkSum);
+        }
+        return score;
+    }
+
+    float intensity_centroid_angle(const GrayImage& image, int x, int y) {
+        const auto& halfWidths = circle_half_widths();
+        int m10 = 0, m01 = 0;
+        for (int v = -PATCH_RADIUS; v <= PATCH_RADIUS; v++) {
+            const u8* row = image.row(y + v);
+            const int hw = halfWidths[std::abs(v)];
+            for (int u = -hw; u <= hw; u++) {
+                const int p = row[x + u];
+                m10 += u * p;
+                m01 += v * p;
+            }
+        }
+        return std::atan2((float)m01, (float)m10);
+    }
+
+    OrbDescriptor describe(const IntegralImage& integral, int x, int y, float angle) {
+        float turns = angle / (2.0f * std::numbers::pi_v<float>);
+        turns -= std::floor(turns);
+        const u32 bin = (u32)std::lround(turns * ANGLE_BINS) % ANGLE_BINS;
+        const auto& pattern = steered_patterns()[bin];
+
+        OrbDescriptor d = {};
+        for (u32 i = 0; i < DESCRIPTOR_BITS; i++) {
+            const auto& s = pattern[i];
+            if (integral.box(x + s.x1, y + s.y1) < integral.box(x + s.x2, y + s.y2)) {
+                d[i / 64] |= 1ull << (i % 64);
+            }
+        }
+        return d;
+    }
+}
+
+OrbFeatures RTR::detect_orb(const GrayImage& image, const OrbOptions& options) {
+    OrbFeatures features;
+
+    // Share features out between levels in proportion to their area
+    const float areaFactor = 1.0f / (options.scaleFactor * options.scaleFactor);
+    float totalArea = 0;
+    for (u32 level = 0; level < options.levels; level++) {
+        totalArea += std::pow(areaFactor, (float)level);
+    }
+
+    GrayImage levelImage;
+    for (u32 level = 0; level < options.levels; level++) {
+        const float scale = std::pow(options.scaleFactor, (float)level);
+        const u32 w = (u32)std::lround(image.width / scale), h = (u32)std::lround(image.height / scale);
+        if (w <= 2 * EDGE || h <= 2 * EDGE)
+            break;
+        // Each level is downscaled from the one before, which is much cheaper than going from full size every time
+        levelImage = level == 0 ? image : downscale_area(levelImage, w, h);
+
+        std::vector<u32> scores(w * h, 0);
+        for (int y = EDGE; y < (int)h - EDGE; y++) {
+            for (int x = EDGE; x < (int)w - EDGE; x += 32) {
+                u32 candidates = fast_candidates(levelImage, x, y, std::min(32, (int)w - EDGE - x), options.fastThreshold);
+                while (candidates) {
+                    const int i = std::countr_zero(candidates);
+                    candidates &= candidates - 1;
+                    scores[y * w + x + i] = fast_score(levelImage, x + i, y, options.fastThreshold);
+                }
+            }
+        }
+
+        // 3x3 non-maximum suppression. Ties go to the first in scan order.
+        std::vector<Keypoint> levelKeypoints;
+        for (int y = EDGE; y < (int)h - EDGE; y++) {
+            for (int x = EDGE; x < (int)w - EDGE; x++) {
+                const u32 s = scores[y * w + x];
+                if (s == 0)
+                    continue;
+                bool isMax = true;
+                for (int dy = -1; dy <= 1 && isMax; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        const u32 neighbour = scores[(y + dy) * w + (x + dx)];
+                        const bool before = dy < 0 || (dy == 0 && dx < 0);
+                        if ((dx || dy) && (neighbour > s || (neighbour == s && before))) {
+                            isMax = false;
+                            break;
+                        }
+                    }
+                }
+                if (isMax) {
+                    levelKeypoints.push_back(Keypoint{ .x = (float)x, .y = (float)y, .angle = 0, .score = s, .level = level });
+                }
+            }
+        }
+
+        const u32 budget = (u32)std::ceil(options.maxFeatures * std::pow(areaFactor, (float)level) / totalArea);
+        if (levelKeypoints.size() > budget) {
+            std::nth_element(levelKeypoints.begin(), levelKeypoints.begin() + budget, levelKeypoints.end(),
+                [](const Keypoint& a, const Keypoint& b) { return a.score > b.score; });
+            levelKeypoints.resize(budget);
+        }
+
+        const IntegralImage integral(levelImage);
+        for (auto& kp : levelKeypoints) {
+            const int x = (int)kp.x, y = (int)kp.y;
+            kp.angle = intensity_centroid_angle(levelImage, x, y);
+            features.descriptors.push_back(describe(integral, x, y, kp.angle));
+            // Back to level 0 pixel coordinates
+            kp.x = (kp.x + 0.5f) * scale - 0.5f;
+            kp.y = (kp.y + 0.5f) * scale - 0.5f;
+            features.keypoints.push_back(kp);
+        }
+    }
+    return features;
+}
+
+u32 RTR::hamming_distance(const OrbDescriptor& a, const OrbDescriptor& b) {
+#if RTR_SSE2
+    // SWAR popcount on both halves at once, then let psadbw add up the byte counts
+    const __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&a[0]), _mm_loadu_si128((const __m128i*)&b[0]));
+    const __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&a[2]), _mm_loadu_si128((const __m128i*)&b[2]));
+    const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+    auto byte_popcount = [&](__m128i x) {
+        x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+        x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+        return _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+    };
+    // At most 16 per byte after adding, no overflow
+    const __m128i counts = _mm_add_epi8(byte_popcount(x0), byte_popcount(x1));
+    const __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+    return (u32)(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums)));
+#else
+    u32 distance = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        distance += (u32)std::popcount(a[i] ^ b[i]);
+    }
+    return distance;
+#endif
+}
+
+std::vector<FeatureMatch> RTR::match_ratio_test(const std::vector<OrbDescriptor>& query, const std::vector<OrbDescriptor>& train, float ratio) {
+    std::vector<FeatureMatch> matches;
+    if (train.size() < 2)
+        return matches;
+    for (u32 q = 0; q < query.size(); q++) {
+        u32 best = UINT32_MAX, second = UINT32_MAX, bestIndex = 0;
+        for (u32 t = 0; t < train.size(); t++) {
+            const u32 d = hamming_distance(query[q], train[t]);
+            if (d < best) {
+                second = best;
+                best = d;
+                bestIndex = t;
+            }
+            else if (d < second) {
+                second = d;
+            }
+        }
+        if (best <= MAX_MATCH_DISTANCE && (float)best < ratio * (float)second) {
+            matches.push_back(FeatureMatch{ .query = q, .train = bestIndex, .distance = best });
+        }
+    }
+    return matches;
+}
+
+std::optional<SimilarityTransform> RTR::align_features(const GrayImage& image480, const GrayImage& image2160, FeatureAlignmentStats* stats) {
+    const auto features480 = detect_orb(image480);
+    const auto features2160 = detect_orb(image2160);
+    auto matches = match_ratio_test(features2160.descriptors, features480.descriptors);
+    // Best first, for PROSAC
+    std::stable_sort(matches.begin(), matches.end(), [](const FeatureMatch& a, const FeatureMatch& b) { return a.distance < b.distance; });
+    if (stats) {
+        *stats = FeatureAlignmentStats{
+            .features480 = (u32)features480.keypoints.size(),
+            .features2160 = (u32)features2160.keypoints.size(),
+            .matches = (u32)matches.size(),
+        };
+    }
+    if (matches.size() <= MIN_MATCH_COUNT)
+        return std::nullopt;
+
+    std::vector<PointMatch> points;
+    points.reserve(matches.size());
+    for (const auto& m : matches) {
+        const auto& src = features2160.keypoints[m.query];
+        const auto& dst = features480.keypoints[m.train];
+        points.push_back(PointMatch{ .srcX = src.x, .srcY = src.y, .dstX = dst.x, .dstY = dst.y });
+    }
+    auto result = estimate_similarity_ransac(points);
+    if (!result || result->numInliers < MIN_INLIERS || result->inlierRatio < MIN_INLIER_RATIO)
+        return std::nullopt;
+    if (stats) {
+        stats->inliers = result->numInliers;
+        stats->inlierRatio = result->inlierRatio;
+        stats->rmsInlierError = result->rmsInlierError;
+    }
+    return result->transform;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// ORB-style binary features: FAST-9 corners on a small image pyramid, intensity-centroid orientation, and steered
+// 256-bit BRIEF descriptors, matched by brute force Hamming distance with Lowe's ratio test.
+// Replaces the SIFT + FLANN path in libimagetransfer/align.py, which is far too slow to run per shot.
+
+#include "image.h"
+#include "transform.h"
+
+#include <array>
+#include <optional>
+#include <vector>
+
+namespace RTR {
+    struct Keypoint {
+        float x, y; // In level 0 pixels
+        float angle; // Radians
+        u32 score;
+        u32 level;
+    };
+
+    using OrbDescriptor = std::array<u64, 4>;
+
+    struct OrbFeatures {
+        std::vector<Keypoint> keypoints;
+        std::vector<OrbDescriptor> descriptors;
+    };
+
+    struct OrbOptions {
+        u32 maxFeatures = 500;
+        // How much brighter/darker than the center the FAST arc has to be
+        u8 fastThreshold = 20;
+        u32 levels = 4;
+        float scaleFactor = 1.25f;
+    };
+
+    OrbFeatures detect_orb(const GrayImage& image, const OrbOptions& options = {});
+
+    u32 hamming_distance(const OrbDescriptor& a, const OrbDescriptor& b);
+
+    struct FeatureMatch {
+        u32 query, train;
+        u32 distance;
+    };
+
+    // For each query descriptor, the nearest train descriptor - if it's clearly nearer than the second nearest.
+    std::vector<FeatureMatch> match_ratio_test(const std::vector<OrbDescriptor>& query, const std::vector<OrbDescriptor>& train, float ratio = 0.75f);
+
+    struct FeatureAlignmentStats {
+        u32 features480 = 0, features2160 = 0;
+        u32 matches = 0;
+        u32 inliers = 0;
+        float inlierRatio = 0;
+        float rmsInlierError = 0;
+    };
+
+    // Feature based AlignmentEstimator: the similarity mapping image2160 pixels onto image480 pixels.
+    // Like align.py, gives up with too few good matches.
+    std::optional<SimilarityTransform> align_features(const GrayImage& image480, const GrayImage& image2160, FeatureAlignmentStats* stats = nullptr);
+}
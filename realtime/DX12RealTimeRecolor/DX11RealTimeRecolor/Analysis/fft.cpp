@@ -0,0 +1,103 @@
+#include "fft.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+#include <utility>
+
+using namespace RTR;
+
+FftPlan::FftPlan(u32 size) : size(size), bitReversed(size), twiddleRe(size / 2), twiddleIm(size / 2) {
+    if (size < 2 || !std::has_single_bit(size))
+        throw std::invalid_argument("FFT size must be a power of two");
+    const u32 bits = (u32)std::countr_zero(size);
+    for (u32 i = 0; i < size; i++) {
+        u32 r = 0;
+        for (u32 b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReversed[i] = r;
+    }
+    for (u32 k = 0; k < size / 2; k++) {
+        const double angle = -2.0 * std::numbers::pi * k / size;
+        twiddleRe[k] = (float)std::cos(angle);
+        twiddleIm[k] = (float)std::sin(angle);
+    }
+}
+
+void FftPlan::transformColumns(float* re, float* im, bool inverse) const {
+    // Every column goes through the same butterflies, so vectorize across columns. Strips of columns are narrow enough
+    // that all the passes over one stay in L1.
+    constexpr u32 STRIP_WIDTH = 16;
+    for (u32 strip = 0; strip < size; strip += STRIP_WIDTH) {
+        const u32 width = std::min(STRIP_WIDTH, size - strip);
+        for (u32 i = 0; i < size; i++) {
+            if (i < bitReversed[i]) {
+                std::swap_ranges(re + (size_t)i * size + strip, re + (size_t)i * size + strip + width, re + (size_t)bitReversed[i] * size + strip);
+                std::swap_ranges(im + (size_t)i * size + strip, im + (size_t)i * size + strip + width, im + (size_t)bitReversed[i] * size + strip);
+            }
+        }
+        for (u32 half = 1; half < size; half *= 2) {
+            const u32 twiddleStep = size / (half * 2);
+            for (u32 start = 0; start < size; start += half * 2) {
+                for (u32 k = 0; k < half; k++) {
+                    const float wr = twiddleRe[k * twiddleStep];
+                    const float wi = inverse ? -twiddleIm[k * twiddleStep] : twiddleIm[k * twiddleStep];
+                    float* evenRe = re + (size_t)(start + k) * size + strip;
+                    float* evenIm = im + (size_t)(start + k) * size + strip;
+                    float* oddRe = re + (size_t)(start + k + half) * size + strip;
+                    float* oddIm = im + (size_t)(start + k + half) * size + strip;
+                    u32 x = 0;
+#if RTR_SSE2
+                    const __m128 vwr = _mm_set1_ps(wr), vwi = _mm_set1_ps(wi);
+                    for (; x + 4 <= width; x += 4) {
+                        const __m128 ore = _mm_loadu_ps(oddRe + x), oim = _mm_loadu_ps(oddIm + x);
+                        const __m128 ere = _mm_loadu_ps(evenRe + x), eim = _mm_loadu_ps(evenIm + x);
+                        const __m128 tre = _mm_sub_ps(_mm_mul_ps(vwr, ore), _mm_mul_ps(vwi, oim));
+                        const __m128 tim = _mm_add_ps(_mm_mul_ps(vwr, oim), _mm_mul_ps(vwi, ore));
+                        _mm_storeu_ps(oddRe + x, _mm_sub_ps(ere, tre));
+                        _mm_storeu_ps(oddIm + x, _mm_sub_ps(eim, tim));
+                        _mm_storeu_ps(evenRe + x, _mm_add_ps(ere, tre));
+                        _mm_storeu_ps(evenIm + x, _mm_add_ps(eim, tim));
+                    }
+#endif
+                    for (; x < width; x++) {
+                        const float tre = wr * oddRe[x] - wi * oddIm[x], tim = wr * oddIm[x] + wi * oddRe[x];
+                        oddRe[x] = evenRe[x] - tre;
+                        oddIm[x] = evenIm[x] - tim;
+                        evenRe[x] += tre;
+                        evenIm[x] += tim;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void FftPlan::transform2d(SplitComplexImage& image, bool inverse) const {
+    if (image.size != size)
+        throw std::invalid_argument("FFT plan and image sizes differ");
+    // Columns, transpose, columns again (the original rows), transpose back. Transposes go in place tile by tile,
+    // a naive one spends longer missing cache than the butterflies take.
+    constexpr u32 TILE = 16;
+    const auto transpose = [this](float* plane) {
+        for (u32 ty = 0; ty < size; ty += TILE) {
+            for (u32 tx = ty; tx < size; tx += TILE) {
+                for (u32 y = ty; y < std::min(ty + TILE, size); y++) {
+                    for (u32 x = (tx == ty ? y + 1 : tx); x < std::min(tx + TILE, size); x++) {
+                        std::swap(plane[(size_t)y * size + x], plane[(size_t)x * size + y]);
+                    }
+                }
+            }
+        }
+    };
+    transformColumns(image.re.data(), image.im.data(), inverse);
+    transpose(image.re.data());
+    transpose(image.im.data());
+    transformColumns(image.re.data(), image.im.data(), inverse);
+    transpose(image.re.data());
+    transpose(image.im.data());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Small radix-2 FFT, just enough for phase correlation on power of two thumbnails.
+
+#include "../Utils/types.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace RTR {
+    // A square complex image as separate real and imaginary planes, which is what vectorizes
+    struct SplitComplexImage {
+        u32 size = 0;
+        std::vector<float> re, im;
+
+        explicit SplitComplexImage(u32 size) : size(size), re((size_t)size * size), im((size_t)size * size) {}
+    };
+
+    // Precomputed bit reversal and twiddles for one power of two size. Immutable once built, so one plan can be
+    // shared between threads.
+    struct FftPlan {
+        u32 size = 0;
+        std::vector<u32> bitReversed;
+        std::vector<float> twiddleRe, twiddleIm; // exp(-2 pi i k / size) for k < size / 2
+
+        // Throws std::invalid_argument if size isn't a power of two
+        explicit FftPlan(u32 size);
+
+        // In place 2D transform of a size x size image, unnormalized: an inverse after a forward transform scales by size^2
+        void transform2d(SplitComplexImage& image, bool inverse) const;
+
+    private:
+        // 1D transforms down every column at once
+        void transformColumns(float* re, float* im, bool inverse) const;
+    };
+}
@@ -0,0 +1,136 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+using namespace RTR;
+
+namespace {
+    // Standard deviation (in 8-bit levels) of the thumbnail below which a frame is considered flat
+    constexpr float MIN_THUMBNAIL_STDDEV = 2.0f;
+
+    u16 chunk_of(u64 hash, u32 chunk) {
+        return (u16)(hash >> (chunk * 16));
+    }
+
+    PixelRect center_of(PixelRect area, u32 imageWidth, u32 imageHeight) {
+        if (area.empty()) {
+            area = PixelRect::whole(imageWidth, imageHeight);
+        }
+        // Never smaller than the thumbnail, even if that means spilling over the area (but never the image)
+        constexpr u32 N = FrameFingerprint::THUMBNAIL_SIZE;
+        const u32 width = std::min(imageWidth, std::max(N, (u32)(area.width * FrameFingerprint::CENTER_FRACTION)));
+        const u32 height = std::min(imageHeight, std::max(N, (u32)(area.height * FrameFingerprint::CENTER_FRACTION)));
+        const i64 x = (i64)area.x + ((i64)area.width - width) / 2;
+        const i64 y = (i64)area.y + ((i64)area.height - height) / 2;
+        return PixelRect{
+            .x = (u32)std::clamp<i64>(x, 0, imageWidth - width),
+            .y = (u32)std::clamp<i64>(y, 0, imageHeight - height),
+            .width = width,
+            .height = height,
+        };
+    }
+
+    FrameFingerprint fingerprint_of_thumbnail(const GrayImage& small) {
+        FrameFingerprint fp;
+
+        float mean = 0;
+        for (u8 p : small.pixels) {
+            mean += p;
+        }
+        mean /= (float)small.pixels.size();
+        float variance = 0;
+        for (u8 p : small.pixels) {
+            variance += (p - mean) * (p - mean);
+        }
+        const float stddev = std::sqrt(variance / (float)small.pixels.size());
+        fp.informative = stddev >= MIN_THUMBNAIL_STDDEV;
+        for (u32 i = 0; i < small.pixels.size(); i++) {
+            fp.thumbnail[i] = fp.informative ? (small.pixels[i] - mean) / stddev : 0.0f;
+        }
+
+        const auto hashImage = downscale_area(small, 9, 8);
+        fp.hash = 0;
+        for (u32 y = 0; y < 8; y++) {
+            for (u32 x = 0; x < 8; x++) {
+                if (hashImage.at(x, y) < hashImage.at(x + 1, y)) {
+                    fp.hash |= 1ull << (y * 8 + x);
+                }
+            }
+        }
+        return fp;
+    }
+}
+
+FrameFingerprint RTR::fingerprint_of(const GrayImage& image, const PixelRect& activeArea) {
+    const auto c = center_of(activeArea, image.width, image.height);
+    const auto center = crop(image, c.x, c.y, c.width, c.height);
+    return fingerprint_of_thumbnail(downscale_area(center, FrameFingerprint::THUMBNAIL_SIZE, FrameFingerprint::THUMBNAIL_SIZE));
+}
+
+FrameFingerprint RTR::fingerprint_of(const LumaPlaneView& luma, const PixelRect& activeArea) {
+    const auto c = center_of(activeArea, luma.width, luma.height);
+    const auto center = luma.subview(c.x, c.y, c.width, c.height);
+    return fingerprint_of_thumbnail(downscale_area(center, FrameFingerprint::THUMBNAIL_SIZE, FrameFingerprint::THUMBNAIL_SIZE));
+}
+
+float RTR::thumbnail_correlation(const FrameFingerprint& a, const FrameFingerprint& b) {
+    // Thumbnails are already zero-mean with unit variance
+    float sum = 0;
+    for (u32 i = 0; i < a.thumbnail.size(); i++) {
+        sum += a.thumbnail[i] * b.thumbnail[i];
+    }
+    return sum / (float)a.thumbnail.size();
+}
+
+void FingerprintIndex::add(u64 frameNumber, const FrameFingerprint& fingerprint) {
+    if (!fingerprint.informative)
+        return;
+    const u32 index = (u32)entries.size();
+    entries.push_back(Entry{ .frameNumber = frameNumber, .fingerprint = fingerprint });
+    for (u32 c = 0; c < NUM_CHUNKS; c++) {
+        tables[c][chunk_of(fingerprint.hash, c)].push_back(index);
+    }
+}
+
+std::optional<FingerprintIndex::Match> FingerprintIndex::find(const FrameFingerprint& query) const {
+    if (!query.informative)
+        return std::nullopt;
+
+    // Gather everything within one bit of the query in at least one chunk
+    std::vector<u32> candidates;
+    for (u32 c = 0; c < NUM_CHUNKS; c++) {
+        const u16 chunk = chunk_of(query.hash, c);
+        for (int flip = -1; flip < 16; flip++) {
+            const u16 probe = flip < 0 ? chunk : (u16)(chunk ^ (1u << flip));
+            auto it = tables[c].find(probe);
+            if (it != tables[c].end()) {
+                candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    u32 bestDistance = MAX_HAMMING_DISTANCE + 1;
+    for (u32 index : candidates) {
+        bestDistance = std::min(bestDistance, (u32)std::popcount(entries[index].fingerprint.hash ^ query.hash));
+    }
+    if (bestDistance > MAX_HAMMING_DISTANCE)
+        return std::nullopt;
+
+    // Hashes are coarse, so let the thumbnails pick between the closest few
+    std::optional<Match> best;
+    for (u32 index : candidates) {
+        const auto& entry = entries[index];
+        const u32 distance = (u32)std::popcount(entry.fingerprint.hash ^ query.hash);
+        if (distance > std::min(bestDistance + HAMMING_SLACK, MAX_HAMMING_DISTANCE))
+            continue;
+        const float correlation = thumbnail_correlation(entry.fingerprint, query);
+        if (correlation >= MIN_THUMBNAIL_CORRELATION && (!best || correlation > best->thumbnailCorrelation)) {
+            best = Match{ .frameNumber = entry.frameNumber, .hammingDistance = distance, .thumbnailCorrelation = correlation };
+        }
+    }
+    return best;
+}
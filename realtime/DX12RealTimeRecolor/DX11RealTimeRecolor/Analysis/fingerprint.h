@@ -0,0 +1,72 @@
+#pragma once
+
+// Compact perceptual fingerprints of frames, and an index to find which frame of one cut matches a frame of the other.
+// The two cuts are different encodes (and possibly different crops), so fingerprints are built from a coarse thumbnail
+// of the middle of the picture, where both cuts are most likely to show the same thing. "The picture" is the active
+// area inside any letterbox bars: a DVD that letterboxes a scope film into 4:3 has a middle 60% of the full frame that's
+// a third bars, and covers a different part of the picture than the same crop of the 2160p frame.
+
+#include "image.h"
+#include "letterbox.h"
+
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace RTR {
+    struct FrameFingerprint {
+        static constexpr u32 THUMBNAIL_SIZE = 16;
+        // Only the middle fraction of the active area (in each dimension) is fingerprinted
+        static constexpr float CENTER_FRACTION = 0.6f;
+
+        // Zero-mean, contrast normalized thumbnail, for verifying hash matches
+        std::array<float, THUMBNAIL_SIZE * THUMBNAIL_SIZE> thumbnail;
+        // 64-bit difference hash: bit (y * 8 + x) is set if the 9x8 thumbnail gets brighter from x to x+1
+        u64 hash;
+        // False for (near) flat frames - fades, black frames, title card backgrounds.
+        // Those all hash to roughly the same thing, so they're never indexed or matched.
+        bool informative;
+    };
+
+    // activeArea is the picture without its bars, in the image's pixels. Empty (all black) means the whole image.
+    FrameFingerprint fingerprint_of(const GrayImage& image, const PixelRect& activeArea);
+    // Straight from a decoded frame, without building an analysis image first
+    FrameFingerprint fingerprint_of(const LumaPlaneView& luma, const PixelRect& activeArea);
+
+    // Zero-mean normalized cross-correlation of two fingerprint thumbnails, in [-1, 1]
+    float thumbnail_correlation(const FrameFingerprint& a, const FrameFingerprint& b);
+
+    // Finds the frame whose fingerprint is closest to a query, without comparing against every frame.
+    // Uses multi-index hashing: the 64-bit hash is split into NUM_CHUNKS 16-bit chunks, each with its own table.
+    // Two hashes within Hamming distance MAX_HAMMING_DISTANCE must have at least one chunk which differs by at most
+    // one bit (pigeonhole), so probing each table with the chunk and its 16 one-bit neighbours finds every candidate.
+    struct FingerprintIndex {
+        static constexpr u32 NUM_CHUNKS = 4;
+        static constexpr u32 MAX_HAMMING_DISTANCE = 2 * NUM_CHUNKS - 1;
+        // Candidates this much worse than the best Hamming distance are still verified against the thumbnail
+        static constexpr u32 HAMMING_SLACK = 2;
+        static constexpr float MIN_THUMBNAIL_CORRELATION = 0.8f;
+
+        struct Match {
+            u64 frameNumber;
+            u32 hammingDistance;
+            float thumbnailCorrelation;
+        };
+
+        // Uninformative fingerprints are ignored
+        void add(u64 frameNumber, const FrameFingerprint& fingerprint);
+        std::optional<Match> find(const FrameFingerprint& query) const;
+
+        size_t size() const { return entries.size(); }
+
+    private:
+        struct Entry {
+            u64 frameNumber;
+            FrameFingerprint fingerprint;
+        };
+        std::vector<Entry> entries;
+        // chunk value -> indices into entries
+        std::array<std::unordered_map<u16, std::vector<u32>>, NUM_CHUNKS> tables;
+    };
+}
@@ -0,0 +1,221 @@
+#include "image.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+using namespace RTR;
+
+bool GrayImage::sample(float x, float y, float& out) const {
+    if (x < 0 || y < 0 || x > (float)(width - 1) || y > (float)(height - 1))
+        return false;
+    u32 x0 = (u32)x, y0 = (u32)y;
+    u32 x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+    float fx = x - (float)x0, fy = y - (float)y0;
+    float top = at(x0, y0) * (1 - fx) + at(x1, y0) * fx;
+    float bottom = at(x0, y1) * (1 - fx) + at(x1, y1) * fx;
+    out = top * (1 - fy) + bottom * fy;
+    return true;
+}
+
+LumaPlaneView RTR::luma_plane_of(const AVFrame* frame) {
+    u32 shift;
+    switch (frame->format) {
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        shift = 0;
+        break;
+    case AV_PIX_FMT_P010LE:
+        // Samples are in the top 10 bits
+        shift = 8;
+        break;
+    case AV_PIX_FMT_YUV420P10LE:
+        // Samples are in the bottom 10 bits
+        shift = 2;
+        break;
+    default:
+        throw std::runtime_error(std::string("Can't analyse frames of format ") + av_get_pix_fmt_name((AVPixelFormat)frame->format));
+    }
+    return LumaPlaneView{
+        .data = frame->data[0],
+        .linesize = frame->linesize[0],
+        .width = (u32)frame->width,
+        .height = (u32)frame->height,
+        .shiftTo8Bit = shift,
+    };
+}
+
+LumaPlaneView RTR::view_of(const GrayImage& image) {
+    return LumaPlaneView{
+        .data = image.pixels.data(),
+        .linesize = (int)image.width,
+        .width = image.width,
+        .height = image.height,
+        .shiftTo8Bit = 0,
+    };
+}
+
+GrayImage RTR::to_gray_image(const LumaPlaneView& src) {
+    GrayImage dst(src.width, src.height);
+    for (u32 y = 0; y < src.height; y++) {
+        u8* out = dst.row(y);
+        if (src.shiftTo8Bit == 0) {
+            std::copy_n(src.data + (size_t)y * src.linesize, src.width, out);
+        }
+        else {
+            for (u32 x = 0; x < src.width; x++) {
+                out[x] = src.at(x, y);
+            }
+        }
+    }
+    return dst;
+}
+
+AreaTaps RTR::area_taps(u32 srcSize, u32 dstSize) {
+    const double scale = (double)srcSize / (double)dstSize;
+    AreaTaps taps;
+    taps.first.resize(dstSize);
+    taps.offsets.resize(dstSize + 1);
+    for (u32 d = 0; d < dstSize; d++) {
+        double start = d * scale, end = (d + 1) * scale;
+        u32 first = (u32)std::floor(start);
+        u32 last = std::min((u32)std::ceil(end) - 1, srcSize - 1);
+        taps.first[d] = first;
+        taps.offsets[d] = (u32)taps.weights.size();
+        for (u32 s = first; s <= last; s++) {
+            double coverage = std::min(end, (double)s + 1) - std::max(start, (double)s);
+            taps.weights.push_back((float)(coverage / scale));
+        }
+    }
+    taps.offsets[dstSize] = (u32)taps.weights.size();
+    return taps;
+}
+
+namespace {
+    // Separable: each source row is filtered horizontally once, then rows are accumulated vertically.
+    // RowFn(y, scratch) returns a pointer to source row y as 8-bit samples, using scratch if it needs to convert.
+    template<typename RowFn>
+    GrayImage downscale_area_impl(u32 srcWidth, u32 srcHeight, RowFn sourceRow, u32 dstWidth, u32 dstHeight) {
+        const auto xTaps = area_taps(srcWidth, dstWidth);
+        const auto yTaps = area_taps(srcHeight, dstHeight);
+
+        GrayImage dst(dstWidth, dstHeight);
+        std::vector<u8> scratch(srcWidth);
+        std::vector<float> rowAccum(dstWidth);
+        // Consecutive destination rows share at most one source row, so remembering the last one filtered is enough
+        std::vector<float> filtered(dstWidth);
+        u32 filteredRow = UINT32_MAX;
+        for (u32 dy = 0; dy < dstHeight; dy++) {
+            std::fill(rowAccum.begin(), rowAccum.end(), 0.0f);
+            for (u32 i = yTaps.offsets[dy]; i < yTaps.offsets[dy + 1]; i++) {
+                const u32 sy = yTaps.first[dy] + (i - yTaps.offsets[dy]);
+                if (sy != filteredRow) {
+                    const u8* in = sourceRow(sy, scratch.data());
+                    for (u32 dx = 0; dx < dstWidth; dx++) {
+                        const u8* px = in + xTaps.first[dx];
+                        const float* w = xTaps.weights.data() + xTaps.offsets[dx];
+                        const u32 n = xTaps.offsets[dx + 1] - xTaps.offsets[dx];
+                        float sum = 0;
+                        for (u32 j = 0; j < n; j++) {
+                            sum += w[j] * px[j];
+                        }
+                        filtered[dx] = sum;
+                    }
+                    filteredRow = sy;
+                }
+                const float wy = yTaps.weights[i];
+                for (u32 dx = 0; dx < dstWidth; dx++) {
+                    rowAccum[dx] += wy * filtered[dx];
+                }
+            }
+            u8* out = dst.row(dy);
+            for (u32 dx = 0; dx < dstWidth; dx++) {
+                out[dx] = (u8)std::clamp(rowAccum[dx] + 0.5f, 0.0f, 255.0f);
+            }
+        }
+        return dst;
+    }
+}
+
+GrayImage RTR::downscale_area(const LumaPlaneView& src, u32 dstWidth, u32 dstHeight) {
+    return downscale_area_impl(src.width, src.height, [&](u32 y, u8* scratch) -> const u8* {
+        if (src.shiftTo8Bit == 0)
+            return src.data + (size_t)y * src.linesize;
+        for (u32 x = 0; x < src.width; x++) {
+            scratch[x] = src.at(x, y);
+        }
+        return scratch;
+    }, dstWidth, dstHeight);
+}
+
+GrayImage RTR::downscale_area(const GrayImage& src, u32 dstWidth, u32 dstHeight) {
+    return downscale_area_impl(src.width, src.height, [&](u32 y, u8*) { return src.row(y); }, dstWidth, dstHeight);
+}
+
+GrayImage RTR::reduce_2x(const LumaPlaneView& src) {
+    GrayImage dst(src.width / 2, src.height / 2);
+    for (u32 y = 0; y < dst.height; y++) {
+        const u8* row0 = src.data + (size_t)(2 * y) * src.linesize;
+        const u8* row1 = row0 + src.linesize;
+        u8* out = dst.row(y);
+        u32 x = 0;
+#if RTR_SSE2
+        const __m128i two = _mm_set1_epi16(2);
+        if (src.shiftTo8Bit == 0) {
+            // 16 source pixels per row -> 8 outputs: even pixels are the low bytes of 16-bit lanes, odd ones the high
+            const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+            for (; x + 8 <= dst.width; x += 8) {
+                const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 2 * x));
+                const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 2 * x));
+                __m128i sum = _mm_add_epi16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8));
+                sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8)));
+                sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+            }
+        }
+        else {
+            // 8 source samples per load, truncated to 8 bits first like at() does, so sums stay well inside 16 bits
+            const __m128i shift = _mm_cvtsi32_si128((int)src.shiftTo8Bit);
+            const __m128i lowWords = _mm_set1_epi32(0x0000FFFF);
+            const auto pairSums = [&](const u8* p0, const u8* p1) {
+                const __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)p0), shift);
+                const __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)p1), shift);
+                const __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(a, lowWords), _mm_srli_epi32(a, 16)),
+                    _mm_add_epi32(_mm_and_si128(b, lowWords), _mm_srli_epi32(b, 16)));
+                return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+            };
+            for (; x + 8 <= dst.width; x += 8) {
+                const __m128i lo = pairSums(row0 + 4 * x, row1 + 4 * x);
+                const __m128i hi = pairSums(row0 + 4 * x + 16, row1 + 4 * x + 16);
+                const __m128i words = _mm_packs_epi32(lo, hi);
+                _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(words, words));
+            }
+        }
+#endif
+        for (; x < dst.width; x++) {
+            const u32 sum = src.at(2 * x, 2 * y) + src.at(2 * x + 1, 2 * y) + src.at(2 * x, 2 * y + 1) + src.at(2 * x + 1, 2 * y + 1);
+            out[x] = (u8)((sum + 2) / 4);
+        }
+    }
+    return dst;
+}
+
+GrayImage RTR::reduce_2x(const GrayImage& src) {
+    return reduce_2x(view_of(src));
+}
+
+GrayImage RTR::crop(const GrayImage& src, u32 x, u32 y, u32 width, u32 height) {
+    GrayImage dst(width, height);
+    for (u32 row = 0; row < height; row++) {
+        std::copy_n(src.row(y + row) + x, width, dst.row(row));
+    }
+    return dst;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// CPU-side images for analysis (alignment, shot detection...).
+// Analysis always works on 8-bit luma - 10-bit sources are truncated, which is plenty for matching two cuts against each other.
+
+#include "../Utils/types.h"
+
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+namespace RTR {
+    struct GrayImage {
+        u32 width = 0, height = 0;
+        std::vector<u8> pixels; // Tightly packed, stride == width
+
+        GrayImage() = default;
+        GrayImage(u32 width, u32 height) : width(width), height(height), pixels(width * height) {}
+
+        bool empty() const { return pixels.empty(); }
+        u8* row(u32 y) { return pixels.data() + y * width; }
+        const u8* row(u32 y) const { return pixels.data() + y * width; }
+        u8 at(u32 x, u32 y) const { return pixels[y * width + x]; }
+
+        // Bilinear sample, returns false if (x, y) falls outside the image
+        bool sample(float x, float y, float& out) const;
+    };
+
+    // A view of the luma plane of a decoded (system memory) AVFrame
+    struct LumaPlaneView {
+        const u8* data;
+        int linesize; // in bytes
+        u32 width, height;
+        // 0 for 8-bit formats, otherwise how far to shift a u16 sample right to get 8 bits
+        u32 shiftTo8Bit;
+
+        u8 at(u32 x, u32 y) const {
+            const u8* row = data + (size_t)y * linesize;
+            if (shiftTo8Bit == 0)
+                return row[x];
+            return (u8)(((const u16*)row)[x] >> shiftTo8Bit);
+        }
+        // The rectangle must be inside the plane
+        LumaPlaneView subview(u32 x, u32 y, u32 subWidth, u32 subHeight) const {
+            const u32 bytesPerSample = shiftTo8Bit == 0 ? 1 : 2;
+            return LumaPlaneView{
+                .data = data + (size_t)y * linesize + x * bytesPerSample,
+                .linesize = linesize,
+                .width = subWidth,
+                .height = subHeight,
+                .shiftTo8Bit = shiftTo8Bit,
+            };
+        }
+    };
+    // Throws if the frame isn't in a system memory format we understand (NV12, P010, yuv420p, yuv420p10)
+    LumaPlaneView luma_plane_of(const AVFrame* frame);
+    LumaPlaneView view_of(const GrayImage& image);
+
+    // Full resolution 8-bit copy of the plane
+    GrayImage to_gray_image(const LumaPlaneView& src);
+
+    // The source pixels covering each destination pixel along one axis, and how much of each is covered.
+    // Flattened: destination pixel d uses weights[offsets[d] .. offsets[d + 1]) for source pixels first[d], first[d] + 1, ...
+    struct AreaTaps {
+        std::vector<u32> first;
+        std::vector<u32> offsets;
+        std::vector<float> weights; // Normalized to sum to 1 per destination pixel
+    };
+    AreaTaps area_taps(u32 srcSize, u32 dstSize);
+
+    // Area-average (anti-aliased) downscale
+    GrayImage downscale_area(const LumaPlaneView& src, u32 dstWidth, u32 dstHeight);
+    GrayImage downscale_area(const GrayImage& src, u32 dstWidth, u32 dstHeight);
+
+    // Exact 2x2 box average, dropping an odd last row/column. Much cheaper than downscale_area for the same result.
+    GrayImage reduce_2x(const LumaPlaneView& src);
+    GrayImage reduce_2x(const GrayImage& src);
+
+    // Copy of a rectangle of src. The rectangle must be inside src.
+    GrayImage crop(const GrayImage& src, u32 x, u32 y, u32 width, u32 height);
+}
@@ -0,0 +1,146 @@
+#include "ivtc.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+
+using namespace RTR;
+
+u64 RTR::count_combed_pixels(const GrayImage& firstFieldSource, const GrayImage& secondFieldSource, u32 firstFieldParity, u8 threshold) {
+    const u32 width = firstFieldSource.width, height = firstFieldSource.height;
+    u64 combed = 0;
+    // Second field lines with a first field line on both sides
+    for (u32 y = 1 + firstFieldParity; y + 1 < height; y += 2) {
+        const u8* above = firstFieldSource.row(y - 1);
+        const u8* line = secondFieldSource.row(y);
+        const u8* below = firstFieldSource.row(y + 1);
+        u32 x = 0;
+#if RTR_SSE2
+        const __m128i t = _mm_set1_epi8((char)threshold);
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(above + x));
+            const __m128i l = _mm_loadu_si128((const __m128i*)(line + x));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(below + x));
+            const __m128i hi = _mm_max_epu8(a, b);
+            const __m128i lo = _mm_min_epu8(a, b);
+            // Saturating subtracts are non-zero exactly where line > hi + t or line < lo - t
+            const __m128i brighter = _mm_subs_epu8(_mm_subs_epu8(l, hi), t);
+            const __m128i darker = _mm_subs_epu8(_mm_subs_epu8(lo, l), t);
+            const int notCombed = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(brighter, darker), zero));
+            combed += (u64)std::popcount((u32)(~notCombed & 0xFFFF));
+        }
+#endif
+        for (; x < width; x++) {
+            const int hi = std::max(above[x], below[x]), lo = std::min(above[x], below[x]);
+            if (line[x] > hi + threshold || line[x] < lo - threshold) {
+                combed++;
+            }
+        }
+    }
+    return combed;
+}
+
+float RTR::mean_abs_difference(const GrayImage& a, const GrayImage& b) {
+    u64 sum = 0;
+    const u8* pa = a.pixels.data();
+    const u8* pb = b.pixels.data();
+    const size_t n = a.pixels.size();
+    size_t i = 0;
+#if RTR_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(pa + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(pb + i));
+        // Two 64-bit lanes of partial sums, which can't overflow for any sane image size
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    alignas(16) u64 lanes[2];
+    _mm_store_si128((__m128i*)lanes, acc);
+    sum += lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) {
+        sum += (u64)std::abs((int)pa[i] - (int)pb[i]);
+    }
+    return n ? (float)((double)sum / (double)n) : 0.0f;
+}
+
+namespace {
+    GrayImage weave(const GrayImage& firstFieldSource, const GrayImage& secondFieldSource, u32 firstFieldParity) {
+        GrayImage out(firstFieldSource.width, firstFieldSource.height);
+        for (u32 y = 0; y < out.height; y++) {
+            const auto& source = (y % 2 == firstFieldParity) ? firstFieldSource : secondFieldSource;
+            std::copy_n(source.row(y), out.width, out.row(y));
+        }
+        return out;
+    }
+
+    // Keep the first field, rebuild the second by averaging the lines above and below
+    GrayImage interpolate_second_field(const GrayImage& frame, u32 firstFieldParity) {
+        GrayImage out = frame;
+        const u32 width = frame.width, height = frame.height;
+        for (u32 y = 1 - firstFieldParity; y < height; y += 2) {
+            const u8* above = frame.row(y > 0 ? y - 1 : y + 1);
+            const u8* below = frame.row(y + 1 < height ? y + 1 : y - 1);
+            u8* line = out.row(y);
+            u32 x = 0;
+#if RTR_SSE2
+            for (; x + 16 <= width; x += 16) {
+                const __m128i a = _mm_loadu_si128((const __m128i*)(above + x));
+                const __m128i b = _mm_loadu_si128((const __m128i*)(below + x));
+                _mm_storeu_si128((__m128i*)(line + x), _mm_avg_epu8(a, b));
+            }
+#endif
+            for (; x < width; x++) {
+                line[x] = (u8)((above[x] + below[x] + 1) / 2);
+            }
+        }
+        return out;
+    }
+}
+
+std::optional<GrayImage> InverseTelecine::process(const LumaPlaneView& luma) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    stats.frames++;
+
+    GrayImage current = to_gray_image(luma);
+    const u32 firstFieldParity = topFieldFirst ? 0 : 1;
+    // Same lines as count_combed_pixels looks at
+    u64 combableLines = 0;
+    for (u32 y = 1 + firstFieldParity; y + 1 < current.height; y += 2) {
+        combableLines++;
+    }
+    const u64 maxCombed = (u64)(MAX_COMBED_FRACTION * combableLines * current.width);
+
+    GrayImage output;
+    if (count_combed_pixels(current, current, firstFieldParity, COMB_THRESHOLD) <= maxCombed) {
+        stats.matchedCurrent++;
+        output = current;
+    }
+    else if (previousInput.width == current.width && previousInput.height == current.height &&
+        count_combed_pixels(current, previousInput, firstFieldParity, COMB_THRESHOLD) <= maxCombed) {
+        stats.matchedPrevious++;
+        output = weave(current, previousInput, firstFieldParity);
+    }
+    else {
+        stats.deinterlaced++;
+        output = interpolate_second_field(current, firstFieldParity);
+    }
+    previousInput = std::move(current);
+
+    const bool duplicate = previousOutput.width == output.width && previousOutput.height == output.height &&
+        mean_abs_difference(previousOutput, output) < DUPLICATE_MEAN_ABS_DIFF;
+    if (!duplicate) {
+        previousOutput = output;
+    }
+    else {
+        stats.duplicatesDropped++;
+    }
+
+    stats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (duplicate)
+        return std::nullopt;
+    return output;
+}
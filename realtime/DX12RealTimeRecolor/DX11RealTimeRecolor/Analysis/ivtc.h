@@ -0,0 +1,51 @@
+#pragma once
+
+// Inverse telecine for DVD-sourced 480p luma, before it goes anywhere near alignment or LUT statistics.
+// 3:2 pulldown turns film frames A B C D into fields AA BB BC CD DD, so two in five decoded frames are woven from
+// two different film frames ("combed") and one film frame turns up twice.
+// Each frame's first field is kept, and its second field is taken either from the same frame or from the previous one,
+// whichever is less combed. If neither works (true interlaced video, edits breaking the cadence) the second field is
+// interpolated from the first instead. Repeated film frames are then dropped.
+
+#include "image.h"
+
+#include <optional>
+
+namespace RTR {
+    struct InverseTelecineStats {
+        u64 frames = 0;
+        u64 matchedCurrent = 0;
+        u64 matchedPrevious = 0;
+        u64 deinterlaced = 0;
+        u64 duplicatesDropped = 0;
+        double totalMs = 0.0;
+    };
+
+    // Number of pixels on the second field's lines which stick out from the first field's lines above and below
+    // by more than threshold in the same direction, i.e. look like combing.
+    // firstFieldSource provides the lines of parity firstFieldParity (0 = top field = even lines), secondFieldSource the rest.
+    u64 count_combed_pixels(const GrayImage& firstFieldSource, const GrayImage& secondFieldSource, u32 firstFieldParity, u8 threshold);
+
+    // Mean absolute difference per pixel between two images of the same size
+    float mean_abs_difference(const GrayImage& a, const GrayImage& b);
+
+    struct InverseTelecine {
+        // How far (in 8-bit levels) a line has to stick out from both neighbours to count as combed
+        static constexpr u8 COMB_THRESHOLD = 12;
+        // A weave with more than this fraction of its second-field pixels combed is rejected
+        static constexpr float MAX_COMBED_FRACTION = 0.002f;
+        // Outputs closer than this to the previous output are pulldown repeats
+        static constexpr float DUPLICATE_MEAN_ABS_DIFF = 0.75f;
+
+        // Which field is displayed first. DVDs are nearly always top field first.
+        bool topFieldFirst = true;
+        InverseTelecineStats stats;
+
+        // Returns the progressive frame, or nothing if it repeats the previous one
+        std::optional<GrayImage> process(const LumaPlaneView& luma);
+
+    private:
+        GrayImage previousInput;
+        GrayImage previousOutput;
+    };
+}
@@ -0,0 +1,372 @@
+#include "lab.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+using namespace RTR;
+
+namespace {
+    // The power law segments of rec2020_linearize and cielab_f in includes.hlsl.
+    // Inverting E' = alpha * E^0.45 - (alpha - 1) gives E = ((E' + alpha - 1) / alpha)^(1/0.45), so E' = 1 is E = 1.
+    float rec2020_power_segment(float ePrime) {
+        const float alpha = 1.099f;
+        return std::pow((ePrime + alpha - 1) / alpha, 2.22223f);
+    }
+
+    float cielab_power_segment(float t) {
+        return std::pow(t, 0.3333f);
+    }
+
+    // A smooth curve sampled over [lo, hi] and linearly interpolated, falling back to evaluating it outside that.
+    // The pows are most of the cost of a conversion otherwise.
+    template<float (*F)(float)>
+    struct SampledCurve {
+        static constexpr u32 SAMPLES = 4096;
+        float lo, hi, scale;
+        std::vector<float> values;
+
+        SampledCurve(float lo, float hi) : lo(lo), hi(hi), scale((SAMPLES - 1) / (hi - lo)), values(SAMPLES + 1) {
+            for (u32 i = 0; i < SAMPLES; i++) {
+                values[i] = F(lo + i / scale);
+            }
+            values[SAMPLES] = values[SAMPLES - 1];
+        }
+
+        float operator()(float x) const {
+            if (!(x >= lo && x < hi))
+                return F(x);
+            const float position = (x - lo) * scale;
+            const u32 i = (u32)position;
+            const float t = position - (float)i;
+            return values[i] + (values[i + 1] - values[i]) * t;
+        }
+    };
+
+    // Nominal range Y'CbCr gives R'G'B' within about [-1, 2] and XYZ relative to white within about [0, 3]. Wilder
+    // values still convert, just slower.
+    struct LabTransfer {
+        SampledCurve<rec2020_power_segment> power{ 0.081f, 2.5f };
+        SampledCurve<cielab_power_segment> cubeRoot{ 0.008856f, 3.0f };
+
+        float linearize(float ePrime) const {
+            const float beta = 0.018f;
+            if (ePrime <= beta * 4.5f)
+                return ePrime / 4.5f;
+            return power(ePrime);
+        }
+
+        float f(float t) const {
+            if (t > 0.008856f)
+                return cubeRoot(t);
+            return 7.787f * t + 4.0f / 29.0f;
+        }
+    };
+
+    const LabTransfer& lab_transfer() {
+        static const LabTransfer transfer;
+        return transfer;
+    }
+}
+
+Lab RTR::yuv_rec2020_10bit_to_cielab(float y, float cb, float cr) {
+    const auto& transfer = lab_transfer();
+
+    const float yPrime = (y / 4.0f - 16.0f) / 219.0f;
+    const float crPrime = (cr / 4.0f - 128.0f) / 224.0f;
+    const float cbPrime = (cb / 4.0f - 128.0f) / 224.0f;
+
+    const float rPrime = 1.4746f * crPrime + yPrime;
+    const float bPrime = 1.8814f * cbPrime + yPrime;
+    const float gPrime = (yPrime - 0.2627f * rPrime - 0.0593f * bPrime) / 0.6780f;
+    const float r = transfer.linearize(rPrime), g = transfer.linearize(gPrime), b = transfer.linearize(bPrime);
+
+    // lin_rgb_to_xyz_matrix, divided by xyz_reference_white
+    const float fx = transfer.f((0.708f * r + 0.292f * g) / 0.95048f);
+    const float fy = transfer.f(0.170f * r + 0.797f * g + 0.033f * b);
+    const float fz = transfer.f((0.131f * r + 0.046f * g + 0.823f * b) / 1.088840f);
+    return Lab{
+        .L = 116.0f * fy - 16.0f,
+        .a = 500.0f * (fx - fy),
+        .b = 200.0f * (fy - fz),
+    };
+}
+
+namespace {
+    // Area filter over one plane of u16 samples, a destination row at a time. Unlike downscale_area this sums source
+    // rows vertically first - a straight multiply-add over whole rows, which vectorizes - so the horizontal taps only
+    // run once per destination row instead of once per source row.
+    struct PlaneDownscaler {
+        const u8* data;
+        int linesize;
+        u32 samplesPerRow; // Both components for the interleaved CbCr plane of P010
+        AreaTaps yTaps;
+        std::vector<float> columnSums;
+
+        PlaneDownscaler(const u8* data, int linesize, u32 samplesPerRow, u32 srcHeight, u32 dstHeight)
+            : data(data), linesize(linesize), samplesPerRow(samplesPerRow), yTaps(area_taps(srcHeight, dstHeight)), columnSums(samplesPerRow) {}
+
+        // Area-weighted sums of the source rows under destination row dy, for source samples [x0, x1) of the row.
+        // The returned row is indexed from the start of the row; only [x0, x1) is valid.
+        const float* sumRows(u32 dy, u32 x0, u32 x1) {
+            std::fill(columnSums.begin() + x0, columnSums.begin() + x1, 0.0f);
+            for (u32 i = yTaps.offsets[dy]; i < yTaps.offsets[dy + 1]; i++) {
+                const u32 sy = yTaps.first[dy] + (i - yTaps.offsets[dy]);
+                const u16* in = (const u16*)(data + (size_t)sy * linesize);
+                const float wy = yTaps.weights[i];
+                float* sums = columnSums.data();
+                u32 x = x0;
+#if RTR_SSE2
+                const __m128 w = _mm_set1_ps(wy);
+                const __m128i zero = _mm_setzero_si128();
+                for (; x + 8 <= x1; x += 8) {
+                    const __m128i samples = _mm_loadu_si128((const __m128i*)(in + x));
+                    const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, zero));
+                    const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(samples, zero));
+                    _mm_storeu_ps(sums + x, _mm_add_ps(_mm_loadu_ps(sums + x), _mm_mul_ps(w, lo)));
+                    _mm_storeu_ps(sums + x + 4, _mm_add_ps(_mm_loadu_ps(sums + x + 4), _mm_mul_ps(w, hi)));
+                }
+#endif
+                for (; x < x1; x++) {
+                    sums[x] += wy * in[x];
+                }
+            }
+            return columnSums.data();
+        }
+    };
+
+    // Horizontal area filter over every step-th value starting at in[0], for destination pixels [dx0, dx1)
+    void filter_row(const float* in, u32 step, const AreaTaps& xTaps, float* out, u32 dx0, u32 dx1) {
+        for (u32 dx = dx0; dx < dx1; dx++) {
+            const float* px = in + (size_t)xTaps.first[dx] * step;
+            const float* w = xTaps.weights.data() + xTaps.offsets[dx];
+            const u32 n = xTaps.offsets[dx + 1] - xTaps.offsets[dx];
+            float sum = 0;
+            for (u32 j = 0; j < n; j++) {
+                sum += w[j] * px[j * step];
+            }
+            out[dx] = sum;
+        }
+    }
+
+    // The source samples [first, end) under destination pixels [dx0, dx1)
+    std::pair<u32, u32> source_span(const AreaTaps& taps, u32 dx0, u32 dx1) {
+        return { taps.first[dx0], taps.first[dx1 - 1] + (taps.offsets[dx1] - taps.offsets[dx1 - 1]) };
+    }
+
+    // downscale_area_to_lab, any run of destination pixels at a time
+    struct AreaToLab {
+        u32 dstWidth, dstHeight;
+        AreaTaps xTaps, chromaXTaps;
+        bool interleavedChroma;
+        std::optional<PlaneDownscaler> luma, cbcr, cb, cr;
+        std::vector<float> yRow, cbRow, crRow;
+
+        AreaToLab(const AVFrame* frame, const PixelRect& area, u32 dstWidth, u32 dstHeight) : dstWidth(dstWidth), dstHeight(dstHeight) {
+            if (dstWidth == 0 || dstHeight == 0)
+                throw std::invalid_argument("Lab image must not be empty");
+            if (area.empty() || area.x % 2 || area.y % 2 || area.x + area.width > (u32)frame->width || area.y + area.height > (u32)frame->height)
+                throw std::invalid_argument("Lab conversion area must be inside the frame and start on a chroma sample");
+            const u32 width = area.width, height = area.height;
+            const u32 chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+            const u32 chromaX = area.x / 2, chromaY = area.y / 2;
+
+            float toCodeValue;
+            switch (frame->format) {
+            case AV_PIX_FMT_P010LE:
+                // Samples are in the top 10 bits, Cb and Cr interleaved in plane 1
+                toCodeValue = 1.0f / 64.0f;
+                interleavedChroma = true;
+                break;
+            case AV_PIX_FMT_YUV420P10LE:
+                toCodeValue = 1.0f;
+                interleavedChroma = false;
+                break;
+            default:
+                throw std::runtime_error(std::string("Can't convert frames of format ") + av_get_pix_fmt_name((AVPixelFormat)frame->format) + " to Lab");
+            }
+
+            // Converting to code values is folded into the horizontal weights. Chroma sample siting is ignored like the
+            // shader does: each destination pixel averages the chroma samples under its footprint in the chroma plane.
+            xTaps = area_taps(width, dstWidth);
+            chromaXTaps = area_taps(chromaWidth, dstWidth);
+            for (float& w : xTaps.weights) {
+                w *= toCodeValue;
+            }
+            for (float& w : chromaXTaps.weights) {
+                w *= toCodeValue;
+            }
+
+            // Samples are all 16 bits, so the area's top left corner in a plane is just an offset
+            const auto start = [&](u32 plane, u32 x, u32 y) {
+                return frame->data[plane] + (size_t)y * frame->linesize[plane] + (size_t)x * sizeof(u16);
+            };
+            luma.emplace(start(0, area.x, area.y), frame->linesize[0], width, height, dstHeight);
+            if (interleavedChroma) {
+                cbcr.emplace(start(1, 2 * chromaX, chromaY), frame->linesize[1], 2 * chromaWidth, chromaHeight, dstHeight);
+            }
+            else {
+                cb.emplace(start(1, chromaX, chromaY), frame->linesize[1], chromaWidth, chromaHeight, dstHeight);
+                cr.emplace(start(2, chromaX, chromaY), frame->linesize[2], chromaWidth, chromaHeight, dstHeight);
+            }
+            yRow.resize(dstWidth);
+            cbRow.resize(dstWidth);
+            crRow.resize(dstWidth);
+        }
+
+        // Destination row dy's luma taps, for finding which source rows it covers
+        const AreaTaps& yTaps() const { return luma->yTaps; }
+
+        // Converts destination pixels [dx0, dx1) of row dy into dst, only reading the source samples under them
+        void convert(u32 dy, u32 dx0, u32 dx1, LabImage& dst) {
+            const auto [x0, x1] = source_span(xTaps, dx0, dx1);
+            filter_row(luma->sumRows(dy, x0, x1), 1, xTaps, yRow.data(), dx0, dx1);
+            const auto [c0, c1] = source_span(chromaXTaps, dx0, dx1);
+            if (interleavedChroma) {
+                const float* sums = cbcr->sumRows(dy, 2 * c0, 2 * c1);
+                filter_row(sums, 2, chromaXTaps, cbRow.data(), dx0, dx1);
+                filter_row(sums + 1, 2, chromaXTaps, crRow.data(), dx0, dx1);
+            }
+            else {
+                filter_row(cb->sumRows(dy, c0, c1), 1, chromaXTaps, cbRow.data(), dx0, dx1);
+                filter_row(cr->sumRows(dy, c0, c1), 1, chromaXTaps, crRow.data(), dx0, dx1);
+            }
+
+            const size_t rowStart = (size_t)dy * dstWidth;
+            for (u32 dx = dx0; dx < dx1; dx++) {
+                const Lab lab = yuv_rec2020_10bit_to_cielab(yRow[dx], cbRow[dx], crRow[dx]);
+                dst.L[rowStart + dx] = lab.L;
+                dst.a[rowStart + dx] = lab.a;
+                dst.b[rowStart + dx] = lab.b;
+            }
+        }
+    };
+
+    // Along one axis, the motion blocks under each destination pixel's footprint: [first, last], and the one under its
+    // centre, whose motion it follows
+    struct BlockSpan {
+        u32 first, last, centre;
+    };
+    std::vector<BlockSpan> block_spans(const AreaTaps& taps, u32 dstSize, u32 areaStart, u32 numBlocks) {
+        std::vector<BlockSpan> spans(dstSize);
+        for (u32 d = 0; d < dstSize; d++) {
+            const auto [first, end] = source_span(taps, d, d + 1);
+            spans[d] = BlockSpan{
+                .first = std::min((areaStart + first) / MotionField::BLOCK_SIZE, numBlocks - 1),
+                .last = std::min((areaStart + end - 1) / MotionField::BLOCK_SIZE, numBlocks - 1),
+                .centre = std::min((areaStart + (first + end) / 2) / MotionField::BLOCK_SIZE, numBlocks - 1),
+            };
+        }
+        return spans;
+    }
+
+    float bilinear(const std::vector<float>& plane, u32 width, float x, float y) {
+        const u32 x0 = std::min((u32)x, width - 1), y0 = (u32)y;
+        const u32 x1 = std::min(x0 + 1, width - 1);
+        const float fx = x - (float)x0, fy = y - (float)y0;
+        const float* row0 = plane.data() + (size_t)y0 * width;
+        // y is at most the last row, where fy is 0 and the row below is never needed
+        const float* row1 = fy > 0 ? row0 + width : row0;
+        const float top = row0[x0] + fx * (row0[x1] - row0[x0]);
+        const float bottom = row1[x0] + fx * (row1[x1] - row1[x0]);
+        return top + fy * (bottom - top);
+    }
+}
+
+LabImage RTR::downscale_area_to_lab(const AVFrame* frame, u32 dstWidth, u32 dstHeight) {
+    return downscale_area_to_lab(frame, PixelRect::whole((u32)frame->width, (u32)frame->height), dstWidth, dstHeight);
+}
+
+LabImage RTR::downscale_area_to_lab(const AVFrame* frame, const PixelRect& area, u32 dstWidth, u32 dstHeight) {
+    AreaToLab converter(frame, area, dstWidth, dstHeight);
+    LabImage dst(dstWidth, dstHeight);
+    for (u32 dy = 0; dy < dstHeight; dy++) {
+        converter.convert(dy, 0, dstWidth, dst);
+    }
+    return dst;
+}
+
+LabImage RTR::downscale_area_to_lab(const AVFrame* frame, const PixelRect& area, const LabImage& previous, const MotionField& motion,
+    u32* convertedPixels) {
+    if (motion.frameWidth != (u32)frame->width || motion.frameHeight != (u32)frame->height)
+        throw std::invalid_argument("Motion field must be of the frame being converted");
+    const u32 dstWidth = previous.width, dstHeight = previous.height;
+    AreaToLab converter(frame, area, dstWidth, dstHeight);
+    const auto columnBlocks = block_spans(converter.xTaps, dstWidth, area.x, motion.blocksX);
+    const auto rowBlocks = block_spans(converter.yTaps(), dstHeight, area.y, motion.blocksY);
+    // Block motion is in frame pixels, destination pixels are bigger
+    const float scaleX = (float)dstWidth / (float)area.width, scaleY = (float)dstHeight / (float)area.height;
+
+    LabImage dst(dstWidth, dstHeight);
+    u32 converted = 0;
+    // Per destination pixel of the current row, the motion it follows if every block under it is Predicted.
+    // Destination rows are a few to a block, so this only changes when the row's blocks do.
+    std::vector<const MotionField::Block*> rowMotion(dstWidth);
+    const BlockSpan* rowMotionFor = nullptr;
+    for (u32 dy = 0; dy < dstHeight; dy++) {
+        const BlockSpan& rows = rowBlocks[dy];
+        if (!rowMotionFor || rows.first != rowMotionFor->first || rows.last != rowMotionFor->last || rows.centre != rowMotionFor->centre) {
+            for (u32 dx = 0; dx < dstWidth; dx++) {
+                const BlockSpan& columns = columnBlocks[dx];
+                bool predicted = true;
+                for (u32 by = rows.first; by <= rows.last && predicted; by++) {
+                    for (u32 bx = columns.first; bx <= columns.last && predicted; bx++) {
+                        predicted = motion.blocks[by * motion.blocksX + bx].state == MotionField::BlockState::Predicted;
+                    }
+                }
+                rowMotion[dx] = predicted ? &motion.blocks[rows.centre * motion.blocksX + columns.centre] : nullptr;
+            }
+            rowMotionFor = &rows;
+        }
+
+        const size_t rowStart = (size_t)dy * dstWidth;
+        const auto carry = [&](u32 dx) {
+            const MotionField::Block* block = rowMotion[dx];
+            if (!block)
+                return false;
+            if (block->dx == 0 && block->dy == 0) {
+                // Static content, by far the most common
+                dst.L[rowStart + dx] = previous.L[rowStart + dx];
+                dst.a[rowStart + dx] = previous.a[rowStart + dx];
+                dst.b[rowStart + dx] = previous.b[rowStart + dx];
+                return true;
+            }
+            // Where the pixel was in the previous frame. Anything coming in from outside the area was never converted.
+            const float px = (float)dx - block->dx * scaleX, py = (float)dy - block->dy * scaleY;
+            if (px < 0 || py < 0 || px > (float)(dstWidth - 1) || py > (float)(dstHeight - 1))
+                return false;
+            dst.L[rowStart + dx] = bilinear(previous.L, dstWidth, px, py);
+            dst.a[rowStart + dx] = bilinear(previous.a, dstWidth, px, py);
+            dst.b[rowStart + dx] = bilinear(previous.b, dstWidth, px, py);
+            return true;
+        };
+        // Runs of pixels that can't be carried over are converted together, so neighbours share their column sums
+        u32 dx = 0;
+        while (dx < dstWidth) {
+            if (carry(dx)) {
+                dx++;
+                continue;
+            }
+            const u32 runStart = dx;
+            while (dx < dstWidth && !carry(dx)) {
+                dx++;
+            }
+            converter.convert(dy, runStart, dx, dst);
+            converted += dx - runStart;
+        }
+    }
+    if (convertedPixels) {
+        *convertedPixels = converted;
+    }
+    return dst;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// CIELAB analysis images, for comparing the colours of the two cuts on the CPU.
+// The conversion mirrors yuv_rec2020_10bit_to_linear_rgb -> linear_rgb_to_xyz -> xyz_to_cielab in includes.hlsl, so
+// anything fitted against these agrees with what yuv_rec2020_to_cielab_comp.hlsl produces. Keep the two in sync.
+
+#include "image.h"
+#include "letterbox.h"
+#include "motionfield.h"
+
+#include <vector>
+
+namespace RTR {
+    struct Lab {
+        float L, a, b;
+    };
+
+    // Planar, tightly packed
+    struct LabImage {
+        u32 width = 0, height = 0;
+        std::vector<float> L, a, b;
+
+        LabImage() = default;
+        LabImage(u32 width, u32 height) : width(width), height(height), L(width * height), a(width * height), b(width * height) {}
+
+        bool empty() const { return L.empty(); }
+        Lab at(u32 x, u32 y) const {
+            const size_t i = (size_t)y * width + x;
+            return Lab{ .L = L[i], .a = a[i], .b = b[i] };
+        }
+    };
+
+    // BT.2020 Y'CbCr in 10-bit code values (fractional values are fine, e.g. averages) to CIELAB
+    Lab yuv_rec2020_10bit_to_cielab(float y, float cb, float cr);
+
+    // Area-average (anti-aliased) downscale of a 10-bit 4:2:0 frame (P010 or yuv420p10) to any size, converting to Lab
+    // in the same pass - the full resolution Lab frame never exists. Y' and CbCr are averaged as code values and each
+    // destination pixel converted once, rather than converting every source pixel and averaging the colours: much
+    // cheaper, and within rounding of the same thing except across hard edges.
+    // Throws if the frame isn't 10-bit 4:2:0 in system memory.
+    LabImage downscale_area_to_lab(const AVFrame* frame, u32 dstWidth, u32 dstHeight);
+    // Same, for just the given area of the frame (e.g. inside the letterbox bars). x and y must be even.
+    LabImage downscale_area_to_lab(const AVFrame* frame, const PixelRect& area, u32 dstWidth, u32 dstHeight);
+    // Same, carrying over what it can from previous (the frame before, converted over the same area at the same size)
+    // along the codec's motion vectors in motion, which must be frame's. Pixels entirely over Predicted blocks are
+    // resampled from where their block came from; only the ones touching intra-coded or badly predicted blocks are
+    // converted again, so the cost follows how much of the frame actually changed. Residuals aren't exported, so
+    // carried pixels can drift from the frame's own until the next keyframe, which has no vectors.
+    // Sets convertedPixels (if given) to how many pixels were converted rather than carried.
+    LabImage downscale_area_to_lab(const AVFrame* frame, const PixelRect& area, const LabImage& previous, const MotionField& motion,
+        u32* convertedPixels = nullptr);
+}
@@ -0,0 +1,186 @@
+#include "letterbox.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <utility>
+
+using namespace RTR;
+
+PixelRect PixelRect::resizedInward(u32 fromWidth, u32 fromHeight, u32 toWidth, u32 toHeight) const {
+    const auto inward = [](u32 start, u32 size, u32 from, u32 to) {
+        // First destination pixel starting at or after start, last one ending at or before start + size
+        const u32 first = (u32)(((u64)start * to + from - 1) / from);
+        const u32 end = (u32)((u64)(start + size) * to / from);
+        return std::pair{ first, end > first ? end - first : 0 };
+    };
+    const auto [newX, newWidth] = inward(x, width, fromWidth, toWidth);
+    const auto [newY, newHeight] = inward(y, height, fromHeight, toHeight);
+    return PixelRect{ .x = newX, .y = newY, .width = newWidth, .height = newHeight };
+}
+
+namespace {
+    constexpr u32 STRIP = 16;
+
+    bool is_bright(const LumaPlaneView& luma, u32 x, u32 y, u8 threshold) {
+        return luma.at(x, y) > threshold;
+    }
+
+#if RTR_SSE2
+    // Lanes of the 16 samples at (x, y) above threshold, as one bit per sample
+    u32 bright_mask(const LumaPlaneView& luma, u32 x, u32 y, u8 threshold) {
+        const u8* row = luma.data + (size_t)y * luma.linesize;
+        if (luma.shiftTo8Bit == 0) {
+            // Saturating subtract leaves zero exactly where the sample is at most the threshold
+            const __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+            const __m128i dark = _mm_cmpeq_epi8(_mm_subs_epu8(v, _mm_set1_epi8((char)threshold)), _mm_setzero_si128());
+            return ~(u32)_mm_movemask_epi8(dark) & 0xFFFF;
+        }
+        // Shifted down to 8 bits the samples fit signed 16-bit compares
+        const __m128i shift = _mm_cvtsi32_si128((int)luma.shiftTo8Bit);
+        const __m128i limit = _mm_set1_epi16(threshold);
+        const u16* samples = (const u16*)row + x;
+        const __m128i lo = _mm_cmpgt_epi16(_mm_srl_epi16(_mm_loadu_si128((const __m128i*)samples), shift), limit);
+        const __m128i hi = _mm_cmpgt_epi16(_mm_srl_epi16(_mm_loadu_si128((const __m128i*)(samples + 8)), shift), limit);
+        return (u32)_mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+    }
+#else
+    u32 bright_mask(const LumaPlaneView& luma, u32 x, u32 y, u8 threshold) {
+        u32 mask = 0;
+        for (u32 i = 0; i < STRIP; i++) {
+            mask |= is_bright(luma, x + i, y, threshold) ? 1u << i : 0;
+        }
+        return mask;
+    }
+#endif
+
+    bool row_is_black(const LumaPlaneView& luma, u32 y, u8 threshold) {
+        u32 x = 0;
+        for (; x + STRIP <= luma.width; x += STRIP) {
+            if (bright_mask(luma, x, y, threshold))
+                return false;
+        }
+        for (; x < luma.width; x++) {
+            if (is_bright(luma, x, y, threshold))
+                return false;
+        }
+        return true;
+    }
+
+    // Which of the STRIP columns starting at x have anything bright in rows [y0, y1)
+    u32 bright_columns(const LumaPlaneView& luma, u32 x, u32 y0, u32 y1, u8 threshold) {
+        u32 mask = 0;
+        for (u32 y = y0; y < y1 && mask != 0xFFFF; y++) {
+            mask |= bright_mask(luma, x, y, threshold);
+        }
+        return mask;
+    }
+
+    bool column_is_black(const LumaPlaneView& luma, u32 x, u32 y0, u32 y1, u8 threshold) {
+        for (u32 y = y0; y < y1; y++) {
+            if (is_bright(luma, x, y, threshold))
+                return false;
+        }
+        return true;
+    }
+
+    // [left, right) x [top, bottom) grown to even coordinates, so the area is whole 4:2:0 chroma samples
+    PixelRect even_rect(u32 left, u32 top, u32 right, u32 bottom, u32 width, u32 height) {
+        left &= ~1u;
+        top &= ~1u;
+        right = std::min(width, (right + 1) & ~1u);
+        bottom = std::min(height, (bottom + 1) & ~1u);
+        return PixelRect{ .x = left, .y = top, .width = right - left, .height = bottom - top };
+    }
+}
+
+PixelRect RTR::detect_active_area(const LumaPlaneView& luma, u8 blackThreshold) {
+    u32 top = 0, bottom = luma.height;
+    while (top < bottom && row_is_black(luma, top, blackThreshold)) {
+        top++;
+    }
+    if (top == bottom)
+        return PixelRect{};
+    while (row_is_black(luma, bottom - 1, blackThreshold)) {
+        bottom--;
+    }
+
+    // Columns in whole strips where possible, the last strip on each side overlapping ones already found to be black
+    u32 left = 0, right = luma.width;
+    if (luma.width >= STRIP) {
+        for (u32 x = 0;; x += STRIP) {
+            const u32 strip = std::min(x, luma.width - STRIP);
+            if (const u32 mask = bright_columns(luma, strip, top, bottom, blackThreshold)) {
+                left = strip + (u32)std::countr_zero(mask);
+                break;
+            }
+        }
+        for (u32 end = luma.width;; end -= STRIP) {
+            const u32 strip = end >= STRIP ? end - STRIP : 0;
+            if (const u32 mask = bright_columns(luma, strip, top, bottom, blackThreshold)) {
+                right = strip + 32 - (u32)std::countl_zero(mask);
+                break;
+            }
+        }
+    }
+    else {
+        while (column_is_black(luma, left, top, bottom, blackThreshold)) {
+            left++;
+        }
+        while (column_is_black(luma, right - 1, top, bottom, blackThreshold)) {
+            right--;
+        }
+    }
+
+    return even_rect(left, top, right, bottom, luma.width, luma.height);
+}
+
+PixelRect RTR::active_area_of_lines(std::span<const u32> rowBright, std::span<const u32> columnBright) {
+    const auto first = [](std::span<const u32> lines) {
+        return (u32)(std::find_if(lines.begin(), lines.end(), [](u32 bright) { return bright != 0; }) - lines.begin());
+    };
+    const auto end = [](std::span<const u32> lines) {
+        return (u32)(lines.rend() - std::find_if(lines.rbegin(), lines.rend(), [](u32 bright) { return bright != 0; }));
+    };
+    const u32 width = (u32)columnBright.size(), height = (u32)rowBright.size();
+    const u32 top = first(rowBright), left = first(columnBright);
+    if (top == height || left == width)
+        return PixelRect{};
+    return even_rect(left, top, end(columnBright), end(rowBright), width, height);
+}
+
+PixelRect LetterboxDetector::update(const LumaPlaneView& luma) {
+    auto start = std::chrono::high_resolution_clock::now();
+    stats.frames++;
+    if (luma.width != frameWidth || luma.height != frameHeight) {
+        area.reset();
+        frameWidth = luma.width;
+        frameHeight = luma.height;
+    }
+
+    if (area) {
+        // Only the first row and column past each edge - anything the picture grows into crosses those
+        const auto& a = *area;
+        const u32 bottom = a.y + a.height, right = a.x + a.width;
+        const bool barsBlack =
+            (a.y == 0 || row_is_black(luma, a.y - 1, BLACK_THRESHOLD)) &&
+            (bottom == luma.height || row_is_black(luma, bottom, BLACK_THRESHOLD)) &&
+            (a.x == 0 || column_is_black(luma, a.x - 1, a.y, bottom, BLACK_THRESHOLD)) &&
+            (right == luma.width || column_is_black(luma, right, a.y, bottom, BLACK_THRESHOLD));
+        if (!barsBlack) {
+            stats.invalidations++;
+            area.reset();
+        }
+    }
+    if (!area) {
+        stats.detections++;
+        const auto detected = detect_active_area(luma, BLACK_THRESHOLD);
+        if (!detected.empty()) {
+            area = detected;
+        }
+    }
+
+    stats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return area ? *area : PixelRect::whole(luma.width, luma.height);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// Black bars (letterboxing/pillarboxing) around the picture. The 2160p release is 3840x2160 with only about 3840x1600
+// active, so every per-pixel stage can skip a quarter of the frame. Replaces crop_letterbox in the notebook, which runs
+// np.nonzero over the whole image.
+
+#include "image.h"
+
+#include <optional>
+#include <span>
+
+namespace RTR {
+    struct PixelRect {
+        u32 x = 0, y = 0, width = 0, height = 0;
+
+        bool empty() const { return width == 0 || height == 0; }
+        bool contains(u32 px, u32 py) const { return px >= x && py >= y && px - x < width && py - y < height; }
+        bool operator==(const PixelRect&) const = default;
+
+        static PixelRect whole(u32 width, u32 height) { return PixelRect{ .x = 0, .y = 0, .width = width, .height = height }; }
+        // The part of this rect (in a fromWidth x fromHeight image) that is entirely inside it once the image is resized
+        // to toWidth x toHeight. Rounds inwards, so resampled pixels never pick up any of what's outside.
+        PixelRect resizedInward(u32 fromWidth, u32 fromHeight, u32 toWidth, u32 toHeight) const;
+    };
+
+    // Smallest rectangle outside which every row and column is black (no sample above blackThreshold, in 8-bit terms),
+    // grown to even coordinates so it lines up with 4:2:0 chroma. Scans inwards from each edge, so the cost depends on
+    // the size of the bars rather than the frame. Empty if the whole frame is black.
+    PixelRect detect_active_area(const LumaPlaneView& luma, u8 blackThreshold);
+    // The same rectangle from per-row and per-column flags (nonzero if anything in that row/column is bright), as
+    // letterbox_detect_comp.hlsl produces them for frames that never reach system memory
+    PixelRect active_area_of_lines(std::span<const u32> rowBright, std::span<const u32> columnBright);
+
+    struct LetterboxStats {
+        u64 frames = 0;
+        u64 detections = 0;
+        // Frames where something showed up in the bars, forcing a detection mid-shot
+        u64 invalidations = 0;
+        double totalMs = 0.0;
+    };
+
+    // Keeps the active area for the current shot - it never changes within one, and rarely between them. Each frame
+    // only checks that the bars are still black, which catches the picture growing without waiting for a shot cut.
+    struct LetterboxDetector {
+        // Video black is 16, leave a little room for noise and ringing
+        static constexpr u8 BLACK_THRESHOLD = 24;
+
+        LetterboxStats stats;
+
+        // The next update detects from scratch
+        void newShot() { area.reset(); }
+        // Active area of this frame. All black frames (fades) count as all active, and don't get cached.
+        PixelRect update(const LumaPlaneView& luma);
+        const std::optional<PixelRect>& cachedArea() const { return area; }
+
+    private:
+        std::optional<PixelRect> area;
+        u32 frameWidth = 0, frameHeight = 0;
+    };
+}
@@ -0,0 +1,154 @@
+#include "motionfield.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/motion_vector.h>
+}
+
+using namespace RTR;
+
+bool RTR::codec_exports_motion_vectors(AVCodecID codec) {
+    switch (codec) {
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_MPEG1VIDEO:
+    case AV_CODEC_ID_MPEG2VIDEO:
+    case AV_CODEC_ID_MPEG4:
+    case AV_CODEC_ID_H263:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void MotionField::resize(u32 width, u32 height) {
+    if (width == frameWidth && height == frameHeight)
+        return;
+    frameWidth = width;
+    frameHeight = height;
+    blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blocks.resize(blocksX * blocksY);
+    coverage.resize(blocksX * blocksY);
+}
+
+void MotionField::markAllIntra() {
+    for (auto& block : blocks) {
+        block = Block{ .dx = 0, .dy = 0, .state = BlockState::Intra };
+    }
+}
+
+bool MotionField::update(const AVFrame* frame) {
+    resize((u32)frame->width, (u32)frame->height);
+
+    const AVFrameSideData* sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    hasVectors = sd != nullptr;
+    if (!sd) {
+        markAllIntra();
+        return false;
+    }
+
+    // Accumulate area-weighted motion for each of our blocks
+    for (auto& block : blocks) {
+        block = Block{ .dx = 0, .dy = 0, .state = BlockState::Intra };
+    }
+    std::fill(coverage.begin(), coverage.end(), 0.0f);
+
+    const auto* mvs = (const AVMotionVector*)sd->data;
+    const size_t numMvs = sd->size / sizeof(AVMotionVector);
+    for (size_t i = 0; i < numMvs; i++) {
+        const AVMotionVector& mv = mvs[i];
+        // The vector says "the block at dst was predicted from src in a reference frame".
+        // For past references that's motion from src to dst. For future references, assume constant velocity
+        // and flip it, because we only care about roughly where things came from in the previous frame.
+        float dx = (float)(mv.dst_x - mv.src_x);
+        float dy = (float)(mv.dst_y - mv.src_y);
+        if (mv.source > 0) {
+            dx = -dx;
+            dy = -dy;
+        }
+
+        // dst_x/y is the center of the codec block
+        int left = mv.dst_x - mv.w / 2;
+        int top = mv.dst_y - mv.h / 2;
+        int right = left + mv.w;
+        int bottom = top + mv.h;
+
+        u32 bx0 = (u32)std::clamp(left / (int)BLOCK_SIZE, 0, (int)blocksX - 1);
+        u32 bx1 = (u32)std::clamp((right - 1) / (int)BLOCK_SIZE, 0, (int)blocksX - 1);
+        u32 by0 = (u32)std::clamp(top / (int)BLOCK_SIZE, 0, (int)blocksY - 1);
+        u32 by1 = (u32)std::clamp((bottom - 1) / (int)BLOCK_SIZE, 0, (int)blocksY - 1);
+        for (u32 by = by0; by <= by1; by++) {
+            for (u32 bx = bx0; bx <= bx1; bx++) {
+                int overlapW = std::min(right, (int)((bx + 1) * BLOCK_SIZE)) - std::max(left, (int)(bx * BLOCK_SIZE));
+                int overlapH = std::min(bottom, (int)((by + 1) * BLOCK_SIZE)) - std::max(top, (int)(by * BLOCK_SIZE));
+                if (overlapW <= 0 || overlapH <= 0)
+                    continue;
+                float area = (float)(overlapW * overlapH);
+                auto& block = blocks[by * blocksX + bx];
+                block.dx += dx * area;
+                block.dy += dy * area;
+                coverage[by * blocksX + bx] += area;
+            }
+        }
+    }
+
+    // Normalize, and mark anything mostly uncovered as intra-coded
+    const float blockArea = (float)(BLOCK_SIZE * BLOCK_SIZE);
+    for (u32 i = 0; i < blocks.size(); i++) {
+        if (coverage[i] >= MIN_COVERAGE * blockArea) {
+            blocks[i].dx /= coverage[i];
+            blocks[i].dy /= coverage[i];
+            blocks[i].state = BlockState::Predicted;
+        }
+        else {
+            blocks[i] = Block{ .dx = 0, .dy = 0, .state = BlockState::Intra };
+        }
+    }
+
+    // We don't get residuals from libavcodec, so use disagreement with the neighbourhood as a proxy for a bad prediction.
+    // Compare against the component-wise median of the predicted 3x3 neighbours.
+    for (u32 by = 0; by < blocksY; by++) {
+        for (u32 bx = 0; bx < blocksX; bx++) {
+            auto& block = blocks[by * blocksX + bx];
+            if (block.state != BlockState::Predicted)
+                continue;
+
+            std::array<float, 9> xs, ys;
+            u32 n = 0;
+            for (int ny = (int)by - 1; ny <= (int)by + 1; ny++) {
+                for (int nx = (int)bx - 1; nx <= (int)bx + 1; nx++) {
+                    if (nx < 0 || ny < 0 || nx >= (int)blocksX || ny >= (int)blocksY)
+                        continue;
+                    const auto& neighbour = blocks[ny * blocksX + nx];
+                    // Incoherent blocks already marked this pass still have valid motion for the median
+                    if (neighbour.state == BlockState::Intra)
+                        continue;
+                    xs[n] = neighbour.dx;
+                    ys[n] = neighbour.dy;
+                    n++;
+                }
+            }
+            std::nth_element(xs.begin(), xs.begin() + n / 2, xs.begin() + n);
+            std::nth_element(ys.begin(), ys.begin() + n / 2, ys.begin() + n);
+            float devX = block.dx - xs[n / 2];
+            float devY = block.dy - ys[n / 2];
+            if (devX * devX + devY * devY > MAX_INCOHERENCE * MAX_INCOHERENCE) {
+                block.state = BlockState::Incoherent;
+            }
+        }
+    }
+
+    return true;
+}
+
+float MotionField::recomputeFraction() const {
+    if (blocks.empty())
+        return 1.0f;
+    size_t needsRecompute = std::count_if(blocks.begin(), blocks.end(), [](const Block& b) {
+        return b.state != BlockState::Predicted;
+    });
+    return (float)needsRecompute / (float)blocks.size();
+}
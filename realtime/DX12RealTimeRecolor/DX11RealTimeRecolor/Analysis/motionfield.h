@@ -0,0 +1,65 @@
+#pragma once
+
+// Per-block motion of a decoded frame, taken from the codec's own motion vectors.
+// libavcodec only exports these (AV_FRAME_DATA_MOTION_VECTORS) from software decoders opened with +export_mvs, and only
+// the H.264 and MPEG-1/2/4 family ones do - not HEVC, so not UHD Blu-ray sources. Frames without them are treated as
+// "everything changed".
+// The field hints at shot cuts (how much of the frame is new), and lets downscale_area_to_lab carry the previous 2160p
+// Lab image over, only converting intra-coded and badly predicted blocks again.
+
+#include "../Utils/types.h"
+
+#include <vector>
+
+extern "C" {
+#include <libavcodec/codec_id.h>
+#include <libavutil/frame.h>
+}
+
+namespace RTR {
+    // Whether libavcodec's software decoder for codec exports motion vectors. If not, asking for them only makes decoding
+    // slower.
+    bool codec_exports_motion_vectors(AVCodecID codec);
+
+    struct MotionField {
+        // Granularity of the field. Codec blocks smaller than this are averaged together.
+        static constexpr u32 BLOCK_SIZE = 16;
+        // A block is considered covered by inter prediction if at least this fraction of it had motion vectors.
+        static constexpr float MIN_COVERAGE = 0.5f;
+        // A block whose motion differs from its neighbours' median by more than this (in pixels) is probably
+        // badly predicted, i.e. has a large residual, so we don't trust its motion.
+        static constexpr float MAX_INCOHERENCE = 2.0f;
+
+        enum class BlockState : u8 {
+            // No motion vectors covered this block => intra-coded, or the frame had no vectors at all.
+            Intra,
+            // Motion vectors disagree with the neighbourhood.
+            Incoherent,
+            // Trustworthy motion.
+            Predicted,
+        };
+        struct Block {
+            float dx, dy;
+            BlockState state;
+        };
+
+        u32 frameWidth = 0, frameHeight = 0;
+        u32 blocksX = 0, blocksY = 0;
+        std::vector<Block> blocks;
+        // Whether the last frame passed to update() had motion vectors at all
+        bool hasVectors = false;
+
+        // Rebuild the field from a decoded frame.
+        // Returns false if the frame had no motion vectors (keyframes, hardware frames, unsupported codecs),
+        // in which case every block is marked Intra.
+        bool update(const AVFrame* frame);
+
+        // Fraction of the frame which needs analysing from scratch, in [0, 1].
+        float recomputeFraction() const;
+
+    private:
+        std::vector<float> coverage;
+        void resize(u32 width, u32 height);
+        void markAllIntra();
+    };
+}
@@ -0,0 +1,217 @@
+#include "patchverify.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+using namespace RTR;
+
+namespace {
+    constexpr u32 PATCH = PatchVerification::PATCH_SIZE;
+    constexpr u32 PATCH_PIXELS = PATCH * PATCH;
+    // The 480p active area is split into cells this big, each offering the patch at its centre
+    constexpr u32 CELL = 2 * PATCH;
+    // Mean |dx| + |dy| per pixel below which a patch is too flat to tell a misalignment from noise
+    constexpr u32 MIN_MEAN_GRADIENT = 6;
+
+    struct Candidate {
+        u32 x, y, gradient;
+    };
+
+    // Sum of absolute differences to the right and lower neighbours over the patch at (x, y), so it reads one column
+    // and one row past the patch
+    u32 gradient_energy(const GrayImage& image, u32 x, u32 y) {
+#if RTR_SSE2
+        __m128i sum = _mm_setzero_si128();
+        for (u32 r = 0; r < PATCH; r++) {
+            const u8* row = image.row(y + r) + x;
+            const __m128i centre = _mm_loadu_si128((const __m128i*)row);
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(centre, _mm_loadu_si128((const __m128i*)(row + 1))));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(centre, _mm_loadu_si128((const __m128i*)(row + image.width))));
+        }
+        return (u32)_mm_cvtsi128_si32(sum) + (u32)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#else
+        u32 sum = 0;
+        for (u32 r = 0; r < PATCH; r++) {
+            const u8* row = image.row(y + r) + x;
+            for (u32 c = 0; c < PATCH; c++) {
+                sum += (u32)std::abs(row[c] - row[c + 1]) + (u32)std::abs(row[c] - row[c + image.width]);
+            }
+        }
+        return sum;
+#endif
+    }
+
+    // The most textured patches inside area, best first
+    std::vector<Candidate> select_patches(const GrayImage& image, const PixelRect& area) {
+        std::vector<Candidate> candidates;
+        for (u32 cellY = area.y; cellY + CELL <= area.y + area.height; cellY += CELL) {
+            for (u32 cellX = area.x; cellX + CELL <= area.x + area.width; cellX += CELL) {
+                const u32 x = cellX + (CELL - PATCH) / 2, y = cellY + (CELL - PATCH) / 2;
+                const u32 gradient = gradient_energy(image, x, y);
+                if (gradient >= MIN_MEAN_GRADIENT * PATCH_PIXELS) {
+                    candidates.push_back(Candidate{ .x = x, .y = y, .gradient = gradient });
+                }
+            }
+        }
+        const auto best = candidates.begin() + std::min<size_t>(candidates.size(), PatchVerification::MAX_PATCHES);
+        std::partial_sort(candidates.begin(), best, candidates.end(), [](const Candidate& l, const Candidate& r) { return l.gradient > r.gradient; });
+        candidates.erase(best, candidates.end());
+        return candidates;
+    }
+
+    // Bilinear samples of image at (sx, sy) + column * (dx, dy) for each column of the row. The caller has checked
+    // they're all inside the image, with a pixel to spare to the right and below.
+    void sample_row(const GrayImage& image, float sx, float sy, float dx, float dy, float* out) {
+        u32 c = 0;
+#if RTR_SSE2
+        // Positions and weights four at a time, only the loads themselves are scalar
+        const __m128 columns = _mm_setr_ps(0, 1, 2, 3);
+        for (; c + 4 <= PATCH; c += 4) {
+            const __m128 offsets = _mm_add_ps(columns, _mm_set1_ps((float)c));
+            const __m128 x = _mm_add_ps(_mm_set1_ps(sx), _mm_mul_ps(offsets, _mm_set1_ps(dx)));
+            const __m128 y = _mm_add_ps(_mm_set1_ps(sy), _mm_mul_ps(offsets, _mm_set1_ps(dy)));
+            const __m128i x0 = _mm_cvttps_epi32(x), y0 = _mm_cvttps_epi32(y);
+            const __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(x0)), fy = _mm_sub_ps(y, _mm_cvtepi32_ps(y0));
+            alignas(16) int xs[4], ys[4];
+            _mm_store_si128((__m128i*)xs, x0);
+            _mm_store_si128((__m128i*)ys, y0);
+            const u8* p[4];
+            for (u32 i = 0; i < 4; i++) {
+                p[i] = image.row((u32)ys[i]) + xs[i];
+            }
+            const u32 below = image.width;
+            const auto gather = [&](u32 offset) {
+                return _mm_cvtepi32_ps(_mm_setr_epi32(p[0][offset], p[1][offset], p[2][offset], p[3][offset]));
+            };
+            const __m128 p00 = gather(0), p01 = gather(1), p10 = gather(below), p11 = gather(below + 1);
+            const __m128 top = _mm_add_ps(p00, _mm_mul_ps(_mm_sub_ps(p01, p00), fx));
+            const __m128 bottom = _mm_add_ps(p10, _mm_mul_ps(_mm_sub_ps(p11, p10), fx));
+            _mm_storeu_ps(out + c, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)));
+        }
+#endif
+        for (; c < PATCH; c++) {
+            const float x = sx + c * dx, y = sy + c * dy;
+            const u32 x0 = (u32)x, y0 = (u32)y;
+            const float fx = x - (float)x0, fy = y - (float)y0;
+            const u8* p = image.row(y0) + x0;
+            const float top = p[0] + (p[1] - p[0]) * fx;
+            const float bottom = p[image.width] + (p[image.width + 1] - p[image.width]) * fx;
+            out[c] = top + (bottom - top) * fy;
+        }
+    }
+
+    // Zero-mean normalized cross-correlation between the patch of image at (x, y) and warped. Values are offset to be
+    // centred on zero first, so single precision sums are plenty.
+    float patch_correlation(const GrayImage& image, u32 x, u32 y, const float* warped) {
+        float sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+        u32 i = 0;
+#if RTR_SSE2
+        __m128 sa = _mm_setzero_ps(), sb = sa, saa = sa, sbb = sa, sab = sa;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128 biasF = _mm_set1_ps(128.0f);
+        for (u32 r = 0; r < PATCH; r++) {
+            const __m128i pixels = _mm_loadu_si128((const __m128i*)(image.row(y + r) + x));
+            const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), bias);
+            const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), bias);
+            // Sign extend the 16-bit lanes to 32 by unpacking into the high half and shifting back down
+            const __m128 a[4] = {
+                _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, lo), 16)),
+                _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, lo), 16)),
+                _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zero, hi), 16)),
+                _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(zero, hi), 16)),
+            };
+            for (u32 q = 0; q < 4; q++, i += 4) {
+                const __m128 b = _mm_sub_ps(_mm_loadu_ps(warped + i), biasF);
+                sa = _mm_add_ps(sa, a[q]);
+                sb = _mm_add_ps(sb, b);
+                saa = _mm_add_ps(saa, _mm_mul_ps(a[q], a[q]));
+                sbb = _mm_add_ps(sbb, _mm_mul_ps(b, b));
+                sab = _mm_add_ps(sab, _mm_mul_ps(a[q], b));
+            }
+        }
+        const auto total = [](__m128 v) {
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, v);
+            return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        };
+        sumA = total(sa); sumB = total(sb);
+        sumAA = total(saa); sumBB = total(sbb); sumAB = total(sab);
+#else
+        for (u32 r = 0; r < PATCH; r++) {
+            const u8* row = image.row(y + r) + x;
+            for (u32 c = 0; c < PATCH; c++, i++) {
+                const float a = row[c] - 128.0f, b = warped[i] - 128.0f;
+                sumA += a; sumB += b;
+                sumAA += a * a; sumBB += b * b; sumAB += a * b;
+            }
+        }
+#endif
+        const double n = PATCH_PIXELS;
+        const double varA = sumAA - (double)sumA * sumA / n;
+        const double varB = sumBB - (double)sumB * sumB / n;
+        const double cov = sumAB - (double)sumA * sumB / n;
+        if (varA <= 0 || varB <= 0)
+            return -1.0f;
+        return (float)(cov / std::sqrt(varA * varB));
+    }
+}
+
+PatchVerification RTR::verify_alignment_patches(const GrayImage& image480, const GrayImage& image2160, const SimilarityTransform& transform,
+    const PixelRect& area480, const PixelRect& area2160) {
+    auto start = std::chrono::high_resolution_clock::now();
+    PatchVerification result;
+
+    // Patches are centred in their cells, so the extra row and column their gradients read is still inside the area
+    const PixelRect searchArea{
+        .x = area480.x,
+        .y = area480.y,
+        .width = std::min(area480.width, image480.width - std::min(image480.width, area480.x)),
+        .height = std::min(area480.height, image480.height - std::min(image480.height, area480.y)),
+    };
+    // Bilinear sampling reads the pixel right of and below each position. Stop a little short of that, as sample_row
+    // doesn't round exactly like apply.
+    const float minX = (float)area2160.x, minY = (float)area2160.y;
+    const float maxX = (float)std::min(area2160.x + area2160.width, image2160.width) - 1.01f;
+    const float maxY = (float)std::min(area2160.y + area2160.height, image2160.height) - 1.01f;
+
+    const auto toSrc = transform.inverse();
+    const float last = (float)(PATCH - 1);
+    // Moving one pixel right in image480 moves (a, b) in image2160
+    const float stepX = toSrc.a, stepY = toSrc.b;
+    float warped[PATCH_PIXELS];
+    const auto patches = select_patches(image480, searchArea);
+    // Whatever the rest do, the verdict can't change once this many have matched (or failed)
+    const float decisive = PatchVerification::MIN_MATCHED_FRACTION * (float)patches.size();
+    const float hopeless = (1.0f - PatchVerification::MIN_MATCHED_FRACTION) * (float)patches.size();
+    for (const auto& patch : patches) {
+        // A similarity transform maps the patch to a (rotated) square, so it's inside if its corners are
+        bool inside = true;
+        for (const auto& [cx, cy] : { std::pair{ 0.0f, 0.0f }, { last, 0.0f }, { 0.0f, last }, { last, last } }) {
+            float sx, sy;
+            toSrc.apply((float)patch.x + cx, (float)patch.y + cy, sx, sy);
+            inside = inside && sx >= minX && sy >= minY && sx < maxX && sy < maxY;
+        }
+        if (!inside)
+            continue;
+
+        for (u32 r = 0; r < PATCH; r++) {
+            float sx, sy;
+            toSrc.apply((float)patch.x, (float)(patch.y + r), sx, sy);
+            sample_row(image2160, sx, sy, stepX, stepY, warped + r * PATCH);
+        }
+        result.patches++;
+        if (patch_correlation(image480, patch.x, patch.y, warped) >= PatchVerification::MIN_PATCH_CORRELATION) {
+            result.matched++;
+        }
+        if ((result.aligned() && (float)result.matched >= decisive) || (float)(result.patches - result.matched) > hopeless)
+            break;
+    }
+
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Checking a cached alignment against a new frame pair without re-estimating it: a few dozen of the most textured
+// patches of the 480p image, each compared against the 2160p image resampled through the transform. Flat patches match
+// anything, but edges and texture only line up if the alignment is right to within a pixel or so.
+
+#include "image.h"
+#include "letterbox.h"
+#include "transform.h"
+
+namespace RTR {
+    struct PatchVerification {
+        static constexpr u32 PATCH_SIZE = 16;
+        static constexpr u32 MAX_PATCHES = 32;
+        // Fewer usable patches than this can't confirm or refute anything
+        static constexpr u32 MIN_PATCHES = 8;
+        // Per patch zero-mean normalized cross-correlation needed to count as matching
+        static constexpr float MIN_PATCH_CORRELATION = 0.6f;
+        static constexpr float MIN_MATCHED_FRACTION = 0.7f;
+
+        // Textured patches that land inside both active areas, and how many of those matched
+        u32 patches = 0, matched = 0;
+        double ms = 0;
+
+        bool conclusive() const { return patches >= MIN_PATCHES; }
+        bool aligned() const { return conclusive() && matched >= MIN_MATCHED_FRACTION * patches; }
+    };
+
+    // transform maps image2160 pixels onto image480 pixels, as from an AlignmentEstimator. Only patches inside area480
+    // (in image480 pixels) that map inside area2160 (in image2160 pixels) are compared.
+    PatchVerification verify_alignment_patches(const GrayImage& image480, const GrayImage& image2160, const SimilarityTransform& transform,
+        const PixelRect& area480, const PixelRect& area2160);
+}
@@ -0,0 +1,278 @@
+#include "phasecorrelation.h"
+#include "alignmenttracker.h"
+#include "fft.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+
+using namespace RTR;
+
+namespace {
+    constexpr u32 CANVAS_SIZE = 256;
+    // The log-polar resampling skips the lowest frequencies, which are mostly the window and the letterboxing
+    constexpr float LOG_POLAR_MIN_RADIUS = 2.0f;
+    constexpr float LOG_POLAR_MAX_RADIUS = CANVAS_SIZE / 2.0f;
+    const float LOG_STEP = std::log(LOG_POLAR_MAX_RADIUS / LOG_POLAR_MIN_RADIUS) / CANVAS_SIZE;
+    // Peak to sidelobe ratios below this are noise. Unrelated frames reach 10-12, the same frame at a different crop
+    // and scale 50+.
+    constexpr float MIN_PEAK_TO_SIDELOBE = 20.0f;
+    // Plausible scale range between the two images once they're on the canvas, anything outside is a bad peak
+    constexpr float MAX_CANVAS_SCALE = 1.5f;
+    // Nobody rotates a film between releases, a big rotation peak is a wrong one
+    constexpr float MAX_ROTATION = 0.05f; // radians
+    constexpr float MIN_OVERLAP = 0.7f;
+    constexpr float MIN_ACCEPTED_CORRELATION = 0.5f;
+
+    const FftPlan& canvas_plan() {
+        static const FftPlan plan(CANVAS_SIZE);
+        return plan;
+    }
+
+    // Mean subtracted and Hann windowed thumbnail. Windowing before placing it on the canvas is the same as windowing on
+    // the canvas, up to resampling, and it's separable here.
+    struct WindowedThumbnail {
+        u32 width = 0, height = 0;
+        std::vector<float> pixels;
+        // Analysis image pixels -> thumbnail pixels, per axis since the thumbnail rounds to whole pixels
+        float toThumbX = 1, toThumbY = 1;
+
+        WindowedThumbnail(const GrayImage& image, const GrayImage& thumbnail)
+            : width(thumbnail.width), height(thumbnail.height), pixels(thumbnail.pixels.size()),
+              toThumbX((float)thumbnail.width / image.width), toThumbY((float)thumbnail.height / image.height) {
+            u64 sum = 0;
+            for (u8 p : thumbnail.pixels) {
+                sum += p;
+            }
+            const float mean = (float)sum / thumbnail.pixels.size();
+            const auto hann = [](u32 i, u32 n) { return 0.5f - 0.5f * std::cos(2.0f * std::numbers::pi_v<float> * (i + 0.5f) / n); };
+            std::vector<float> windowX(width);
+            for (u32 x = 0; x < width; x++) {
+                windowX[x] = hann(x, width);
+            }
+            for (u32 y = 0; y < height; y++) {
+                const float windowY = hann(y, height);
+                for (u32 x = 0; x < width; x++) {
+                    pixels[(size_t)y * width + x] = (thumbnail.at(x, y) - mean) * windowX[x] * windowY;
+                }
+            }
+        }
+    };
+
+    // The thumbnail's image placed onto a canvas plane through placement (analysis pixels -> canvas pixels), zero
+    // everywhere it doesn't reach
+    void place_on_canvas(const WindowedThumbnail& thumbnail, const SimilarityTransform& placement, std::vector<float>& canvas) {
+        // Straight from canvas pixels to thumbnail pixels
+        const auto toImage = placement.inverse();
+        const float ax = toImage.a * thumbnail.toThumbX, bx = toImage.b * thumbnail.toThumbX;
+        const float ay = toImage.a * thumbnail.toThumbY, by = toImage.b * thumbnail.toThumbY;
+        const float cx = (toImage.tx + 0.5f) * thumbnail.toThumbX - 0.5f, cy = (toImage.ty + 0.5f) * thumbnail.toThumbY - 0.5f;
+        const float maxX = (float)thumbnail.width - 1, maxY = (float)thumbnail.height - 1;
+        for (u32 y = 0; y < CANVAS_SIZE; y++) {
+            float* out = canvas.data() + (size_t)y * CANVAS_SIZE;
+            for (u32 x = 0; x < CANVAS_SIZE; x++) {
+                const float tx = ax * x - bx * y + cx, ty = by * x + ay * y + cy;
+                if (tx < 0 || ty < 0 || tx > maxX || ty > maxY) {
+                    out[x] = 0;
+                    continue;
+                }
+                const u32 x0 = (u32)tx, y0 = (u32)ty;
+                const u32 x1 = std::min(x0 + 1, thumbnail.width - 1), y1 = std::min(y0 + 1, thumbnail.height - 1);
+                const float fx = tx - x0, fy = ty - y0;
+                const float* row0 = thumbnail.pixels.data() + (size_t)y0 * thumbnail.width;
+                const float* row1 = thumbnail.pixels.data() + (size_t)y1 * thumbnail.width;
+                out[x] = (1 - fy) * ((1 - fx) * row0[x0] + fx * row0[x1]) + fy * ((1 - fx) * row1[x0] + fx * row1[x1]);
+            }
+        }
+    }
+
+    // Splits the spectrum Z of (a + i b), both real, into the spectra of a and b:
+    // A[k] = (Z[k] + conj(Z[-k])) / 2, B[k] = (Z[k] - conj(Z[-k])) / 2i
+    void split_real_pair(const SplitComplexImage& packed, SplitComplexImage& a, SplitComplexImage& b) {
+        const u32 mask = CANVAS_SIZE - 1;
+        for (u32 v = 0; v < CANVAS_SIZE; v++) {
+            for (u32 u = 0; u < CANVAS_SIZE; u++) {
+                const size_t i = (size_t)v * CANVAS_SIZE + u;
+                const size_t negated = (size_t)((CANVAS_SIZE - v) & mask) * CANVAS_SIZE + ((CANVAS_SIZE - u) & mask);
+                const float zr = packed.re[i], zi = packed.im[i];
+                const float nr = packed.re[negated], ni = packed.im[negated];
+                a.re[i] = 0.5f * (zr + nr);
+                a.im[i] = 0.5f * (zi - ni);
+                b.re[i] = 0.5f * (zi + ni);
+                b.im[i] = 0.5f * (nr - zr);
+            }
+        }
+    }
+
+    // Rows are angles over [0, pi) (the magnitude spectrum of a real image is symmetric), columns log radii.
+    // Scaling the image shifts this along the columns, rotating it shifts it along the rows.
+    void log_polar_magnitude(const SplitComplexImage& spectrum, std::vector<float>& logPolar) {
+        // Reddy & Chatterji's high-pass emphasis, to keep the huge low frequencies from swamping the correlation
+        static const auto emphasisCos = [] {
+            std::array<float, CANVAS_SIZE> c;
+            for (u32 u = 0; u < CANVAS_SIZE; u++) {
+                const int frequency = (int)u - (u >= CANVAS_SIZE / 2 ? (int)CANVAS_SIZE : 0);
+                c[u] = std::cos(std::numbers::pi_v<float> * frequency / CANVAS_SIZE);
+            }
+            return c;
+        }();
+        // Angles in [0, pi) only reach rows 0 to CANVAS_SIZE / 2 (+1 for the bilinear neighbour)
+        constexpr u32 SAMPLED_ROWS = CANVAS_SIZE / 2 + 2;
+        std::vector<float> magnitude((size_t)SAMPLED_ROWS * CANVAS_SIZE);
+        for (u32 v = 0; v < SAMPLED_ROWS; v++) {
+            for (u32 u = 0; u < CANVAS_SIZE; u++) {
+                const size_t i = (size_t)v * CANVAS_SIZE + u;
+                const float c = emphasisCos[u] * emphasisCos[v];
+                const float re = spectrum.re[i], im = spectrum.im[i];
+                magnitude[i] = std::log1p(std::sqrt(re * re + im * im)) * (1.0f - c) * (2.0f - c);
+            }
+        }
+
+        static const auto radii = [] {
+            std::array<float, CANVAS_SIZE> r;
+            for (u32 i = 0; i < CANVAS_SIZE; i++) {
+                r[i] = LOG_POLAR_MIN_RADIUS * std::exp(LOG_STEP * i);
+            }
+            return r;
+        }();
+        // Bilinear, wrapping around like the DFT does for negative frequencies
+        const u32 mask = CANVAS_SIZE - 1;
+        for (u32 a = 0; a < CANVAS_SIZE; a++) {
+            const float angle = std::numbers::pi_v<float> * a / CANVAS_SIZE;
+            const float ca = std::cos(angle), sa = std::sin(angle);
+            for (u32 r = 0; r < CANVAS_SIZE; r++) {
+                const float u = radii[r] * ca, v = radii[r] * sa;
+                const float fu = std::floor(u), fv = std::floor(v);
+                const float wu = u - fu, wv = v - fv;
+                const u32 u0 = (u32)(int)fu & mask, u1 = (u0 + 1) & mask;
+                const u32 v0 = (u32)fv, v1 = v0 + 1;
+                const float* row0 = magnitude.data() + (size_t)v0 * CANVAS_SIZE;
+                const float* row1 = magnitude.data() + (size_t)v1 * CANVAS_SIZE;
+                logPolar[(size_t)a * CANVAS_SIZE + r] = (1 - wv) * ((1 - wu) * row0[u0] + wu * row0[u1]) + wv * ((1 - wu) * row1[u0] + wu * row1[u1]);
+            }
+        }
+    }
+
+    struct Peak {
+        float x, y; // Signed shift, sub-pixel
+        float peakToSidelobe;
+    };
+
+    // The shift d such that a(p) ~= b(p - d), from the spectra of a and b
+    Peak phase_correlate(const SplitComplexImage& spectrumA, const SplitComplexImage& spectrumB) {
+        // Normalized cross power spectrum, A conj(B) / |A conj(B)|
+        SplitComplexImage cross(CANVAS_SIZE);
+        for (size_t i = 0; i < cross.re.size(); i++) {
+            const float ar = spectrumA.re[i], ai = spectrumA.im[i];
+            const float br = spectrumB.re[i], bi = spectrumB.im[i];
+            const float re = ar * br + ai * bi, im = ai * br - ar * bi;
+            const float normSq = re * re + im * im;
+            const float scale = normSq > 1e-24f ? 1.0f / std::sqrt(normSq) : 0.0f;
+            cross.re[i] = re * scale;
+            cross.im[i] = im * scale;
+        }
+        canvas_plan().transform2d(cross, true);
+
+        const auto& surface = cross.re;
+        size_t best = 0;
+        double sum = 0, sumSq = 0;
+        for (size_t i = 0; i < surface.size(); i++) {
+            sum += surface[i];
+            sumSq += (double)surface[i] * surface[i];
+            if (surface[i] > surface[best]) {
+                best = i;
+            }
+        }
+        const u32 mask = CANVAS_SIZE - 1;
+        const u32 bx = (u32)(best % CANVAS_SIZE), by = (u32)(best / CANVAS_SIZE);
+        const auto at = [&](u32 x, u32 y) { return surface[(size_t)(y & mask) * CANVAS_SIZE + (x & mask)]; };
+
+        // Parabola through the peak and its neighbours along each axis
+        const auto refine = [](float left, float centre, float right) {
+            const float denominator = left - 2 * centre + right;
+            return denominator < 0 ? std::clamp(0.5f * (left - right) / denominator, -0.5f, 0.5f) : 0.0f;
+        };
+        const float peak = at(bx, by);
+        float x = bx + refine(at(bx - 1, by), peak, at(bx + 1, by));
+        float y = by + refine(at(bx, by - 1), peak, at(bx, by + 1));
+        if (x >= CANVAS_SIZE / 2.0f) {
+            x -= CANVAS_SIZE;
+        }
+        if (y >= CANVAS_SIZE / 2.0f) {
+            y -= CANVAS_SIZE;
+        }
+
+        const double n = (double)surface.size();
+        const double mean = sum / n;
+        const double deviation = std::sqrt(std::max(1e-30, sumSq / n - mean * mean));
+        return Peak{ .x = x, .y = y, .peakToSidelobe = (float)((peak - mean) / deviation) };
+    }
+}
+
+std::optional<SimilarityTransform> RTR::align_phase_correlation(const GrayImage& image480, const GrayImage& image2160, PhaseCorrelationStats* stats) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    PhaseCorrelationStats localStats;
+    if (!stats) {
+        stats = &localStats;
+    }
+    *stats = {};
+    const auto finish = [&](std::optional<SimilarityTransform> result) {
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return result;
+    };
+
+    // Fit each image's long side to the canvas
+    const auto thumbnail_for_canvas = [](const GrayImage& image, float& toCanvas) {
+        toCanvas = (float)(CANVAS_SIZE - 1) / std::max(image.width, image.height);
+        return downscale_area(image, std::max(1u, (u32)std::ceil(image.width * toCanvas)), std::max(1u, (u32)std::ceil(image.height * toCanvas)));
+    };
+    float toCanvas480, toCanvas2160;
+    const auto gray480 = thumbnail_for_canvas(image480, toCanvas480);
+    const auto gray2160 = thumbnail_for_canvas(image2160, toCanvas2160);
+    const WindowedThumbnail thumb480(image480, gray480);
+    const WindowedThumbnail thumb2160(image2160, gray2160);
+    const auto& plan = canvas_plan();
+
+    // Both canvases are real, so they share one FFT
+    SplitComplexImage packed(CANVAS_SIZE);
+    place_on_canvas(thumb480, SimilarityTransform{ .a = toCanvas480 }, packed.re);
+    place_on_canvas(thumb2160, SimilarityTransform{ .a = toCanvas2160 }, packed.im);
+    plan.transform2d(packed, false);
+    SplitComplexImage spectrum480(CANVAS_SIZE), spectrum2160(CANVAS_SIZE);
+    split_real_pair(packed, spectrum480, spectrum2160);
+
+    // Magnitude spectra don't care about translation, so this sees only scale and rotation
+    log_polar_magnitude(spectrum480, packed.re);
+    log_polar_magnitude(spectrum2160, packed.im);
+    plan.transform2d(packed, false);
+    SplitComplexImage logPolar480(CANVAS_SIZE), logPolar2160(CANVAS_SIZE);
+    split_real_pair(packed, logPolar480, logPolar2160);
+    const auto scalePeak = phase_correlate(logPolar480, logPolar2160);
+    stats->scalePeak = scalePeak.peakToSidelobe;
+    // Growing the image shrinks its spectrum, hence the sign
+    const float canvasScale = std::exp(-scalePeak.x * LOG_STEP);
+    const float rotation = scalePeak.y * std::numbers::pi_v<float> / CANVAS_SIZE;
+    if (scalePeak.peakToSidelobe < MIN_PEAK_TO_SIDELOBE || canvasScale > MAX_CANVAS_SCALE || canvasScale < 1.0f / MAX_CANVAS_SCALE ||
+        std::abs(rotation) > MAX_ROTATION)
+        return finish(std::nullopt);
+
+    // Put the 2160p image on the canvas at the 480p image's scale, then all that's left between them is a shift
+    const auto linear = SimilarityTransform{ .a = canvasScale * std::cos(rotation), .b = canvasScale * std::sin(rotation) };
+    SplitComplexImage rescaled2160(CANVAS_SIZE);
+    place_on_canvas(thumb2160, linear.downscaled(toCanvas2160, 1.0f), rescaled2160.re);
+    plan.transform2d(rescaled2160, false);
+    const auto translationPeak = phase_correlate(spectrum480, rescaled2160);
+    stats->translationPeak = translationPeak.peakToSidelobe;
+    if (translationPeak.peakToSidelobe < MIN_PEAK_TO_SIDELOBE)
+        return finish(std::nullopt);
+
+    const auto onCanvas = SimilarityTransform{ .a = linear.a, .b = linear.b, .tx = translationPeak.x, .ty = translationPeak.y };
+    const auto transform = onCanvas.downscaled(toCanvas2160, toCanvas480);
+    // Checked on the thumbnails, at full analysis resolution this would cost more than everything above
+    stats->correlation = aligned_correlation(gray480, gray2160, transform.downscaled(1.0f / thumb2160.toThumbX, 1.0f / thumb480.toThumbX), MIN_OVERLAP);
+    if (stats->correlation < MIN_ACCEPTED_CORRELATION)
+        return finish(std::nullopt);
+    return finish(transform);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Fourier-Mellin alignment: scale (and rotation) from phase correlating log-polar magnitude spectra, then translation
+// from phase correlating the rescaled thumbnails. A fixed handful of 256x256 FFTs, so it's cheap enough to try first on
+// every shot - the two releases almost always differ by a pure scale + crop, which doesn't need features at all.
+
+#include "image.h"
+#include "transform.h"
+
+#include <optional>
+
+namespace RTR {
+    struct PhaseCorrelationStats {
+        // Peak to sidelobe ratio of each correlation surface - how far the peak stands above the noise, in standard deviations
+        float scalePeak = 0, translationPeak = 0;
+        // aligned_correlation of the result, or -1 if it didn't get that far
+        float correlation = -1;
+        double ms = 0;
+    };
+
+    // AlignmentEstimator: the similarity mapping image2160 pixels onto image480 pixels.
+    // Gives up if either correlation peak is weak or the result doesn't actually line the images up.
+    std::optional<SimilarityTransform> align_phase_correlation(const GrayImage& image480, const GrayImage& image2160, PhaseCorrelationStats* stats = nullptr);
+}
@@ -0,0 +1,41 @@
+#include "pyramid.h"
+
+#include <stdexcept>
+
+using namespace RTR;
+
+ImagePyramid::ImagePyramid(const AVFrame* source) : frame(av_frame_clone(source)) {
+    if (!frame)
+        throw std::runtime_error("Failed to reference frame for pyramid");
+    try {
+        luma = luma_plane_of(frame);
+    }
+    catch (...) {
+        av_frame_free(&frame);
+        throw;
+    }
+}
+
+ImagePyramid::~ImagePyramid() {
+    av_frame_free(&frame);
+}
+
+std::shared_ptr<const ImagePyramid> ImagePyramid::of(const AVFrame* frame) {
+    // The constructor is private, so no make_shared
+    return std::shared_ptr<const ImagePyramid>(new ImagePyramid(frame));
+}
+
+const GrayImage& ImagePyramid::level(u32 n) const {
+    if (n == 0 || n >= 32 || (luma.width >> n) == 0 || (luma.height >> n) == 0)
+        throw std::out_of_range("No such pyramid level");
+    std::lock_guard lock(mutex);
+    while (levels.size() < n) {
+        levels.push_back(levels.empty() ? reduce_2x(luma) : reduce_2x(levels.back()));
+    }
+    return levels[n - 1];
+}
+
+u32 ImagePyramid::builtLevels() const {
+    std::lock_guard lock(mutex);
+    return (u32)levels.size();
+}
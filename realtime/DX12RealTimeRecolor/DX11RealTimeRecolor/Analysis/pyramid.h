@@ -0,0 +1,39 @@
+#pragma once
+
+// One decoded frame's luma at successively halved resolutions, shared by every analysis stage that needs a reduced
+// copy (alignment, fingerprinting, shot detection) instead of each downscaling the full frame itself.
+
+#include "image.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace RTR {
+    struct ImagePyramid {
+        // Takes a reference on the frame's buffers, so the pyramid stays valid after the decoder moves on to the next
+        // frame. Throws like luma_plane_of for unsupported formats.
+        static std::shared_ptr<const ImagePyramid> of(const AVFrame* frame);
+
+        ImagePyramid(const ImagePyramid&) = delete;
+        ImagePyramid& operator=(const ImagePyramid&) = delete;
+        ~ImagePyramid();
+
+        // Level 0, the frame itself
+        const LumaPlaneView& base() const { return luma; }
+        // Level n >= 1 is the base 2x2 box reduced n times. Built (with any levels below it) the first time anyone asks.
+        // Throws std::out_of_range for level 0 or a level that would be empty.
+        const GrayImage& level(u32 n) const;
+        // How many levels have been built so far
+        u32 builtLevels() const;
+
+    private:
+        explicit ImagePyramid(const AVFrame* frame);
+
+        AVFrame* frame;
+        LumaPlaneView luma;
+        mutable std::mutex mutex;
+        // Element n - 1 is level n. A deque, so references handed out survive more levels being added.
+        mutable std::deque<GrayImage> levels;
+    };
+}
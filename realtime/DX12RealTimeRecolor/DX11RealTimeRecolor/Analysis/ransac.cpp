@@ -0,0 +1,251 @@
+#include "ransac.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <execution>
+#include <random>
+#include <utility>
+
+using namespace RTR;
+
+std::optional<SimilarityTransform> RTR::fit_similarity(std::span<const PointMatch> matches, const std::vector<bool>* mask) {
+    // Centering both point sets decouples the translation, leaving a 2-parameter linear problem with a closed form:
+    // a = sum(xs.xd + ys.yd) / sum(|s|^2), b = sum(xs.yd - ys.xd) / sum(|s|^2)
+    double n = 0, sx = 0, sy = 0, dx = 0, dy = 0;
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (mask && !(*mask)[i])
+            continue;
+        n++;
+        sx += matches[i].srcX; sy += matches[i].srcY;
+        dx += matches[i].dstX; dy += matches[i].dstY;
+    }
+    if (n < 2)
+        return std::nullopt;
+    sx /= n; sy /= n; dx /= n; dy /= n;
+
+    double sumSq = 0, sumA = 0, sumB = 0;
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (mask && !(*mask)[i])
+            continue;
+        const double xs = matches[i].srcX - sx, ys = matches[i].srcY - sy;
+        const double xd = matches[i].dstX - dx, yd = matches[i].dstY - dy;
+        sumSq += xs * xs + ys * ys;
+        sumA += xs * xd + ys * yd;
+        sumB += xs * yd - ys * xd;
+    }
+    if (sumSq < 1e-9)
+        return std::nullopt; // All source points in the same place
+    const double a = sumA / sumSq, b = sumB / sumSq;
+    return SimilarityTransform{
+        .a = (float)a,
+        .b = (float)b,
+        .tx = (float)(dx - (a * sx - b * sy)),
+        .ty = (float)(dy - (b * sx + a * sy)),
+    };
+}
+
+namespace {
+    // Structure of arrays copy of the matches for vectorized scoring, padded to whole SIMD blocks with matches that
+    // can never be inliers
+    struct MatchArrays {
+        static constexpr u32 BLOCK = 4;
+        u32 count = 0;
+        std::vector<float> srcX, srcY, dstX, dstY;
+
+        explicit MatchArrays(std::span<const PointMatch> matches) : count((u32)matches.size()) {
+            const size_t padded = (matches.size() + BLOCK - 1) / BLOCK * BLOCK;
+            srcX.assign(padded, 0.0f);
+            srcY.assign(padded, 0.0f);
+            dstX.assign(padded, 1e18f);
+            dstY.assign(padded, 1e18f);
+            for (size_t i = 0; i < matches.size(); i++) {
+                srcX[i] = matches[i].srcX;
+                srcY[i] = matches[i].srcY;
+                dstX[i] = matches[i].dstX;
+                dstY[i] = matches[i].dstY;
+            }
+        }
+    };
+
+    // Counts matches within the threshold, giving up (returning nothing) as soon as the rest of the matches couldn't get
+    // it to mustReach - most hypotheses are bad and lose within the first few blocks
+    std::optional<u32> count_inliers_bounded(const MatchArrays& m, const SimilarityTransform& t, float thresholdSq, u32 mustReach) {
+        constexpr u32 CHECK_INTERVAL = 8 * MatchArrays::BLOCK;
+        const u32 padded = (u32)m.srcX.size();
+        u32 count = 0;
+#if RTR_SSE2
+        const __m128 a = _mm_set1_ps(t.a), b = _mm_set1_ps(t.b), tx = _mm_set1_ps(t.tx), ty = _mm_set1_ps(t.ty);
+        const __m128 limit = _mm_set1_ps(thresholdSq);
+        for (u32 i = 0; i < padded; i += MatchArrays::BLOCK) {
+            const __m128 sx = _mm_loadu_ps(m.srcX.data() + i), sy = _mm_loadu_ps(m.srcY.data() + i);
+            const __m128 ex = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a, sx), _mm_mul_ps(b, sy)), tx), _mm_loadu_ps(m.dstX.data() + i));
+            const __m128 ey = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b, sx), _mm_mul_ps(a, sy)), ty), _mm_loadu_ps(m.dstY.data() + i));
+            const __m128 errorSq = _mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey));
+            count += (u32)std::popcount((u32)_mm_movemask_ps(_mm_cmple_ps(errorSq, limit)));
+            if ((i + MatchArrays::BLOCK) % CHECK_INTERVAL == 0 && count + (m.count - std::min(m.count, i + MatchArrays::BLOCK)) < mustReach)
+                return std::nullopt;
+        }
+#else
+        for (u32 i = 0; i < padded; i++) {
+            const float ex = t.a * m.srcX[i] - t.b * m.srcY[i] + t.tx - m.dstX[i];
+            const float ey = t.b * m.srcX[i] + t.a * m.srcY[i] + t.ty - m.dstY[i];
+            count += ex * ex + ey * ey <= thresholdSq ? 1 : 0;
+            if ((i + 1) % CHECK_INTERVAL == 0 && count + (m.count - std::min(m.count, i + 1)) < mustReach)
+                return std::nullopt;
+        }
+#endif
+        return count;
+    }
+
+    // Also fills in the inlier mask and the sum of squared inlier errors
+    u32 count_inliers(std::span<const PointMatch> matches, const SimilarityTransform& transform, float thresholdSq, std::vector<bool>& inliers, double& errorSqSum) {
+        u32 count = 0;
+        errorSqSum = 0;
+        for (size_t i = 0; i < matches.size(); i++) {
+            float x, y;
+            transform.apply(matches[i].srcX, matches[i].srcY, x, y);
+            const float ex = x - matches[i].dstX, ey = y - matches[i].dstY;
+            const float errorSq = ex * ex + ey * ey;
+            inliers[i] = errorSq <= thresholdSq;
+            if (inliers[i]) {
+                count++;
+                errorSqSum += errorSq;
+            }
+        }
+        return count;
+    }
+
+    // Iterations needed to have drawn an all-inlier pair with the given confidence
+    u32 required_iterations(float confidence, float inlierRatio, u32 maxIterations) {
+        const double allInliers = (double)inlierRatio * inlierRatio;
+        if (allInliers >= 1.0)
+            return 1;
+        if (allInliers <= 0.0)
+            return maxIterations;
+        const double n = std::log(1.0 - confidence) / std::log(1.0 - allInliers);
+        return (u32)std::min<double>(maxIterations, std::ceil(n));
+    }
+
+    // Chum & Matas' PROSAC schedule for a 2 point model: draws from the best n matches, growing n so that by the time
+    // RANSAC would have drawn maxIterations samples from all of them, every sample has been as likely as under RANSAC
+    struct ProsacSampler {
+        static constexpr u32 SAMPLE_SIZE = 2;
+
+        u32 total;
+        u32 n = SAMPLE_SIZE;
+        double samplesForN; // T_n: expected RANSAC samples (out of maxIterations) drawn entirely from the best n
+        double drawsForN = 1; // T'_n: draws after which the sampler moves on to n + 1
+        u32 draws = 0;
+        std::mt19937 rng;
+
+        ProsacSampler(u32 total, u32 maxIterations, u32 seed) : total(total), rng(seed) {
+            samplesForN = maxIterations;
+            for (u32 i = 0; i < SAMPLE_SIZE; i++) {
+                samplesForN *= (double)(n - i) / (double)(total - i);
+            }
+        }
+
+        std::pair<u32, u32> draw() {
+            draws++;
+            if (draws > drawsForN && n < total) {
+                const double samplesForNext = samplesForN * (n + 1) / (n + 1 - SAMPLE_SIZE);
+                drawsForN += std::ceil(samplesForNext - samplesForN);
+                samplesForN = samplesForNext;
+                n++;
+            }
+            if (draws > drawsForN) {
+                // Used up the schedule with every match in the pool, so this is plain RANSAC now
+                const u32 i = std::uniform_int_distribution<u32>(0, total - 1)(rng);
+                const u32 j = std::uniform_int_distribution<u32>(0, total - 2)(rng);
+                return { i, j >= i ? j + 1 : j };
+            }
+            // The newest match in the pool, with one from the ones before it
+            return { n - 1, std::uniform_int_distribution<u32>(0, n - 2)(rng) };
+        }
+    };
+}
+
+std::optional<RansacResult> RTR::estimate_similarity_ransac(std::span<const PointMatch> matches, const RansacOptions& options) {
+    // Scoring costs about 2ns per hypothesis and match, so below this much work (a 16-hypothesis batch against 128
+    // matches, a few microseconds) a batch scores faster on one thread than it takes to hand it out
+    constexpr u64 PARALLEL_MIN_WORK = 16 * 128;
+
+    const u32 n = (u32)matches.size();
+    if (n < 2)
+        return std::nullopt;
+    const float thresholdSq = options.reprojectionThreshold * options.reprojectionThreshold;
+    const MatchArrays arrays(matches);
+    // Fixed seed, so the same frames always give the same answer
+    ProsacSampler sampler(n, options.maxIterations, 0x5eed);
+
+    RansacResult best{ .transform = {}, .inliers = {}, .numInliers = 0, .iterations = 0, .abandonedHypotheses = 0, .inlierRatio = 0, .rmsInlierError = 0 };
+    u32 iterationLimit = options.maxIterations;
+    std::vector<SimilarityTransform> hypotheses;
+    std::vector<std::optional<u32>> scores;
+    while (best.iterations < iterationLimit) {
+        // Drawing stays serial, so results don't depend on thread timing
+        const u32 batch = std::min(std::max(1u, options.batchSize), iterationLimit - best.iterations);
+        hypotheses.clear();
+        for (u32 i = 0; i < batch; i++) {
+            const auto [first, second] = sampler.draw();
+            const PointMatch sample[2] = { matches[first], matches[second] };
+            if (auto hypothesis = fit_similarity(sample)) {
+                hypotheses.push_back(*hypothesis);
+            }
+        }
+        best.iterations += batch;
+
+        // Only hypotheses beating the best so far matter, which lets bad ones bail out early
+        const u32 mustReach = best.numInliers + 1;
+        scores.resize(hypotheses.size());
+        const auto score = [&](const SimilarityTransform& h) {
+            scores[&h - hypotheses.data()] = count_inliers_bounded(arrays, h, thresholdSq, mustReach);
+        };
+        if ((u64)hypotheses.size() * n >= PARALLEL_MIN_WORK) {
+            std::for_each(std::execution::par, hypotheses.begin(), hypotheses.end(), score);
+        }
+        else {
+            std::for_each(hypotheses.begin(), hypotheses.end(), score);
+        }
+
+        for (size_t i = 0; i < hypotheses.size(); i++) {
+            if (!scores[i]) {
+                best.abandonedHypotheses++;
+            }
+            else if (*scores[i] > best.numInliers) {
+                best.numInliers = *scores[i];
+                best.transform = hypotheses[i];
+            }
+        }
+        iterationLimit = std::min(iterationLimit, required_iterations(options.confidence, (float)best.numInliers / n, options.maxIterations));
+    }
+    if (best.numInliers <= 2)
+        return std::nullopt;
+
+    // Polish on the consensus set, which may grow as the fit improves
+    best.inliers.assign(n, false);
+    double errorSqSum;
+    count_inliers(matches, best.transform, thresholdSq, best.inliers, errorSqSum);
+    for (u32 refine = 0; refine < options.refineIterations; refine++) {
+        auto refined = fit_similarity(matches, &best.inliers);
+        if (!refined)
+            break;
+        std::vector<bool> refinedInliers(n);
+        double refinedErrorSqSum;
+        const u32 count = count_inliers(matches, *refined, thresholdSq, refinedInliers, refinedErrorSqSum);
+        if (count < best.numInliers)
+            break;
+        const bool converged = refinedInliers == best.inliers;
+        best.transform = *refined;
+        best.inliers = std::move(refinedInliers);
+        best.numInliers = count;
+        errorSqSum = refinedErrorSqSum;
+        if (converged)
+            break;
+    }
+    best.inlierRatio = (float)best.numInliers / n;
+    best.rmsInlierError = (float)std::sqrt(errorSqSum / best.numInliers);
+    return best;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Robust similarity transform fitting, standing in for cv2.estimateAffinePartial2D.
+
+#include "../Utils/types.h"
+#include "transform.h"
+
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace RTR {
+    // A putative correspondence: (srcX, srcY) in the image being transformed, (dstX, dstY) in the base image
+    struct PointMatch {
+        float srcX, srcY;
+        float dstX, dstY;
+    };
+
+    // Defaults are estimateAffinePartial2D's
+    struct RansacOptions {
+        float reprojectionThreshold = 3.0f;
+        u32 maxIterations = 2000;
+        float confidence = 0.99f;
+        // Least squares refits on the inlier set, stopping early once it stops changing
+        u32 refineIterations = 10;
+        // Hypotheses are drawn in batches and scored in parallel, then the stopping criterion is checked between batches
+        u32 batchSize = 16;
+    };
+
+    struct RansacResult {
+        SimilarityTransform transform;
+        std::vector<bool> inliers; // Per match
+        u32 numInliers;
+        // Hypotheses drawn, and how many of those were abandoned part way through scoring
+        u32 iterations;
+        u32 abandonedHypotheses;
+        // For judging how far to trust the result: the fraction of matches agreeing with it, and how closely they do
+        float inlierRatio;
+        float rmsInlierError; // Pixels, in the base image
+    };
+
+    // Exact least squares similarity for the given matches (all of them, or only the ones with mask set)
+    std::optional<SimilarityTransform> fit_similarity(std::span<const PointMatch> matches, const std::vector<bool>* mask = nullptr);
+
+    // PROSAC: matches should be ordered best first (e.g. by descriptor distance), and hypotheses are drawn from a growing
+    // prefix of them, so good matches get tried long before plain RANSAC would stumble on them. Unordered matches still
+    // work, just without the head start.
+    // Returns nothing if there are fewer than two matches or no hypothesis gets more than two inliers.
+    std::optional<RansacResult> estimate_similarity_ransac(std::span<const PointMatch> matches, const RansacOptions& options = {});
+}
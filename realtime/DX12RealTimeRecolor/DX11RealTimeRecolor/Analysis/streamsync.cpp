@@ -0,0 +1,20 @@
+#include "streamsync.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace RTR;
+
+bool RTR::is_480p_frame_needed(const StreamTimeMapping& mapping, double period2160, double time480, double duration480) {
+    if (!(period2160 > 0) || !(duration480 > 0) || !(mapping.rate > 0))
+        return true;
+    // The targets this frame would be picked for, in 2160p time, widened for the 2160p timestamps' own rounding
+    const double margin = SYNC_TOLERANCE / 2;
+    const double first = mapping.to2160(time480 - SYNC_TOLERANCE) - margin;
+    const double last = mapping.to2160(time480 + duration480 - SYNC_TOLERANCE) + margin;
+    if (last < 0)
+        return false;
+    // First 2160p frame at or after first
+    const double frame = std::ceil(std::max(first, 0.0) / period2160);
+    return frame * period2160 < last;
+}
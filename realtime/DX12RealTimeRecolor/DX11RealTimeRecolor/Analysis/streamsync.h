@@ -0,0 +1,41 @@
+#pragma once
+
+// Pairing frames of the two cuts by presentation time rather than by decode order. They rarely line up one to one:
+// 23.976 vs 24 fps, PAL releases sped up to 25 fps, different amounts of lead-in before the film starts.
+// Each 2160p frame is paired with the 480p frame on screen at the same moment of the film.
+
+#include "../Utils/types.h"
+
+namespace RTR {
+    // time480 = time2160 * rate + offset, both in seconds from the start of their stream.
+    // A PAL release of a 24 fps film has rate 24/25; one with two more seconds of lead-in than the 2160p release has offset 2.
+    struct StreamTimeMapping {
+        double offset = 0.0;
+        double rate = 1.0;
+
+        double to480(double time2160) const { return time2160 * rate + offset; }
+        double to2160(double time480) const { return (time480 - offset) / rate; }
+    };
+
+    // Timestamps are rounded differently by different containers (Matroska to the millisecond), so a 480p frame counts
+    // as on screen from this many seconds early
+    constexpr double SYNC_TOLERANCE = 0.002;
+
+    // Whether the 480p frame starting at time480 is on screen at target480
+    inline bool is_on_screen_by(double time480, double target480) {
+        return time480 - SYNC_TOLERANCE <= target480;
+    }
+
+    // Whether any 2160p frame pairs with the 480p frame at [time480, time480 + duration480), if 2160p frames come every
+    // period2160 seconds from time 0. Errs towards yes. If the 2160p timestamps turn out irregular, a frame that wasn't
+    // needed after all just means the previous 480p frame gets shown a little longer.
+    bool is_480p_frame_needed(const StreamTimeMapping& mapping, double period2160, double time480, double duration480);
+
+    struct FrameSyncStats {
+        u64 pairs = 0;
+        // 480p frames that were decoded but never shown, because a later one was already on screen
+        u64 passedOver480 = 0;
+        // Pairs that reused the previous 480p frame, because the next one wasn't on screen yet
+        u64 repeated480 = 0;
+    };
+}
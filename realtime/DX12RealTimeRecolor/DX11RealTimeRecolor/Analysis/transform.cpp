@@ -0,0 +1,33 @@
+#include "transform.h"
+
+#include <cmath>
+
+using namespace RTR;
+
+float SimilarityTransform::scale() const {
+    return std::sqrt(a * a + b * b);
+}
+
+SimilarityTransform SimilarityTransform::inverse() const {
+    // Inverse of the linear part [a -b; b a] is [a b; -b a] / (a^2 + b^2)
+    const float det = a * a + b * b;
+    const float ia = a / det, ib = -b / det;
+    return SimilarityTransform{
+        .a = ia,
+        .b = ib,
+        .tx = -(ia * tx - ib * ty),
+        .ty = -(ib * tx + ia * ty),
+    };
+}
+
+SimilarityTransform SimilarityTransform::downscaled(float srcFactor, float dstFactor) const {
+    // x_small_src * srcFactor = x_src, x_dst = dstFactor * x_small_dst
+    // => x_small_dst = (A * (srcFactor * x_small_src) + t) / dstFactor
+    const float linear = srcFactor / dstFactor;
+    return SimilarityTransform{
+        .a = a * linear,
+        .b = b * linear,
+        .tx = tx / dstFactor,
+        .ty = ty / dstFactor,
+    };
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Geometric transforms between the two cuts' frames.
+
+namespace RTR {
+    // 4-DOF similarity transform (uniform scale + rotation + translation), like cv2.estimateAffinePartial2D returns:
+    // [x']   [a -b] [x]   [tx]
+    // [y'] = [b  a] [y] + [ty]
+    struct SimilarityTransform {
+        float a = 1, b = 0, tx = 0, ty = 0;
+
+        void apply(float x, float y, float& outX, float& outY) const {
+            outX = a * x - b * y + tx;
+            outY = b * x + a * y + ty;
+        }
+        float scale() const;
+        SimilarityTransform inverse() const;
+        // The equivalent transform between images downscaled by srcFactor (on the input side) and dstFactor (on the output side)
+        SimilarityTransform downscaled(float srcFactor, float dstFactor) const;
+    };
+}
@@ -0,0 +1,143 @@
+#include "warp.h"
+#include "../Utils/simd.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace RTR;
+
+namespace {
+    constexpr u32 FRACTION_BITS = 7;
+    constexpr u32 FRACTION_ONE = 1 << FRACTION_BITS;
+}
+
+bool RemapTable::matches(const SimilarityTransform& transform, u32 otherSrcWidth, u32 otherSrcHeight, u32 otherWidth, u32 otherHeight,
+    const PixelRect& otherOutputArea, const PixelRect& otherSourceArea) const {
+    return transform.a == outputToSource.a && transform.b == outputToSource.b && transform.tx == outputToSource.tx && transform.ty == outputToSource.ty &&
+        otherSrcWidth == srcWidth && otherSrcHeight == srcHeight && otherWidth == width && otherHeight == height &&
+        otherOutputArea == outputArea && otherSourceArea == sourceArea;
+}
+
+RemapTable RTR::build_remap_table(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height) {
+    return build_remap_table(outputToSource, srcWidth, srcHeight, width, height, PixelRect::whole(width, height), PixelRect::whole(srcWidth, srcHeight));
+}
+
+RemapTable RTR::build_remap_table(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height, const PixelRect& outputArea, const PixelRect& sourceArea) {
+    if (srcWidth < 2 || srcHeight < 2)
+        throw std::invalid_argument("Remap source must be at least 2x2");
+    if (outputArea.x + outputArea.width > width || outputArea.y + outputArea.height > height ||
+        sourceArea.x + sourceArea.width > srcWidth || sourceArea.y + sourceArea.height > srcHeight)
+        throw std::invalid_argument("Remap areas must be inside the images");
+    RemapTable table;
+    table.outputToSource = outputToSource;
+    table.srcWidth = srcWidth;
+    table.srcHeight = srcHeight;
+    table.width = width;
+    table.height = height;
+    table.outputArea = outputArea;
+    table.sourceArea = sourceArea;
+    const size_t n = (size_t)width * height;
+    table.offsets.assign(n, 0);
+    table.fractionX.assign(n, 0);
+    table.fractionY.assign(n, 0);
+    table.valid.assign(n, 0);
+    if (outputArea.empty() || sourceArea.empty())
+        return table;
+    // Same coverage rule as GrayImage::sample, within the source area
+    const float minX = (float)sourceArea.x, maxX = (float)(sourceArea.x + sourceArea.width - 1);
+    const float minY = (float)sourceArea.y, maxY = (float)(sourceArea.y + sourceArea.height - 1);
+    u32 boundsLeft = UINT32_MAX, boundsTop = UINT32_MAX, boundsRight = 0, boundsBottom = 0;
+    for (u32 y = outputArea.y; y < outputArea.y + outputArea.height; y++) {
+        for (u32 x = outputArea.x; x < outputArea.x + outputArea.width; x++) {
+            float sx, sy;
+            outputToSource.apply((float)x, (float)y, sx, sy);
+            if (sx < minX || sy < minY || sx > maxX || sy > maxY)
+                continue;
+            // Keep both taps inside the image: on the last row/column, sample from one back with full weight instead
+            u32 x0 = std::min((u32)sx, srcWidth - 2), y0 = std::min((u32)sy, srcHeight - 2);
+            const u32 fx = (u32)((sx - (float)x0) * FRACTION_ONE + 0.5f);
+            const u32 fy = (u32)((sy - (float)y0) * FRACTION_ONE + 0.5f);
+            const size_t i = (size_t)y * width + x;
+            table.offsets[i] = y0 * srcWidth + x0;
+            table.fractionX[i] = (u8)std::min(fx, FRACTION_ONE);
+            table.fractionY[i] = (u8)std::min(fy, FRACTION_ONE);
+            table.valid[i] = 1;
+            table.validCount++;
+            boundsLeft = std::min(boundsLeft, x);
+            boundsRight = std::max(boundsRight, x + 1);
+            boundsTop = std::min(boundsTop, y);
+            boundsBottom = std::max(boundsBottom, y + 1);
+        }
+    }
+    if (table.validCount) {
+        table.bounds = PixelRect{ .x = boundsLeft, .y = boundsTop, .width = boundsRight - boundsLeft, .height = boundsBottom - boundsTop };
+    }
+    return table;
+}
+
+GrayImage RTR::warp(const GrayImage& src, const RemapTable& table) {
+    if (src.width != table.srcWidth || src.height != table.srcHeight)
+        throw std::invalid_argument("Image doesn't match the remap table");
+    GrayImage dst(table.width, table.height);
+    const u8* s = src.pixels.data();
+    const u32 stride = src.width;
+#if RTR_SSE2
+    const __m128i one = _mm_set1_epi16(FRACTION_ONE);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (2 * FRACTION_BITS - 1));
+#endif
+    const auto& bounds = table.bounds;
+    for (u32 y = bounds.y; y < bounds.y + bounds.height; y++) {
+        size_t i = (size_t)y * table.width + bounds.x;
+        const size_t n = i + bounds.width;
+#if RTR_SSE2
+        // No gather in SSE2, so the taps are fetched one pixel at a time and only the blend is vectorized
+        for (; i + 8 <= n; i += 8) {
+            alignas(16) u16 topLeft[8], topRight[8], bottomLeft[8], bottomRight[8];
+            for (u32 k = 0; k < 8; k++) {
+                const u8* p = s + table.offsets[i + k];
+                topLeft[k] = p[0];
+                topRight[k] = p[1];
+                bottomLeft[k] = p[stride];
+                bottomRight[k] = p[stride + 1];
+            }
+            // Invalid pixels have zero weights but still blend pixel 0, mask them out
+            const __m128i valid = _mm_cmpgt_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(table.valid.data() + i)), zero), zero);
+            const __m128i fx = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(table.fractionX.data() + i)), zero);
+            const __m128i fy = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(table.fractionY.data() + i)), zero);
+            const __m128i fxInv = _mm_sub_epi16(one, fx);
+            // Horizontal pass stays within 16 bits (255 * 128)
+            const __m128i top = _mm_add_epi16(_mm_mullo_epi16(_mm_load_si128((const __m128i*)topLeft), fxInv), _mm_mullo_epi16(_mm_load_si128((const __m128i*)topRight), fx));
+            const __m128i bottom = _mm_add_epi16(_mm_mullo_epi16(_mm_load_si128((const __m128i*)bottomLeft), fxInv), _mm_mullo_epi16(_mm_load_si128((const __m128i*)bottomRight), fx));
+            // Vertical pass as top * (1 - fy) + bottom * fy in 32 bits, with madd doing the multiply-adds pairwise
+            const __m128i fyInv = _mm_sub_epi16(one, fy);
+            const __m128i weightsLo = _mm_unpacklo_epi16(fyInv, fy), weightsHi = _mm_unpackhi_epi16(fyInv, fy);
+            const __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(top, bottom), weightsLo), round), 2 * FRACTION_BITS);
+            const __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(top, bottom), weightsHi), round), 2 * FRACTION_BITS);
+            const __m128i words = _mm_and_si128(_mm_packs_epi32(lo, hi), valid);
+            _mm_storel_epi64((__m128i*)(dst.pixels.data() + i), _mm_packus_epi16(words, words));
+        }
+#endif
+        for (; i < n; i++) {
+            if (!table.valid[i])
+                continue;
+            const u8* p = s + table.offsets[i];
+            const u32 fx = table.fractionX[i], fy = table.fractionY[i];
+            const u32 top = p[0] * (FRACTION_ONE - fx) + p[1] * fx;
+            const u32 bottom = p[stride] * (FRACTION_ONE - fx) + p[stride + 1] * fx;
+            dst.pixels[i] = (u8)((top * (FRACTION_ONE - fy) + bottom * fy + (1 << (2 * FRACTION_BITS - 1))) >> (2 * FRACTION_BITS));
+        }
+    }
+    return dst;
+}
+
+const RemapTable& RemapCache::tableFor(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height, const PixelRect& outputArea, const PixelRect& sourceArea) {
+    if (table && table->matches(outputToSource, srcWidth, srcHeight, width, height, outputArea, sourceArea)) {
+        reuses++;
+    }
+    else {
+        table = build_remap_table(outputToSource, srcWidth, srcHeight, width, height, outputArea, sourceArea);
+        builds++;
+    }
+    return *table;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Bilinear affine warps with the per-pixel source coordinates cached. Within a shot the transform between the two cuts
+// never changes, so every frame but the first only pays for the gather and blend.
+
+#include "image.h"
+#include "letterbox.h"
+#include "transform.h"
+
+#include <optional>
+#include <vector>
+
+namespace RTR {
+    struct RemapTable {
+        // Output pixel (x, y) samples the source at outputToSource(x, y)
+        SimilarityTransform outputToSource;
+        u32 srcWidth = 0, srcHeight = 0;
+        u32 width = 0, height = 0;
+        // Per output pixel: source index of the top left tap, and the weights of the right and bottom taps in 1/128ths.
+        // Pixels the source doesn't cover point at pixel 0 with zero weights.
+        std::vector<u32> offsets;
+        std::vector<u8> fractionX, fractionY;
+        std::vector<u8> valid;
+        u32 validCount = 0;
+        // Only output pixels in outputArea that sample inside sourceArea are valid, the rest are skipped entirely
+        PixelRect outputArea, sourceArea;
+        // Bounding box of the valid pixels, the only part warp() touches
+        PixelRect bounds;
+
+        bool matches(const SimilarityTransform& transform, u32 srcWidth, u32 srcHeight, u32 width, u32 height, const PixelRect& outputArea, const PixelRect& sourceArea) const;
+    };
+
+    // The source must be at least 2x2
+    RemapTable build_remap_table(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height);
+    // Same, restricted to the active (e.g. inside the letterbox bars) areas of the output and source
+    RemapTable build_remap_table(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height, const PixelRect& outputArea, const PixelRect& sourceArea);
+
+    // Invalid pixels come out as 0, check table.valid. Throws std::invalid_argument if src isn't the size the table was built for.
+    GrayImage warp(const GrayImage& src, const RemapTable& table);
+
+    // Holds on to the last table, only rebuilding when the transform or sizes change
+    struct RemapCache {
+        u64 builds = 0, reuses = 0;
+
+        const RemapTable& tableFor(const SimilarityTransform& outputToSource, u32 srcWidth, u32 srcHeight, u32 width, u32 height, const PixelRect& outputArea, const PixelRect& sourceArea);
+
+    private:
+        std::optional<RemapTable> table;
+    };
+}
@@ -7,11 +7,36 @@ using namespace RTR;
 struct Arguments {
     LONG requestedWindowWidth;
     LONG requestedWindowHeight;
+    bool analysisMode; // Only decode keyframes of both cuts, for fast alignment/LUT fitting passes.
+    bool motionVectors; // Decode the 2160p stream in software and track its motion vectors, if its codec has any to export (not HEVC).
+    bool trackAlignment; // Read frames back to the CPU and track the 2160p -> 480p alignment.
+    bool matchFingerprints; // Read frames back to the CPU and look up each 2160p frame in an index of 480p frames.
+    bool convertToLab; // Read frames back to the CPU and convert each 2160p frame to Lab at the 480p frame's scale. With --motion-vectors, only what changed.
+    StreamTimeMapping sync; // How 2160p presentation times map to 480p ones, for pairing frames.
+    size_t readAheadBytes; // How far ahead of the demuxers to read each file, 0 to leave it to libavformat.
+    u32 readsInFlight; // How many reads of each file to keep going at once.
+    bool separateReaders; // Read each file on its own thread rather than taking turns, for files on different drives.
+    bool reprobe; // Ignore the probe cache sidecars and probe both files again, rewriting them.
+    double start, end; // Seconds into the 2160p release to play from and to. Anything else means seeking, by way of a keyframe index.
+    std::wstring edlPath; // If set, don't play anything - fingerprint both cuts in full, align them and write an edit decision list here.
 };
 Arguments parse_command_line_args() {
     auto args = Arguments{
         .requestedWindowWidth = 1280,
         .requestedWindowHeight = 720,
+        .analysisMode = false,
+        .motionVectors = false,
+        .trackAlignment = false,
+        .matchFingerprints = false,
+        .convertToLab = false,
+        .sync = {},
+        .readAheadBytes = ReadAheadReader::DEFAULT_BUFFER_SIZE,
+        .readsInFlight = ReadAheadReader::DEFAULT_READS_IN_FLIGHT,
+        .separateReaders = false,
+        .reprobe = false,
+        .start = 0.0,
+        .end = std::numeric_limits<double>::infinity(),
+        .edlPath = {},
     };
 
     // From https://www.3dgep.com/learning-directx-12-1
@@ -28,6 +53,68 @@ Arguments parse_command_line_args() {
         {
             args.requestedWindowHeight = ::wcstol(argv[++i], nullptr, 10);
         }
+        if (::wcscmp(argv[i], L"-a") == 0 || ::wcscmp(argv[i], L"--analysis") == 0)
+        {
+            args.analysisMode = true;
+        }
+        if (::wcscmp(argv[i], L"-mv") == 0 || ::wcscmp(argv[i], L"--motion-vectors") == 0)
+        {
+            args.motionVectors = true;
+        }
+        if (::wcscmp(argv[i], L"--align") == 0)
+        {
+            args.trackAlignment = true;
+        }
+        if (::wcscmp(argv[i], L"--fingerprint") == 0)
+        {
+            args.matchFingerprints = true;
+        }
+        if (::wcscmp(argv[i], L"--lab") == 0)
+        {
+            args.convertToLab = true;
+        }
+        if (::wcscmp(argv[i], L"--sync-offset") == 0)
+        {
+            // Seconds into the 480p release at which the 2160p release starts
+            args.sync.offset = ::wcstod(argv[++i], nullptr);
+        }
+        if (::wcscmp(argv[i], L"--sync-rate") == 0)
+        {
+            // 480p seconds per 2160p second, as a number or a fraction (24/25 for a PAL speedup)
+            wchar_t* end;
+            args.sync.rate = ::wcstod(argv[++i], &end);
+            if (*end == L'/') {
+                args.sync.rate /= ::wcstod(end + 1, nullptr);
+            }
+        }
+        if (::wcscmp(argv[i], L"--read-ahead-mb") == 0)
+        {
+            args.readAheadBytes = (size_t)::wcstoul(argv[++i], nullptr, 10) << 20;
+        }
+        if (::wcscmp(argv[i], L"--reads-in-flight") == 0)
+        {
+            args.readsInFlight = (u32)::wcstoul(argv[++i], nullptr, 10);
+        }
+        if (::wcscmp(argv[i], L"--separate-readers") == 0)
+        {
+            args.separateReaders = true;
+        }
+        if (::wcscmp(argv[i], L"--reprobe") == 0)
+        {
+            args.reprobe = true;
+        }
+        if (::wcscmp(argv[i], L"--start") == 0)
+        {
+            args.start = ::wcstod(argv[++i], nullptr);
+        }
+        if (::wcscmp(argv[i], L"--end") == 0)
+        {
+            args.end = ::wcstod(argv[++i], nullptr);
+        }
+        if (::wcscmp(argv[i], L"--build-edl") == 0)
+        {
+            args.edlPath = argv[++i];
+        }
     }
 
     // Free memory allocated by CommandLineToArgvW
@@ -36,6 +123,9 @@ Arguments parse_command_line_args() {
     return args;
 }
 
+constexpr const char* VIDEO_PATH_480 = "../../../../480p.mp4";
+constexpr const char* VIDEO_PATH_2160 = "../../../../2160p.mkv";
+
 // Global state
 WindowState g_windowState;
 bool g_windowInitialized = false;
@@ -239,6 +329,35 @@ void dx11_write_buffer(ComPtr<ID3D11DeviceContext>& deviceContext, ComPtr<ID3D11
     deviceContext->Unmap(buffer.Get(), 0);
 }
 
+// GPU-only structured buffer of u32s, for compute shaders to read and write
+ComPtr<ID3D11Buffer> dx11_create_u32_structured_buffer(ComPtr<ID3D11Device>& device, u32 numElements, ComPtr<ID3D11UnorderedAccessView>& outUav) {
+    auto bufferDesc = D3D11_BUFFER_DESC{
+        .ByteWidth = numElements * (u32)sizeof(u32),
+        .Usage = D3D11_USAGE_DEFAULT,
+        .BindFlags = D3D11_BIND_UNORDERED_ACCESS,
+        .CPUAccessFlags = 0,
+        .MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+        .StructureByteStride = sizeof(u32),
+    };
+    ComPtr<ID3D11Buffer> buffer;
+    ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, &buffer));
+    ThrowIfFailed(device->CreateUnorderedAccessView(buffer.Get(), nullptr, &outUav));
+    return buffer;
+}
+
+// CPU-readable copy target for a GPU buffer
+ComPtr<ID3D11Buffer> dx11_create_readback_buffer(ComPtr<ID3D11Device>& device, u32 sizeBytes) {
+    auto bufferDesc = D3D11_BUFFER_DESC{
+        .ByteWidth = sizeBytes,
+        .Usage = D3D11_USAGE_STAGING,
+        .BindFlags = 0,
+        .CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+    };
+    ComPtr<ID3D11Buffer> buffer;
+    ThrowIfFailed(device->CreateBuffer(&bufferDesc, nullptr, &buffer));
+    return buffer;
+}
+
 
 DX11State dx11_init() {
     assert(g_windowInitialized);
@@ -296,6 +415,16 @@ DX11State dx11_init() {
         &deviceContext
     ));
 
+    // Decode threads use the immediate context too: D3D11VA decoding, and StagingReadback's copies and maps.
+    // libavcodec's own lock (AVD3D11VADeviceContext::lock) only serializes its calls against each other; multithread
+    // protection is what makes every call on the context, from any thread, take the context's lock. That guards single
+    // calls, not sequences of them - which is enough, because the decode threads never bind anything, so nothing they
+    // do depends on or disturbs the render loop's pipeline state between its calls. What it doesn't stop is a call that
+    // blocks inside the lock (like a Map that waits for the GPU) holding up the render loop, see StagingReadback.
+    ComPtr<ID3D11Multithread> multithread;
+    ThrowIfFailed(deviceContext.As(&multithread));
+    multithread->SetMultithreadProtected(TRUE);
+
     ComPtr<IDXGIFactory1> factory;
     if (SUCCEEDED(swapchain->GetParent(IID_PPV_ARGS(&factory)))) {
         factory->MakeWindowAssociation(g_windowState.hWnd, DXGI_MWA_NO_WINDOW_CHANGES);
@@ -331,6 +460,8 @@ DX11State dx11_init() {
         .rgb_frag = dx11_compile_pixel_shader(device, L"rgb_frag.cso"),
         .yuv_rec2020_to_cielab_comp = dx11_compile_compute_shader(device, L"yuv_rec2020_to_cielab_comp.cso"),
         .yuv_rec2020_to_lin_rgb_comp = dx11_compile_compute_shader(device, L"yuv_rec2020_to_lin_rgb_comp.cso"),
+        .tile_change_detect_comp = dx11_compile_compute_shader(device, L"tile_change_detect_comp.cso"),
+        .letterbox_detect_comp = dx11_compile_compute_shader(device, L"letterbox_detect_comp.cso"),
 
         .quadVertexBuffer = quadVertexBuffer,
         .quadIndexBuffer = quadIndexBuffer,
@@ -387,6 +518,8 @@ void DX11State::flushAndClose() {
     quadIndexBuffer.Reset();
     quadVertexBuffer.Reset();
 
+    letterbox_detect_comp.Reset();
+    tile_change_detect_comp.Reset();
     yuv_rec2020_to_cielab_comp.Reset();
     rgb_frag.Reset();
     yuv_bt601_to_srgb_comp.Reset();
@@ -401,6 +534,194 @@ void DX11State::flushAndClose() {
     swapchain.Reset();
 }
 
+void DirtyTileTracker::create(DX11State& dx11State, u32 width, u32 height) {
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    forceAllDirty = true;
+
+    tileDirty = dx11_create_u32_structured_buffer(dx11State.device, tilesX * tilesY, tileDirtyUav);
+    dirtyTileCount = dx11_create_u32_structured_buffer(dx11State.device, 1, dirtyTileCountUav);
+    for (auto& readback : dirtyTileCountReadback) {
+        readback = dx11_create_readback_buffer(dx11State.device, sizeof(u32));
+    }
+}
+
+void DirtyTileTracker::ensurePreviousFrameTextures(DX11State& dx11State, DXGI_FORMAT backingFormat, u32 width, u32 height) {
+    if (previousFrameFormat == backingFormat)
+        return;
+    previousFrameFormat = backingFormat;
+    // The old copy (if any) was in a different format, so it's meaningless
+    forceAllDirty = true;
+
+    auto lumFormat = DXGI_FORMAT_R8_UINT, chromFormat = DXGI_FORMAT_R8G8_UINT;
+    if (backingFormat == DXGI_FORMAT_P010) {
+        lumFormat = DXGI_FORMAT_R16_UINT;
+        chromFormat = DXGI_FORMAT_R16G16_UINT;
+    }
+
+    auto desc = D3D11_TEXTURE2D_DESC{
+        .Width = width,
+        .Height = height,
+        .MipLevels = 1,
+        .ArraySize = 1,
+        .Format = lumFormat,
+        .SampleDesc = DXGI_SAMPLE_DESC {
+            .Count = 1,
+            .Quality = 0
+        },
+        .Usage = D3D11_USAGE_DEFAULT,
+        .BindFlags = D3D11_BIND_UNORDERED_ACCESS,
+        .CPUAccessFlags = 0,
+        .MiscFlags = 0
+    };
+    ThrowIfFailed(dx11State.device->CreateTexture2D(&desc, NULL, &previousLum));
+    ThrowIfFailed(dx11State.device->CreateUnorderedAccessView(previousLum.Get(), nullptr, &previousLumUav));
+
+    desc.Width = (width + 1) / 2;
+    desc.Height = (height + 1) / 2;
+    desc.Format = chromFormat;
+    ThrowIfFailed(dx11State.device->CreateTexture2D(&desc, NULL, &previousChrom));
+    ThrowIfFailed(dx11State.device->CreateUnorderedAccessView(previousChrom.Get(), nullptr, &previousChromUav));
+}
+
+// Expects the colorspace constant buffer to already be bound to b0.
+void DirtyTileTracker::detectChanges(DX11State& dx11State, ID3D11UnorderedAccessView* lum, ID3D11UnorderedAccessView* chrom) {
+    const UINT zeros[4] = { 0, 0, 0, 0 };
+    dx11State.deviceContext->ClearUnorderedAccessViewUint(dirtyTileCountUav.Get(), zeros);
+
+    dx11State.deviceContext->CSSetShader(dx11State.tile_change_detect_comp.Get(), nullptr, 0);
+    ID3D11UnorderedAccessView* uavs[] = {
+        lum,
+        chrom,
+        previousLumUav.Get(),
+        previousChromUav.Get(),
+        tileDirtyUav.Get(),
+        dirtyTileCountUav.Get(),
+    };
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+    dx11State.deviceContext->Dispatch(tilesX, tilesY, 1);
+
+    // Unbind resources for other rendering to use
+    for (auto& uav : uavs) {
+        uav = nullptr;
+    }
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+
+    // The previous output is valid again once this frame has been converted
+    forceAllDirty = false;
+
+    // Copy the dirty-count out, to be read back in a later frame. readbackIndex is the oldest buffer; if its count
+    // still hasn't come back, overwriting it would lose it, and slow frames would go missing from the stats.
+    if (readbackPending[readbackIndex] && !collectReadback(dx11State, readbackIndex)) {
+        stats.framesUncounted++;
+        return;
+    }
+    dx11State.deviceContext->CopyResource(dirtyTileCountReadback[readbackIndex].Get(), dirtyTileCount.Get());
+    readbackPending[readbackIndex] = true;
+    readbackIndex = (readbackIndex + 1) % NUM_INFLIGHT_FRAMES;
+}
+
+void DirtyTileTracker::collectStats(DX11State& dx11State) {
+    // readbackIndex is the oldest readback. The GPU finishes them in order, so stop at the first one still in flight.
+    for (u32 i = 0; i < NUM_INFLIGHT_FRAMES; i++) {
+        const u32 index = (readbackIndex + i) % NUM_INFLIGHT_FRAMES;
+        if (readbackPending[index] && !collectReadback(dx11State, index))
+            return;
+    }
+}
+
+bool DirtyTileTracker::collectReadback(DX11State& dx11State, u32 index) {
+    D3D11_MAPPED_SUBRESOURCE ms;
+    HRESULT hr = dx11State.deviceContext->Map(dirtyTileCountReadback[index].Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &ms);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+        return false;
+    ThrowIfFailed(hr);
+    u32 dirtyTiles = *(const u32*)ms.pData;
+    dx11State.deviceContext->Unmap(dirtyTileCountReadback[index].Get(), 0);
+    readbackPending[index] = false;
+
+    u32 totalTiles = tilesX * tilesY;
+    stats.tilesConsidered += totalTiles;
+    stats.tilesSkipped += totalTiles - std::min(dirtyTiles, totalTiles);
+    return true;
+}
+
+void GpuLetterboxDetector::create(DX11State& dx11State, u32 width, u32 height) {
+    this->width = width;
+    this->height = height;
+    // Anything still in flight was for the old size
+    area.reset();
+    readbackPending = {};
+    readbackIndex = 0;
+
+    brightLines = dx11_create_u32_structured_buffer(dx11State.device, height + width, brightLinesUav);
+    for (auto& readback : brightLinesReadback) {
+        readback = dx11_create_readback_buffer(dx11State.device, (height + width) * (u32)sizeof(u32));
+    }
+}
+
+void GpuLetterboxDetector::detect(DX11State& dx11State, ID3D11UnorderedAccessView* lum, u32 width, u32 height) {
+    if (width != this->width || height != this->height) {
+        create(dx11State, width, height);
+    }
+    // Same as DirtyTileTracker::detectChanges: rather than overwrite the oldest readback before it's come back,
+    // skip this frame. The area only needs to come from a recent frame, not every one.
+    if (readbackPending[readbackIndex] && !collectReadback(dx11State, readbackIndex)) {
+        stats.framesUncounted++;
+        return;
+    }
+    stats.dispatches++;
+
+    const UINT zeros[4] = { 0, 0, 0, 0 };
+    dx11State.deviceContext->ClearUnorderedAccessViewUint(brightLinesUav.Get(), zeros);
+
+    dx11State.deviceContext->CSSetShader(dx11State.letterbox_detect_comp.Get(), nullptr, 0);
+    ID3D11UnorderedAccessView* uavs[] = {
+        lum,
+        brightLinesUav.Get(),
+    };
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+    dx11State.deviceContext->Dispatch((width + TILE_SIZE - 1) / TILE_SIZE, (height + TILE_SIZE - 1) / TILE_SIZE, 1);
+
+    // Unbind resources for other rendering to use
+    for (auto& uav : uavs) {
+        uav = nullptr;
+    }
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+
+    dx11State.deviceContext->CopyResource(brightLinesReadback[readbackIndex].Get(), brightLines.Get());
+    readbackPending[readbackIndex] = true;
+    readbackIndex = (readbackIndex + 1) % NUM_INFLIGHT_FRAMES;
+}
+
+void GpuLetterboxDetector::collect(DX11State& dx11State) {
+    // readbackIndex is the oldest readback. The GPU finishes them in order, so stop at the first one still in flight.
+    for (u32 i = 0; i < NUM_INFLIGHT_FRAMES; i++) {
+        const u32 index = (readbackIndex + i) % NUM_INFLIGHT_FRAMES;
+        if (readbackPending[index] && !collectReadback(dx11State, index))
+            return;
+    }
+}
+
+bool GpuLetterboxDetector::collectReadback(DX11State& dx11State, u32 index) {
+    D3D11_MAPPED_SUBRESOURCE ms;
+    HRESULT hr = dx11State.deviceContext->Map(brightLinesReadback[index].Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &ms);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+        return false;
+    ThrowIfFailed(hr);
+    const u32* lines = (const u32*)ms.pData;
+    const PixelRect detected = active_area_of_lines(std::span(lines, height), std::span(lines + height, width));
+    dx11State.deviceContext->Unmap(brightLinesReadback[index].Get(), 0);
+    readbackPending[index] = false;
+
+    stats.readbacks++;
+    // All black frames (fades) say nothing about where the bars are
+    if (!detected.empty()) {
+        area = detected;
+    }
+    return true;
+}
+
 // Adapted from ff_dxva2_common_frame_params in ffmpeg internals: https://github.com/FFmpeg/FFmpeg/blob/8653dcaf7d665b15b40ea9a560c8171b0914a882/libavcodec/dxva2.c#L476
 void get_internal_dx11_tex_stats(AVCodecContext* avctx, FfmpegInternalTextureStats* out)
 {
@@ -453,7 +774,14 @@ int ff_dxva2_common_frame_params(AVCodecContext* avctx, AVBufferRef* hw_frames_c
     frames_ctx->sw_format = avctx->sw_pix_fmt == AV_PIX_FMT_YUV420P10 ? AV_PIX_FMT_P010 : AV_PIX_FMT_NV12;
     frames_ctx->width = stats.surface_width;
     frames_ctx->height = stats.surface_height;
-    frames_ctx->initial_pool_size = stats.num_surfaces;
+    // The pool is fixed size, and on top of the decoder's own references a surface is held by:
+    //  - every frame waiting in the decode queue, and the ones being read back
+    //  - the one being pushed
+    //  - latest, which the render loop converts and keeps showing
+    //  - pending, which readFrameAt took off the queue but isn't on screen yet
+    //  - chosen, which readFrameAt holds while latest still has the previous frame
+    // MPEG-2 only asks for 3 surfaces of its own, so being a couple short runs the pool dry and fails decoding.
+    frames_ctx->initial_pool_size = stats.num_surfaces + DECODE_QUEUE_DEPTH + StagingReadback::RING_SIZE + 4;
 
     if (frames_ctx->format == AV_PIX_FMT_D3D11) {
         auto* frames_hwctx = (AVD3D11VAFramesContext*)frames_ctx->hwctx;
@@ -483,28 +811,77 @@ AVPixelFormat get_hw_format(AVCodecContext* decoder_ctx, const AVPixelFormat* pi
     return AV_PIX_FMT_NONE;
 }
 
-FFMpegPerVideoState ffmpeg_create_decoder(DX11State& dx11State, const char* path) {
-    FFMpegPerVideoState state = {};
+// Opens path into *input_ctx (allocated up front if it reads through a custom pb) and fills in its stream info, from the
+// probe cache sidecar if there's an up to date one, otherwise by probing and writing the sidecar for next time.
+InputOpenStats ffmpeg_open_input(AVFormatContext** input_ctx, const char* path, bool useProbeCache) {
+    InputOpenStats stats;
+    auto start = std::chrono::high_resolution_clock::now();
+    ThrowIfFfmpegFail(avformat_open_input(input_ctx, path, NULL, NULL));
+    auto opened = std::chrono::high_resolution_clock::now();
+    stats.openMs = std::chrono::duration<double, std::milli>(opened - start).count();
+
+    stats.fromProbeCache = useProbeCache && load_probe_cache(*input_ctx, path);
+    if (!stats.fromProbeCache) {
+        ThrowIfFfmpegFail(avformat_find_stream_info(*input_ctx, NULL));
+        stats.probeCacheWritten = save_probe_cache(*input_ctx, path);
+    }
+    stats.streamInfoMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - opened).count();
+    return stats;
+}
+
+FFMpegPerVideoState ffmpeg_create_decoder(DX11State& dx11State, const char* path, FFMpegDecodeOptions options) {
+    FFMpegPerVideoState state = {
+        .options = options,
+        .path = path,
+    };
 
     // Open the video and figure out what streams it has
-    ThrowIfFfmpegFail(avformat_open_input(&state.input_ctx, path, NULL, NULL));
-    ThrowIfFfmpegFail(avformat_find_stream_info(state.input_ctx, NULL));
+    if (options.readAheadBytes) {
+        state.reader = std::make_unique<ReadAheadReader>(path, options.readAheadBytes, options.readsInFlight, options.readScheduler);
+        state.input_ctx = avformat_alloc_context();
+        state.input_ctx->pb = state.reader->ioContext();
+    }
+    state.openStats = ffmpeg_open_input(&state.input_ctx, path, options.useProbeCache);
+    if (state.reader) {
+        // So the scheduler knows how many seconds of playback a buffered byte is worth
+        state.reader->setByteRate(state.input_ctx->bit_rate / 8.0);
+    }
 
     // Find the best video stream, allocating and filling in certain properties of a decoder (but not opening the decoder yet...)
     state.video_stream_index = ThrowIfFfmpegFail(av_find_best_stream(state.input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &state.decoder, 0));
     state.video_stream = state.input_ctx->streams[state.video_stream_index];
+    // Don't bother demuxing audio/subtitles
+    for (unsigned int i = 0; i < state.input_ctx->nb_streams; i++) {
+        if ((int)i != state.video_stream_index) {
+            state.input_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
 
     // Allocate a decoder context, fill it with parameters for the video codec we want and the hardware device context...
     state.decoder_ctx = avcodec_alloc_context3(state.decoder);
     assert(state.decoder_ctx);
     // Set up the decoder with the correct parameters for this video stream's codec
     ThrowIfFfmpegFail(avcodec_parameters_to_context(state.decoder_ctx, state.video_stream->codecpar));
-    // Request the D3D11 format
-    state.decoder_ctx->get_format = get_hw_format;
-    //// ... I think this means there's only one DX11 frame texture, and it gets reused?
-    //av_opt_set_int(state.decoder_ctx, "refcounted_frames", 1, 0);
-    // Create a hardware device context using the DX11 device, put it into the decoder_ctx
-    {
+    if (options.exportMotionVectors && !codec_exports_motion_vectors(state.decoder->id)) {
+        char msgbuf[256];
+        snprintf(msgbuf, sizeof(msgbuf), "%s: the %s decoder doesn't export motion vectors, not tracking them\n", path, state.decoder->name);
+        OutputDebugStringA(msgbuf);
+        state.options.exportMotionVectors = options.exportMotionVectors = false;
+    }
+    // Only software decoders export motion vectors
+    if (options.softwareDecode || options.exportMotionVectors) {
+        // Let libavcodec pick a thread count, software decoding of UHD needs all the help it can get
+        state.decoder_ctx->thread_count = 0;
+        if (options.exportMotionVectors) {
+            state.decoder_ctx->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+        }
+    }
+    else {
+        // Request the D3D11 format
+        state.decoder_ctx->get_format = get_hw_format;
+        //// ... I think this means there's only one DX11 frame texture, and it gets reused?
+        //av_opt_set_int(state.decoder_ctx, "refcounted_frames", 1, 0);
+        // Create a hardware device context using the DX11 device, put it into the decoder_ctx
         AVBufferRef* hw_device_ctx = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
         AVHWDeviceContext* device_ctx = reinterpret_cast<AVHWDeviceContext*>(hw_device_ctx->data);
         AVD3D11VADeviceContext* d3d11va_device_ctx = reinterpret_cast<AVD3D11VADeviceContext*>(device_ctx->hwctx);
@@ -514,12 +891,17 @@ FFMpegPerVideoState ffmpeg_create_decoder(DX11State& dx11State, const char* path
 
         av_buffer_unref(&hw_device_ctx);
     }
+    if (options.keyframesOnly) {
+        // The decoder throws away anything that isn't a keyframe before doing any real work on it.
+        state.decoder_ctx->skip_frame = AVDISCARD_NONKEY;
+        // Only affects the software decoders, but there's no point deblocking frames we only use for statistics.
+        state.decoder_ctx->skip_loop_filter = AVDISCARD_ALL;
+    }
 
     // Decoder context now has all parameters filled in, now actually open the decoder
     ThrowIfFfmpegFail(avcodec_open2(state.decoder_ctx, state.decoder, NULL));
 
     state.packet = av_packet_alloc();
-    state.frame = av_frame_alloc();
 
     get_internal_dx11_tex_stats(state.decoder_ctx, &state.stats);
 
@@ -571,8 +953,13 @@ FFMpegPerVideoState ffmpeg_create_decoder(DX11State& dx11State, const char* path
     ThrowIfFailed(dx11State.device->CreateShaderResourceView(state.latestFrameAsLab.Get(), nullptr, &state.latestFrameAsLabSrv));
     ThrowIfFailed(dx11State.device->CreateUnorderedAccessView(state.latestFrameAsLab.Get(), nullptr, &state.latestFrameAsLabUav));
 
+    state.dirtyTiles.create(dx11State, state.stats.content_width, state.stats.content_height);
+
     DX11ColorspaceConstantBuffer buf = {
         .texDims = DirectX::XMUINT2(state.stats.content_width, state.stats.content_height),
+        .tileCounts = DirectX::XMUINT2(state.dirtyTiles.tilesX, state.dirtyTiles.tilesY),
+        .forceAllTilesDirty = 1,
+        .tileChangeThreshold = TILE_CHANGE_THRESHOLD,
     };
     state.texDimConstantBuffer = dx11_create_buffer(dx11State.device, D3D11_BIND_CONSTANT_BUFFER, &buf, sizeof(buf));
 
@@ -619,84 +1006,1060 @@ void FFMpegPerVideoState::updateBackingFrame(DX11State& dx11State, ID3D11Texture
 
             backingFrameUavs.push_back(uavs);
         }
+
+        dirtyTiles.ensurePreviousFrameTextures(dx11State, desc.Format, stats.content_width, stats.content_height);
     }
 }
 
-void FFMpegPerVideoState::readFrame(DX11State& dx11State) {
-    do {
+void StagingReadback::start(DecodedFrame decoded) {
+    assert(!full());
+    // D3D11VA frames are a slice of the decoder's texture array
+    auto* surface = (ID3D11Texture2D*)decoded.frame->data[0];
+    const UINT slice = (UINT)(intptr_t)decoded.frame->data[1];
+    D3D11_TEXTURE2D_DESC desc;
+    surface->GetDesc(&desc);
+
+    Slot& slot = slots[(first + count) % RING_SIZE];
+    if (!slot.staging || desc.Format != slot.desc.Format || desc.Width != slot.desc.Width || desc.Height != slot.desc.Height) {
+        ComPtr<ID3D11Device> device;
+        surface->GetDevice(&device);
+        if (!deviceContext) {
+            device->GetImmediateContext(&deviceContext);
+        }
+        slot.desc = D3D11_TEXTURE2D_DESC{
+            .Width = desc.Width,
+            .Height = desc.Height,
+            .MipLevels = 1,
+            .ArraySize = 1,
+            .Format = desc.Format,
+            .SampleDesc = DXGI_SAMPLE_DESC {
+                .Count = 1,
+                .Quality = 0
+            },
+            .Usage = D3D11_USAGE_STAGING,
+            .BindFlags = 0,
+            .CPUAccessFlags = D3D11_CPU_ACCESS_READ,
+            .MiscFlags = 0
+        };
+        ThrowIfFailed(device->CreateTexture2D(&slot.desc, NULL, &slot.staging));
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    // The decoder's texture has no mips, so the slice is the subresource
+    deviceContext->CopySubresourceRegion(slot.staging.Get(), 0, 0, 0, 0, surface, slice, nullptr);
+    // Otherwise the copy can sit in the command buffer until the render loop next flushes
+    deviceContext->Flush();
+    const double copyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    stats.totalCopyMs += copyMs;
+    stats.worstCopyMs = std::max(stats.worstCopyMs, copyMs);
+
+    slot.decoded = std::move(decoded);
+    count++;
+}
+
+std::optional<DecodedFrame> StagingReadback::finishOldest(bool wait) {
+    if (empty())
+        return std::nullopt;
+    Slot& slot = slots[first];
+    const AVFrame* frame = slot.decoded.frame.get();
+    const bool is10bit = slot.desc.Format == DXGI_FORMAT_P010;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    auto waitStart = std::chrono::high_resolution_clock::now();
+    bool waited = false;
+    while (true) {
+        auto start = std::chrono::high_resolution_clock::now();
+        HRESULT hr = deviceContext->Map(slot.staging.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+        const double mapMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        stats.totalMapMs += mapMs;
+        stats.worstMapMs = std::max(stats.worstMapMs, mapMs);
+        if (hr != DXGI_ERROR_WAS_STILL_DRAWING) {
+            ThrowIfFailed(hr);
+            break;
+        }
+        stats.notReadyPolls++;
+        if (!wait)
+            return std::nullopt;
+        waited = true;
+        // Only when the ring's full or the video's over, neither of which is in a hurry. Spinning on Map would fight the
+        // render thread for the lock; sleeping leaves it free.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (waited) {
+        stats.waits++;
+        stats.waitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+    }
+
+    // Only allocated once there's something to copy, polls that find the copy in flight shouldn't cost a frame buffer
+    AVFramePtr cpuFrame(av_frame_alloc());
+    int ret = cpuFrame ? 0 : AVERROR(ENOMEM);
+    if (ret >= 0) {
+        cpuFrame->format = is10bit ? AV_PIX_FMT_P010 : AV_PIX_FMT_NV12;
+        cpuFrame->width = frame->width;
+        cpuFrame->height = frame->height;
+        ret = av_frame_get_buffer(cpuFrame.get(), 0);
+    }
+    if (ret >= 0) {
+        ret = av_frame_copy_props(cpuFrame.get(), frame);
+    }
+    if (ret < 0) {
+        deviceContext->Unmap(slot.staging.Get(), 0);
+        ThrowIfFfmpegFail(ret);
+    }
+
+    // NV12/P010: interleaved chroma right below the luma rows of the whole (padded) surface
+    const int bytesPerSample = is10bit ? 2 : 1;
+    const u8* lum = (const u8*)mapped.pData;
+    const u8* chrom = lum + (size_t)mapped.RowPitch * slot.desc.Height;
+    av_image_copy_plane(cpuFrame->data[0], cpuFrame->linesize[0], lum, (int)mapped.RowPitch,
+        frame->width * bytesPerSample, frame->height);
+    av_image_copy_plane(cpuFrame->data[1], cpuFrame->linesize[1], chrom, (int)mapped.RowPitch,
+        ((frame->width + 1) / 2) * 2 * bytesPerSample, (frame->height + 1) / 2);
+    deviceContext->Unmap(slot.staging.Get(), 0);
+
+    DecodedFrame decoded = std::move(slot.decoded);
+    decoded.cpuFrame = std::move(cpuFrame);
+    first = (first + 1) % RING_SIZE;
+    count--;
+    stats.frames++;
+    return decoded;
+}
+
+void SoftwareFrameUpload::upload(DX11State& dx11State, const AVFrame* frame) {
+    const auto newFormat = (AVPixelFormat)frame->format;
+    bool planarChroma, samplesInLowBits, is10bit;
+    switch (newFormat) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        planarChroma = true; samplesInLowBits = false; is10bit = false;
+        break;
+    case AV_PIX_FMT_NV12:
+        planarChroma = false; samplesInLowBits = false; is10bit = false;
+        break;
+    case AV_PIX_FMT_YUV420P10LE:
+        planarChroma = true; samplesInLowBits = true; is10bit = true;
+        break;
+    case AV_PIX_FMT_P010LE:
+        planarChroma = false; samplesInLowBits = false; is10bit = true;
+        break;
+    default:
+        throw std::runtime_error(std::string("Can't upload software frames of format ") + av_get_pix_fmt_name(newFormat));
+    }
+
+    const u32 chromWidth = ((u32)frame->width + 1) / 2;
+    const u32 chromHeight = ((u32)frame->height + 1) / 2;
+
+    if (newFormat != format || (u32)frame->width != width || (u32)frame->height != height) {
+        format = newFormat;
+        width = (u32)frame->width;
+        height = (u32)frame->height;
+        equivalentHwFormat = is10bit ? DXGI_FORMAT_P010 : DXGI_FORMAT_NV12;
+
+        auto desc = D3D11_TEXTURE2D_DESC{
+            .Width = width,
+            .Height = height,
+            .MipLevels = 1,
+            .ArraySize = 1,
+            .Format = is10bit ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R8_UINT,
+            .SampleDesc = DXGI_SAMPLE_DESC {
+                .Count = 1,
+                .Quality = 0
+            },
+            .Usage = D3D11_USAGE_DEFAULT,
+            .BindFlags = D3D11_BIND_UNORDERED_ACCESS,
+            .CPUAccessFlags = 0,
+            .MiscFlags = 0
+        };
+        ThrowIfFailed(dx11State.device->CreateTexture2D(&desc, NULL, &lum));
+        desc.Width = chromWidth;
+        desc.Height = chromHeight;
+        desc.Format = is10bit ? DXGI_FORMAT_R16G16_UINT : DXGI_FORMAT_R8G8_UINT;
+        ThrowIfFailed(dx11State.device->CreateTexture2D(&desc, NULL, &chrom));
+
+        // The conversion shaders read Texture2DArrays, because that's what D3D11VA hands us
+        auto uavDesc = D3D11_UNORDERED_ACCESS_VIEW_DESC{
+            .Format = DXGI_FORMAT_UNKNOWN, // Use the format of the texture
+            .ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY,
+            .Texture2DArray = {
+                .MipSlice = 0,
+                .FirstArraySlice = 0,
+                .ArraySize = 1,
+            }
+        };
+        ThrowIfFailed(dx11State.device->CreateUnorderedAccessView(lum.Get(), &uavDesc, &uavs.lum));
+        ThrowIfFailed(dx11State.device->CreateUnorderedAccessView(chrom.Get(), &uavDesc, &uavs.chrom));
+    }
+
+    // Luma
+    if (samplesInLowBits) {
+        // yuv420p10 keeps samples in the low bits, P010 (which the shaders expect) keeps them in the high bits
+        scratch.resize(width * height * sizeof(u16));
+        auto* dst = (u16*)scratch.data();
+        for (u32 y = 0; y < height; y++) {
+            const auto* src = (const u16*)(frame->data[0] + y * frame->linesize[0]);
+            for (u32 x = 0; x < width; x++) {
+                dst[y * width + x] = src[x] << 6;
+            }
+        }
+        dx11State.deviceContext->UpdateSubresource(lum.Get(), 0, nullptr, scratch.data(), width * sizeof(u16), 0);
+    }
+    else {
+        dx11State.deviceContext->UpdateSubresource(lum.Get(), 0, nullptr, frame->data[0], frame->linesize[0], 0);
+    }
+
+    // Chroma
+    if (planarChroma) {
+        // Interleave U and V
+        if (is10bit) {
+            scratch.resize(chromWidth * chromHeight * 2 * sizeof(u16));
+            auto* dst = (u16*)scratch.data();
+            for (u32 y = 0; y < chromHeight; y++) {
+                const auto* srcU = (const u16*)(frame->data[1] + y * frame->linesize[1]);
+                const auto* srcV = (const u16*)(frame->data[2] + y * frame->linesize[2]);
+                for (u32 x = 0; x < chromWidth; x++) {
+                    dst[(y * chromWidth + x) * 2 + 0] = srcU[x] << 6;
+                    dst[(y * chromWidth + x) * 2 + 1] = srcV[x] << 6;
+                }
+            }
+            dx11State.deviceContext->UpdateSubresource(chrom.Get(), 0, nullptr, scratch.data(), chromWidth * 2 * sizeof(u16), 0);
+        }
+        else {
+            scratch.resize(chromWidth * chromHeight * 2);
+            auto* dst = scratch.data();
+            for (u32 y = 0; y < chromHeight; y++) {
+                const auto* srcU = frame->data[1] + y * frame->linesize[1];
+                const auto* srcV = frame->data[2] + y * frame->linesize[2];
+                for (u32 x = 0; x < chromWidth; x++) {
+                    dst[(y * chromWidth + x) * 2 + 0] = srcU[x];
+                    dst[(y * chromWidth + x) * 2 + 1] = srcV[x];
+                }
+            }
+            dx11State.deviceContext->UpdateSubresource(chrom.Get(), 0, nullptr, scratch.data(), chromWidth * 2, 0);
+        }
+    }
+    else {
+        dx11State.deviceContext->UpdateSubresource(chrom.Get(), 0, nullptr, frame->data[1], frame->linesize[1], 0);
+    }
+}
+
+const AVFrame* FFMpegPerVideoState::latestCpuFrame() const {
+    return latest.systemMemoryFrame();
+}
+
+std::optional<double> FFMpegPerVideoState::secondsFromStart(i64 timestamp) const {
+    if (timestamp == AV_NOPTS_VALUE)
+        return std::nullopt;
+    const i64 start = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+    return (double)(timestamp - start) * av_q2d(video_stream->time_base);
+}
+
+i64 FFMpegPerVideoState::timestampAt(double seconds) const {
+    const i64 start = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+    return start + (i64)std::llround(seconds / av_q2d(video_stream->time_base));
+}
+
+double FFMpegPerVideoState::durationInSeconds(i64 duration) const {
+    if (duration > 0)
+        return (double)duration * av_q2d(video_stream->time_base);
+    const AVRational rate = video_stream->avg_frame_rate;
+    return rate.num > 0 && rate.den > 0 ? av_q2d(av_inv_q(rate)) : 0.0;
+}
+
+u64 FFMpegPerVideoState::frameNumberAt(double seconds) const {
+    const double frameDuration = durationInSeconds(0);
+    if (seconds <= 0.0 || frameDuration <= 0.0)
+        return 0;
+    return (u64)std::llround(seconds / frameDuration);
+}
+
+double FFMpegPerVideoState::timeOfFrame(u64 frameNumber) const {
+    return (double)frameNumber * durationInSeconds(0);
+}
+
+void FFMpegPerVideoState::seekTo(double start, double end) {
+    assert(!decodeThread.joinable() && "Can't seek while decoding");
+    rangeStart = start;
+    rangeEnd = end;
+    if (start <= 0.0)
+        return;
+
+    auto indexStart = std::chrono::high_resolution_clock::now();
+    const KeyframeIndex index = load_or_build_keyframe_index(input_ctx, video_stream_index, path);
+    auto seekStart = std::chrono::high_resolution_clock::now();
+    // Seeks land on the last keyframe at or before the timestamp, by decode time for some demuxers and presentation
+    // time for others. Going by whichever is earlier means it's never the keyframe after.
+    const Keyframe* keyframe = index.lastAtOrBefore(timestampAt(start));
+    const i64 target = keyframe ? std::min(keyframe->pts, keyframe->dts) : timestampAt(0.0);
+    ThrowIfFfmpegFail(avformat_seek_file(input_ctx, video_stream_index, INT64_MIN, target, target, 0));
+
+    seekStats = SeekStats{
+        .seeked = true,
+        .indexSource = index.source,
+        .keyframes = index.keyframes.size(),
+        .indexMs = std::chrono::duration<double, std::milli>(seekStart - indexStart).count(),
+        .seekMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - seekStart).count(),
+        .keyframeTime = keyframe ? secondsFromStart(keyframe->pts).value_or(0.0) : 0.0,
+    };
+}
+
+void FFMpegPerVideoState::startDecoding() {
+    packetQueue = std::make_unique<BoundedQueue<AVPacketPtr>>(PACKET_QUEUE_DEPTH);
+    decodeQueue = std::make_unique<BoundedQueue<DecodedFrame>>(DECODE_QUEUE_DEPTH);
+    baseSkipFrame = decoder_ctx->skip_frame;
+    demuxThread = std::thread([this] {
+        try {
+            demuxLoop();
+        }
+        catch (...) {
+            demuxError = std::current_exception();
+        }
+        packetQueue->close();
+    });
+    decodeThread = std::thread([this] {
+        try {
+            decodeLoop();
+        }
+        catch (...) {
+            decodeError = std::current_exception();
+        }
+        decodeQueue->close();
+        // Nothing's going to take any more packets
+        packetQueue->close();
+    });
+}
+
+void FFMpegPerVideoState::stopDecoding() {
+    if (!decodeThread.joinable())
+        return;
+    // Unblocks the threads if they're waiting to push, and makes them stop at the next packet or frame otherwise
+    decodeQueue->close();
+    packetQueue->close();
+    decodeThread.join();
+    demuxThread.join();
+}
+
+void FFMpegPerVideoState::demuxLoop() {
+    while (true) {
         av_packet_unref(packet);
-        ThrowIfFfmpegFail(av_read_frame(input_ctx, packet));
-    } while (packet->stream_index != video_stream_index);
-
-    ThrowIfFfmpegFail(avcodec_send_packet(decoder_ctx, packet));
-    
-    int ret = avcodec_receive_frame(decoder_ctx, frame);
-    switch (ret) {
-    case 0: {
+        int ret = av_read_frame(input_ctx, packet);
+        if (ret == AVERROR_EOF)
+            return;
+        ThrowIfFfmpegFail(ret);
+        // Other streams are discarded, but the demuxer can still hand out the odd packet of them (attachments etc.)
+        if (packet->stream_index != video_stream_index)
+            continue;
+        // Frames are presented no earlier than they're decoded, so none from here on are in the range
+        const auto decodeTime = secondsFromStart(packet->dts);
+        if (decodeTime && *decodeTime >= rangeEnd)
+            return;
+        // The decoder would discard non-keyframes anyway, but dropping them here means it doesn't even parse them.
+        if (options.keyframesOnly && !(packet->flags & AV_PKT_FLAG_KEY))
+            continue;
+        if ((packet->flags & AV_PKT_FLAG_DISPOSABLE) && isUnwanted(packet)) {
+            decodeStats.packetsSkipped++;
+            continue;
+        }
+
+        AVPacketPtr queued(av_packet_alloc());
+        av_packet_move_ref(queued.get(), packet);
+        if (!packetQueue->push(std::move(queued)))
+            return;
+    }
+}
+
+void FFMpegPerVideoState::decodeLoop() {
+    while (true) {
+        const DecodeStep step = decodeStep();
+        decodeStats.steps++;
+        decodeStats.maxPacketsPerStep = std::max(decodeStats.maxPacketsPerStep, step.packetsSent);
+        decodeStats.maxFramesPerStep = std::max(decodeStats.maxFramesPerStep, step.framesReceived);
+        if (step.finished)
+            return;
+    }
+}
+
+bool FFMpegPerVideoState::isUnwanted(const AVPacket* packet) const {
+    const auto time = secondsFromStart(packet->pts);
+    if (!time)
+        return false;
+    const double duration = durationInSeconds(packet->duration);
+    return *time + duration <= rangeStart || (wanted && !wanted(*time, duration));
+}
+
+bool FFMpegPerVideoState::takePacket() {
+    auto next = packetQueue->pop();
+    if (!next) {
+        if (demuxError)
+            std::rethrow_exception(demuxError);
+        return false;
+    }
+    heldPacket = std::move(*next);
+    return true;
+}
+
+DecodeStep FFMpegPerVideoState::decodeStep() {
+    DecodeStep step;
+
+    // Feed the decoder until it won't take any more without some output being read first. A reordering decoder can
+    // take several packets before the first frame comes out; at the end of the file, the flush packet releases the
+    // frames it's still holding.
+    while (!flushSent) {
+        if (!heldPacket && !inputEnded) {
+            inputEnded = !takePacket();
+        }
+        // Not every container marks disposable packets, but the decoder can still skip unreferenced frames itself.
+        // Without frame threading it checks skip_frame while the packet is sent, so this only applies to this one.
+        if (heldPacket && !(decoder_ctx->active_thread_type & FF_THREAD_FRAME)) {
+            decoder_ctx->skip_frame = isUnwanted(heldPacket.get()) ? std::max(baseSkipFrame, AVDISCARD_NONREF) : baseSkipFrame;
+        }
+        int ret = avcodec_send_packet(decoder_ctx, heldPacket.get());
+        if (ret == AVERROR(EAGAIN))
+            break; // Keep whatever we were sending for the next step
+        ThrowIfFfmpegFail(ret);
+        if (heldPacket) {
+            heldPacket.reset();
+            step.packetsSent++;
+            decodeStats.packetsSent++;
+        }
+        else {
+            flushSent = true;
+        }
+    }
+
+    // Drain everything it has ready
+    while (true) {
+        DecodedFrame decoded = { .frame = AVFramePtr(av_frame_alloc()) };
+        int ret = avcodec_receive_frame(decoder_ctx, decoded.frame.get());
+        if (ret == AVERROR(EAGAIN)) {
+            // Copies still in flight are picked up next step, or once the ring fills
+            step.finished = !queueReadBack(false);
+            return step;
+        }
+        if (ret == AVERROR_EOF) {
+            queueReadBack(true);
+            step.finished = true;
+            return step;
+        }
+        ThrowIfFfmpegFail(ret);
+        step.framesReceived++;
+        decodeStats.framesReceived++;
+        if (flushSent) {
+            decodeStats.framesFlushed++;
+        }
+
+        decoded.time = secondsFromStart(decoded.frame->best_effort_timestamp);
+        decoded.duration = durationInSeconds(decoded.frame->duration);
+        if (decoded.time && *decoded.time >= rangeEnd) {
+            // Frames come out in presentation order, so that was the last of the range
+            queueReadBack(true);
+            step.finished = true;
+            return step;
+        }
+        if (decoded.time && *decoded.time + decoded.duration <= rangeStart) {
+            decodeStats.framesBeforeStart++;
+            continue;
+        }
+        if (wanted && decoded.time && !wanted(*decoded.time, decoded.duration)) {
+            decodeStats.framesDropped++;
+            continue;
+        }
+
+        if (options.cpuReadback && decoded.frame->format == AV_PIX_FMT_D3D11) {
+            if (readback.full()) {
+                // Nowhere to copy it to until the oldest copy is done
+                auto oldest = readback.finishOldest(true);
+                if (!decodeQueue->push(std::move(*oldest))) {
+                    step.finished = true;
+                    return step;
+                }
+            }
+            readback.start(std::move(decoded));
+            if (!queueReadBack(false)) {
+                step.finished = true;
+                return step;
+            }
+            continue;
+        }
+        // Behind any frames still being read back
+        if (!queueReadBack(true) || !decodeQueue->push(std::move(decoded))) {
+            step.finished = true;
+            return step;
+        }
+    }
+}
+
+bool FFMpegPerVideoState::queueReadBack(bool wait) {
+    while (auto decoded = readback.finishOldest(wait)) {
+        if (!decodeQueue->push(std::move(*decoded)))
+            return false;
+    }
+    return true;
+}
+
+std::optional<DecodedFrame> FFMpegPerVideoState::nextFrame() {
+    if (pending) {
+        std::optional<DecodedFrame> next = std::move(pending);
+        pending.reset();
+        return next;
+    }
+    auto next = decodeQueue->pop();
+    if (!next && decodeError)
+        std::rethrow_exception(decodeError);
+    return next;
+}
+
+void FFMpegPerVideoState::readFrame(DX11State& dx11State) {
+    hasNewFrame = false;
+    passedOver.clear();
+    // At the end of the video, keep showing the last frame
+    if (auto next = nextFrame()) {
+        latest = std::move(*next);
+        convertLatest(dx11State);
+    }
+}
+
+void FFMpegPerVideoState::readFrameAt(DX11State& dx11State, double target, FrameSyncStats& syncStats) {
+    hasNewFrame = false;
+    passedOver.clear();
+    syncStats.pairs++;
+    std::optional<DecodedFrame> chosen;
+    while (auto next = nextFrame()) {
+        if (next->time && !is_on_screen_by(*next->time, target)) {
+            // Belongs to a later target
+            pending = std::move(next);
+            break;
+        }
+        if (chosen) {
+            syncStats.passedOver480++;
+            if (keepPassedOver) {
+                // Don't hold on to decoder surfaces for frames that will never be converted
+                if (chosen->cpuFrame) {
+                    chosen->frame.reset();
+                }
+                passedOver.push_back(std::move(*chosen));
+            }
+        }
+        chosen = std::move(next);
+        // Without timestamps, all we can do is go one frame at a time
+        if (!chosen->time)
+            break;
+    }
+    if (!chosen) {
+        syncStats.repeated480++;
+        return;
+    }
+    latest = std::move(*chosen);
+    convertLatest(dx11State);
+}
+
+void FFMpegPerVideoState::convertLatest(DX11State& dx11State) {
+    const AVFrame* frame = latest.frame.get();
+    hasNewFrame = true;
+    decodedFrames++;
+
+    BackingFrameUAVs source;
+    if (frame->format == AV_PIX_FMT_D3D11) {
         auto newBackingFrame = (ID3D11Texture2D*)frame->data[0];
         updateBackingFrame(dx11State, newBackingFrame);
 
         const int texture_index = (intptr_t)frame->data[1];
-        DX11ColorspaceConstantBuffer buf = {
-            .texDims = DirectX::XMUINT2((u32)decoder_ctx->width, (u32)decoder_ctx->height),
-        };
-        dx11_write_buffer(dx11State.deviceContext, texDimConstantBuffer, &buf, sizeof(buf));
-
-        switch (decoder_ctx->colorspace) {
-        case AVCOL_SPC_BT709:
-            // TODO 709 and 601 are different!!!
-        case AVCOL_SPC_BT470BG:
-        case AVCOL_SPC_SMPTE170M: // these are both 601
-        case AVCOL_SPC_SMPTE240M: // TODO this has a different white point but it's close enough for now
-            dx11State.deviceContext->CSSetShader(dx11State.yuv_bt601_to_srgb_comp.Get(), nullptr, 0);
-            break;
-        case AVCOL_SPC_BT2020_CL:
-        case AVCOL_SPC_BT2020_NCL:
-            // TODO CL/NCL are slightly different!!
-            dx11State.deviceContext->CSSetShader(dx11State.yuv_rec2020_to_lin_rgb_comp.Get(), nullptr, 0);
-            break;
-        default:
-            assert(false && "don't know how to translate colorspace to rgb");
+        source = backingFrameUavs[texture_index];
+    }
+    else {
+        softwareUpload.upload(dx11State, frame);
+        dirtyTiles.ensurePreviousFrameTextures(dx11State, softwareUpload.equivalentHwFormat, stats.content_width, stats.content_height);
+        source = softwareUpload.uavs;
+    }
+
+    if (options.exportMotionVectors) {
+        motionStats.frames++;
+        if (!motionField.update(frame)) {
+            motionStats.framesWithoutVectors++;
         }
-        ID3D11UnorderedAccessView* uavs[] = {
-            backingFrameUavs[texture_index].lum.Get(),
-            backingFrameUavs[texture_index].chrom.Get(),
-            latestFrameAsRgbUav.Get()
-        };
-        dx11State.deviceContext->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
-        auto* cbuf = texDimConstantBuffer.Get();
-        dx11State.deviceContext->CSSetConstantBuffers(0, 1, &cbuf);
-        dx11State.deviceContext->Dispatch(buf.texDims.x, buf.texDims.y, 1);
-
-        //dx11State.deviceContext->CSSetShader(dx11State.yuv_rec2020_to_cielab_comp.Get(), nullptr, 0);
-        //uavs[2] = latestFrameAsLabUav.Get();
-        //dx11State.deviceContext->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
-        //dx11State.deviceContext->Dispatch(buf.texDims.x, buf.texDims.y, 1);
-
-        // Unbind resources for other rendering to use
-        uavs[0] = nullptr;
-        uavs[1] = nullptr;
-        uavs[2] = nullptr;
-        dx11State.deviceContext->CSSetUnorderedAccessViews(0, 3, uavs, nullptr);
-
-
-        //dx11State.deviceContext->CopySubresourceRegion(
-        //    lastFrameCopyTarget.Get(), 0, // subresource#0 of lastFrameCopyTarget
-        //    0, 0, 0, // DstXYZ
-        //    latestFrame, texture_index,
-        //    &regionToCopy
-        //);
-        break;
+        motionStats.recomputeFractionSum += motionField.recomputeFraction();
     }
-    case AVERROR_EOF:
-    case AVERROR(EAGAIN):
-        // Don't copy more stuff around, hopefully frame is still valid with the last frame of the video...
+
+    // decoder_ctx belongs to the decode thread now, everything about the frame comes from the frame itself
+    ID3D11ComputeShader* conversionShader = nullptr;
+    switch (frame->colorspace) {
+    case AVCOL_SPC_BT709:
+        // TODO 709 and 601 are different!!!
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M: // these are both 601
+    case AVCOL_SPC_SMPTE240M: // TODO this has a different white point but it's close enough for now
+        conversionShader = dx11State.yuv_bt601_to_srgb_comp.Get();
+        break;
+    case AVCOL_SPC_BT2020_CL:
+    case AVCOL_SPC_BT2020_NCL:
+        // TODO CL/NCL are slightly different!!
+        conversionShader = dx11State.yuv_rec2020_to_lin_rgb_comp.Get();
         break;
-    case AVERROR(EINVAL):
-        ThrowIfFfmpegFail(ret);
     default:
+        assert(false && "don't know how to translate colorspace to rgb");
+    }
+    // Output from a different conversion can't be reused
+    if (conversionShader != lastConversionShader) {
+        dirtyTiles.invalidate();
+        lastConversionShader = conversionShader;
+    }
+
+    // Converted in full until the bars have been found
+    auto activeArea = PixelRect::whole((u32)frame->width, (u32)frame->height);
+    const AVFrame* cpu = latestCpuFrame();
+    if (cpu) {
+        activeArea = letterbox.update(luma_plane_of(cpu));
+    }
+    else if (gpuLetterbox.width == (u32)frame->width && gpuLetterbox.height == (u32)frame->height) {
+        gpuLetterbox.collect(dx11State);
+        activeArea = gpuLetterbox.area.value_or(activeArea);
+    }
+    if (activeArea != convertedArea) {
+        // Black out the bars once, and convert the whole new area even where tiles look unchanged - they may
+        // never have been converted before
+        const FLOAT black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        dx11State.deviceContext->ClearUnorderedAccessViewFloat(latestFrameAsRgbUav.Get(), black);
+        dirtyTiles.invalidate();
+        convertedArea = activeArea;
+    }
+
+    DX11ColorspaceConstantBuffer buf = {
+        .texDims = DirectX::XMUINT2((u32)frame->width, (u32)frame->height),
+        .tileCounts = DirectX::XMUINT2(dirtyTiles.tilesX, dirtyTiles.tilesY),
+        .forceAllTilesDirty = dirtyTiles.forceAllDirty ? 1u : 0u,
+        .tileChangeThreshold = TILE_CHANGE_THRESHOLD,
+        .activeMin = DirectX::XMUINT2(activeArea.x, activeArea.y),
+        .activeMax = DirectX::XMUINT2(activeArea.x + activeArea.width, activeArea.y + activeArea.height),
+        // P010 keeps its 10 bits at the top of each 16-bit sample
+        .blackThreshold = (u32)LetterboxDetector::BLACK_THRESHOLD << (dirtyTiles.previousFrameFormat == DXGI_FORMAT_P010 ? 8 : 0),
+    };
+    dx11_write_buffer(dx11State.deviceContext, texDimConstantBuffer, &buf, sizeof(buf));
+    auto* cbuf = texDimConstantBuffer.Get();
+    dx11State.deviceContext->CSSetConstantBuffers(0, 1, &cbuf);
+
+    // Figure out which tiles actually need converting
+    dirtyTiles.detectChanges(dx11State, source.lum.Get(), source.chrom.Get());
+    // Without a system memory copy, the bars for later frames come from this one
+    if (!cpu) {
+        gpuLetterbox.detect(dx11State, source.lum.Get(), (u32)frame->width, (u32)frame->height);
+    }
+
+    dx11State.deviceContext->CSSetShader(conversionShader, nullptr, 0);
+    ID3D11UnorderedAccessView* uavs[] = {
+        source.lum.Get(),
+        source.chrom.Get(),
+        latestFrameAsRgbUav.Get(),
+        dirtyTiles.tileDirtyUav.Get(),
+    };
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, 4, uavs, nullptr);
+    dx11State.deviceContext->Dispatch(activeArea.width, activeArea.height, 1);
+
+    //dx11State.deviceContext->CSSetShader(dx11State.yuv_rec2020_to_cielab_comp.Get(), nullptr, 0);
+    //uavs[2] = latestFrameAsLabUav.Get();
+    //dx11State.deviceContext->CSSetUnorderedAccessViews(0, 4, uavs, nullptr);
+    //dx11State.deviceContext->Dispatch(buf.texDims.x, buf.texDims.y, 1);
+
+    // Unbind resources for other rendering to use
+    uavs[0] = nullptr;
+    uavs[1] = nullptr;
+    uavs[2] = nullptr;
+    uavs[3] = nullptr;
+    dx11State.deviceContext->CSSetUnorderedAccessViews(0, 4, uavs, nullptr);
+
+    dirtyTiles.collectStats(dx11State);
+
+
+    //dx11State.deviceContext->CopySubresourceRegion(
+    //    lastFrameCopyTarget.Get(), 0, // subresource#0 of lastFrameCopyTarget
+    //    0, 0, 0, // DstXYZ
+    //    latestFrame, texture_index,
+    //    &regionToCopy
+    //);
+}
+
+// Decodes every frame of a video in software and fingerprints it, for offline passes over a whole cut.
+std::vector<FrameFingerprint> ffmpeg_fingerprint_video(const char* path) {
+    AVFormatContext* input_ctx = nullptr;
+    ffmpeg_open_input(&input_ctx, path, true);
+    const AVCodec* decoder = nullptr;
+    const int video_stream_index = ThrowIfFfmpegFail(av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0));
+    // Don't bother demuxing audio/subtitles
+    for (unsigned int i = 0; i < input_ctx->nb_streams; i++) {
+        if ((int)i != video_stream_index) {
+            input_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    AVCodecContext* decoder_ctx = avcodec_alloc_context3(decoder);
+    assert(decoder_ctx);
+    ThrowIfFfmpegFail(avcodec_parameters_to_context(decoder_ctx, input_ctx->streams[video_stream_index]->codecpar));
+    decoder_ctx->thread_count = 0;
+    // Fingerprint thumbnails can't see blocking artifacts
+    decoder_ctx->skip_loop_filter = AVDISCARD_ALL;
+    ThrowIfFfmpegFail(avcodec_open2(decoder_ctx, decoder, NULL));
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    std::vector<FrameFingerprint> fingerprints;
+    // Same as playback, so both cuts are fingerprinted inside their bars
+    LetterboxDetector letterbox;
+    auto receive_frames = [&]() {
+        while (true) {
+            int ret = avcodec_receive_frame(decoder_ctx, frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return;
+            ThrowIfFfmpegFail(ret);
+            const auto luma = luma_plane_of(frame);
+            fingerprints.push_back(fingerprint_of(luma, letterbox.update(luma)));
+            av_frame_unref(frame);
+        }
+    };
+    int ret;
+    while ((ret = av_read_frame(input_ctx, packet)) >= 0) {
+        if (packet->stream_index == video_stream_index) {
+            ThrowIfFfmpegFail(avcodec_send_packet(decoder_ctx, packet));
+            receive_frames();
+        }
+        av_packet_unref(packet);
+    }
+    if (ret != AVERROR_EOF) {
         ThrowIfFfmpegFail(ret);
     }
+    // Drain whatever the decoder is still holding on to
+    ThrowIfFfmpegFail(avcodec_send_packet(decoder_ctx, NULL));
+    receive_frames();
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&decoder_ctx);
+    avformat_close_input(&input_ctx);
+    return fingerprints;
+}
+
+void build_edit_decision_list(const char* path2160, const char* path480, const std::wstring& edlPath) {
+    auto fingerprints2160 = ffmpeg_fingerprint_video(path2160);
+    auto fingerprints480 = ffmpeg_fingerprint_video(path480);
+    auto edl = align_cuts(fingerprints2160, fingerprints480);
+    edl.write(edlPath);
+
+    u64 unmatched = std::count(edl.frame480For2160.begin(), edl.frame480For2160.end(), -1);
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "EDL: %zu 2160p frames, %zu 480p frames, %zu segments, %llu 2160p frames without a counterpart. "
+        "%llu anchors, %.1f MiB of backpointers\n",
+        fingerprints2160.size(), fingerprints480.size(), edl.segments.size(), unmatched,
+        edl.stats.anchors, edl.stats.backpointerBytes / (1024.0 * 1024.0));
+    OutputDebugStringA(msgbuf);
+}
+
+void log_dirty_tile_stats(const char* name, const DirtyTileStats& stats) {
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: skipped %.1f%% of %llu tiles (%llu frames not counted, readback still in flight)\n",
+        name, stats.skippedFraction() * 100.0, stats.tilesConsidered, stats.framesUncounted);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_letterbox_stats(const char* name, const LetterboxDetector& letterbox, const PixelRect& convertedArea) {
+    const auto& stats = letterbox.stats;
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: converting %ux%u at (%u, %u), %llu letterbox detections (%llu mid-shot) over %llu frames, %.3fms/frame\n",
+        name, convertedArea.width, convertedArea.height, convertedArea.x, convertedArea.y, stats.detections, stats.invalidations, stats.frames,
+        stats.frames ? stats.totalMs / stats.frames : 0.0);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_gpu_letterbox_stats(const char* name, const GpuLetterboxStats& stats) {
+    if (!stats.dispatches && !stats.framesUncounted)
+        return;
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu letterbox detections on the GPU, %llu read back (%llu frames skipped, readback still in flight)\n",
+        name, stats.dispatches, stats.readbacks, stats.framesUncounted);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_decode_queue_stats(const char* name, const FFMpegPerVideoState& video) {
+    if (!video.decodeQueue)
+        return;
+    // A full queue means decode kept up with rendering, an empty one that rendering waited on decode
+    const auto stats = video.decodeQueue->getStats();
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu frames decoded, decoder waited on a full queue %llu times (%.1fms), render loop on an empty one %llu times (%.1fms)\n",
+        name, stats.pushes, stats.fullWaits, stats.fullWaitMs, stats.emptyWaits, stats.emptyWaitMs);
+    OutputDebugStringA(msgbuf);
+    const auto packets = video.packetQueue->getStats();
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu packets demuxed, demuxer waited on a full queue %llu times (%.1fms), decoder on an empty one %llu times (%.1fms)\n",
+        name, packets.pushes, packets.fullWaits, packets.fullWaitMs, packets.emptyWaits, packets.emptyWaitMs);
+    OutputDebugStringA(msgbuf);
+    const auto& decode = video.decodeStats;
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu packets sent, %llu frames received (%llu at the final flush) over %llu steps, at most %u packets and %u frames in one\n",
+        name, decode.packetsSent, decode.framesReceived, decode.framesFlushed, decode.steps, decode.maxPacketsPerStep, decode.maxFramesPerStep);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_readback_stats(const char* name, const FFMpegPerVideoState& video) {
+    const auto& stats = video.readback.stats;
+    if (stats.frames == 0)
+        return;
+    // Copy and map times include waiting for the immediate context's lock, i.e. for the render loop
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu frames read back, copy %.3fms mean (%.3fms worst), map %.3fms mean (%.3fms worst), %llu polls not ready, waited on the GPU %llu times (%.1fms)\n",
+        name, stats.frames, stats.totalCopyMs / stats.frames, stats.worstCopyMs, stats.totalMapMs / stats.frames, stats.worstMapMs,
+        stats.notReadyPolls, stats.waits, stats.waitMs);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_read_ahead_stats(const char* name, const FFMpegPerVideoState& video, double playbackSeconds) {
+    if (!video.reader)
+        return;
+    // Stalls are what the demuxer actually waited on the disk, the rest of the read time was hidden behind decoding
+    const auto stats = video.reader->getStats();
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: read %.1fMB in %llu %s reads (up to %u in flight) over %llu runs, %.1fMB/s overall, %.1fMB/s while waiting on reads\n",
+        name, stats.bytesRead / 1e6, stats.reads, stats.overlapped ? "overlapped" : "synchronous", stats.maxReadsInFlight, stats.runs,
+        playbackSeconds > 0 ? stats.bytesRead / 1e6 / playbackSeconds : 0.0, stats.readMs > 0 ? stats.bytesRead / 1e3 / stats.readMs : 0.0);
+    OutputDebugStringA(msgbuf);
+    snprintf(msgbuf, sizeof(msgbuf), "%s: demuxer stalled %llu times (%.1fms), %llu seeks outside the buffer\n",
+        name, stats.stalls, stats.stallMs, stats.seeks);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_input_open_stats(const char* name, const InputOpenStats& stats) {
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: opened in %.1fms, stream info %s in %.1fms%s\n",
+        name, stats.openMs, stats.fromProbeCache ? "from the probe cache" : "probed", stats.streamInfoMs,
+        !stats.fromProbeCache && !stats.probeCacheWritten ? " (couldn't write the probe cache)" : "");
+    OutputDebugStringA(msgbuf);
+}
+
+void log_seek_stats(const char* name, const FFMpegPerVideoState& video) {
+    const auto& seek = video.seekStats;
+    if (!seek.seeked)
+        return;
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: started at %.3fs from the keyframe at %.3fs (%llu frames decoded to get there), index of %llu keyframes from %s in %.1fms, seek %.1fms\n",
+        name, video.rangeStart, seek.keyframeTime, video.decodeStats.framesBeforeStart, seek.keyframes, keyframe_index_source_name(seek.indexSource), seek.indexMs, seek.seekMs);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_startup_stats(const StartupStats& stats) {
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "Startup: 480p decoding after %.1fms, 2160p after %.1fms, first frame converted after %.1fms and on screen after %.1fms\n",
+        stats.ready480Ms, stats.ready2160Ms, stats.firstFrameMs, stats.firstPresentMs);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_read_scheduler_stats(const ReadScheduler& scheduler) {
+    const auto stats = scheduler.getStats();
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "Read scheduler: %llu runs, switched files %llu times\n", stats.runs, stats.switches);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_sync_stats(const FrameSyncStats& stats, const DecodeThreadStats& decode480) {
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "Sync: %llu pairs, %llu repeating the previous 480p frame, %llu 480p frames passed over. "
+        "480p decode skipped %llu packets, dropped %llu frames\n",
+        stats.pairs, stats.repeated480, stats.passedOver480, decode480.packetsSkipped, decode480.framesDropped);
+    OutputDebugStringA(msgbuf);
+}
+
+void log_motion_field_stats(const char* name, const MotionFieldStats& stats) {
+    char msgbuf[256];
+    snprintf(msgbuf, sizeof(msgbuf), "%s: %llu/%llu frames had no motion vectors, %.1f%% of blocks needed recomputing on average\n",
+        name, stats.framesWithoutVectors, stats.frames, stats.meanRecomputeFraction() * 100.0);
+    OutputDebugStringA(msgbuf);
+}
+
+// The 2160p frame is analysed at a quarter of its resolution (pyramid level 2), which puts it in the same ballpark as
+// the 480p frame.
+constexpr u32 ANALYSIS_LEVEL_2160 = 2;
+constexpr u32 ANALYSIS_DOWNSCALE_2160 = 1 << ANALYSIS_LEVEL_2160;
+// Fingerprints are 16x16 thumbnails, no point building them from more than a few hundred pixels across
+constexpr u32 FINGERPRINT_LEVEL_2160 = 4;
+
+void CpuFrameAnalysis::update(FFMpegPerVideoState& video480, FFMpegPerVideoState& video2160) {
+    bool new480 = false, new2160 = false;
+    const auto take480 = [&](const DecodedFrame& decoded) {
+        const AVFrame* frame480 = decoded.systemMemoryFrame();
+        if (!frame480)
+            return;
+        auto luma480 = luma_plane_of(frame480);
+        if (inverseTelecine480) {
+            // Pulldown repeats don't count as new frames
+            if (auto progressive = ivtc480.process(luma480)) {
+                image480 = std::move(*progressive);
+                time480 = decoded.time;
+                new480 = true;
+            }
+        }
+        else {
+            image480 = to_gray_image(luma480);
+            time480 = decoded.time;
+            new480 = true;
+        }
+    };
+    if (video480.hasNewFrame) {
+        // Frames the sync skipped still carry fields the pulldown cadence needs
+        for (const auto& skipped : video480.passedOver) {
+            take480(skipped);
+        }
+        take480(video480.latest);
+    }
+    const AVFrame* frame2160 = video2160.latestCpuFrame();
+    if (video2160.hasNewFrame && frame2160) {
+        pyramid2160 = ImagePyramid::of(frame2160);
+        new2160 = true;
+    }
+    if ((!new480 && !new2160) || image480.empty() || !pyramid2160)
+        return;
+
+    if (matchFingerprints) {
+        // Both inside their bars, which is where the two cuts show the same picture
+        if (new480 && time480) {
+            const auto area480 = video480.convertedArea.resizedInward(
+                (u32)video480.latest.frame->width, (u32)video480.latest.frame->height, image480.width, image480.height);
+            fingerprints480.add(video480.frameNumberAt(*time480), fingerprint_of(image480, area480));
+        }
+        else if (new480) {
+            fingerprintStats.untimed480++;
+        }
+        if (new2160) {
+            const auto& level = pyramid2160->level(FINGERPRINT_LEVEL_2160);
+            const auto area2160 = video2160.convertedArea.resizedInward(
+                (u32)frame2160->width, (u32)frame2160->height, level.width, level.height);
+            auto fingerprint = fingerprint_of(level, area2160);
+            auto start = std::chrono::high_resolution_clock::now();
+            auto match = fingerprints480.find(fingerprint);
+            double queryMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            fingerprintStats.queries++;
+            fingerprintStats.matches += match ? 1 : 0;
+            fingerprintStats.totalQueryMs += queryMs;
+            fingerprintStats.worstQueryMs = std::max(fingerprintStats.worstQueryMs, queryMs);
+            if (match && video2160.latest.time) {
+                const double offset = video480.timeOfFrame(match->frameNumber) - *video2160.latest.time;
+                fingerprintStats.timedMatches++;
+                fingerprintStats.totalMatchOffset += offset;
+                fingerprintStats.lastMatchOffset = offset;
+            }
+        }
+    }
+
+    if (convertToLab2160 && new2160) {
+        // Once the alignment is known, at the scale it maps 2160p pixels onto 480p ones. Until then, at the 480p height.
+        const float scale = alignment.transform
+            ? alignment.transform->scale() / ANALYSIS_DOWNSCALE_2160
+            : (float)image480.height / (float)frame2160->height;
+        // Only the picture, not the bars
+        const auto& area = video2160.convertedArea;
+        const u32 width = std::max(1u, (u32)(area.width * scale + 0.5f));
+        const u32 height = std::max(1u, (u32)(area.height * scale + 0.5f));
+        auto start = std::chrono::high_resolution_clock::now();
+        // Without a timestamp there's no telling whether the last conversion was of the frame just before
+        std::optional<u64> frameNumber;
+        if (video2160.latest.time) {
+            frameNumber = video2160.frameNumberAt(*video2160.latest.time);
+        }
+        const bool followsLast = frameNumber && lab2160Frame && *frameNumber == *lab2160Frame + 1;
+        if (followsLast && video2160.motionField.hasVectors && area == lab2160Area && width == lab2160.width && height == lab2160.height) {
+            u32 converted = 0;
+            lab2160 = downscale_area_to_lab(frame2160, area, lab2160, video2160.motionField, &converted);
+            labStats.propagatedFrames++;
+            labStats.propagatedConvertedSum += (double)converted / ((double)width * height);
+        }
+        else {
+            lab2160 = downscale_area_to_lab(frame2160, area, width, height);
+        }
+        lab2160Area = area;
+        lab2160Frame = frameNumber;
+        labStats.frames++;
+        labStats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    if (!trackAlignment)
+        return;
+
+    std::optional<float> codecChangedFraction;
+    if (video2160.options.exportMotionVectors && new2160 && video2160.motionField.hasVectors) {
+        codecChangedFraction = video2160.motionField.recomputeFraction();
+    }
+
+    u64 estimationsBefore = alignment.stats.estimations;
+    u64 shotCutsBefore = alignment.stats.shotCuts;
+    alignment.activeArea480 = video480.convertedArea;
+    alignment.activeArea2160 = video2160.convertedArea;
+    auto transform = alignment.update(image480, *pyramid2160, ANALYSIS_LEVEL_2160, codecChangedFraction);
+    if (alignment.stats.shotCuts != shotCutsBefore) {
+        // The bars might change with the shot, look for them again next frame
+        video480.letterbox.newShot();
+        video2160.letterbox.newShot();
+    }
+    if (alignment.stats.estimations != estimationsBefore) {
+        char msgbuf[256];
+        if (transform) {
+            // Report in full 2160p pixels
+            auto full = transform->downscaled(1.0f / ANALYSIS_DOWNSCALE_2160, 1.0f);
+            snprintf(msgbuf, sizeof(msgbuf), "Re-estimated alignment: scale %.4f, rotation %.4f, offset (%.1f, %.1f)\n",
+                full.scale(), std::atan2(full.b, full.a), full.tx, full.ty);
+        }
+        else {
+            snprintf(msgbuf, sizeof(msgbuf), "Failed to estimate alignment\n");
+        }
+        OutputDebugStringA(msgbuf);
+    }
+}
+
+std::optional<SimilarityTransform> CpuFrameAnalysis::estimateAlignment(const GrayImage& image480, const GrayImage& image2160) {
+    featureStats = {};
+    // Nearly always a pure scale + crop, which the phase correlation gets in a fixed few milliseconds
+    if (auto transform = align_phase_correlation(image480, image2160, &phaseCorrelationStats))
+        return transform;
+    phaseCorrelationFallbacks++;
+    if (auto transform = align_features(image480, image2160, &featureStats))
+        return transform;
+    // Flat or very dark frames don't have enough corners, the exhaustive search can still lock onto them
+    featureFallbacks++;
+    return search_scale_translation(image480, image2160);
+}
+
+void CpuFrameAnalysis::logStats() const {
+    char msgbuf[256];
+    if (inverseTelecine480) {
+        const auto& stats = ivtc480.stats;
+        snprintf(msgbuf, sizeof(msgbuf), "480p IVTC: %llu frames, %llu field matched current, %llu previous, %llu deinterlaced, %llu repeats dropped, %.3fms/frame\n",
+            stats.frames, stats.matchedCurrent, stats.matchedPrevious, stats.deinterlaced, stats.duplicatesDropped,
+            stats.frames ? stats.totalMs / stats.frames : 0.0);
+        OutputDebugStringA(msgbuf);
+    }
+    if (trackAlignment) {
+        const auto& stats = alignment.stats;
+        snprintf(msgbuf, sizeof(msgbuf), "Alignment: %llu frames, %llu estimations (%llu failed), %llu shot cuts, %llu drifts, %llu warp tables built\n",
+            stats.frames, stats.estimations, stats.failedEstimations, stats.shotCuts, stats.driftDetections, stats.warpTableBuilds);
+        OutputDebugStringA(msgbuf);
+        snprintf(msgbuf, sizeof(msgbuf), "Alignment patch checks: %llu/%llu passed, %.1fus/check\n",
+            stats.patchCheckPasses, stats.patchChecks, stats.patchChecks ? stats.patchCheckMs * 1000.0 / stats.patchChecks : 0.0);
+        OutputDebugStringA(msgbuf);
+        snprintf(msgbuf, sizeof(msgbuf), "Phase correlation: %llu fallbacks to features, last peaks %.1f (scale) %.1f (translation), correlation %.3f, %.3fms\n",
+            phaseCorrelationFallbacks, phaseCorrelationStats.scalePeak, phaseCorrelationStats.translationPeak, phaseCorrelationStats.correlation, phaseCorrelationStats.ms);
+        OutputDebugStringA(msgbuf);
+        snprintf(msgbuf, sizeof(msgbuf), "Feature alignment: %llu fallbacks to search, last had %u/%u features, %u matches, %u inliers (%.0f%%, %.2fpx RMS)\n",
+            featureFallbacks, featureStats.features480, featureStats.features2160, featureStats.matches, featureStats.inliers,
+            featureStats.inlierRatio * 100.0f, featureStats.rmsInlierError);
+        OutputDebugStringA(msgbuf);
+    }
+    if (matchFingerprints) {
+        const auto& stats = fingerprintStats;
+        snprintf(msgbuf, sizeof(msgbuf), "Fingerprints: %zu 480p frames indexed (%llu without timestamps), %llu/%llu 2160p frames matched, %.3fms mean query, %.3fms worst\n",
+            fingerprints480.size(), stats.untimed480, stats.matches, stats.queries, stats.queries ? stats.totalQueryMs / stats.queries : 0.0, stats.worstQueryMs);
+        OutputDebugStringA(msgbuf);
+        snprintf(msgbuf, sizeof(msgbuf), "Fingerprint matches: 480p - 2160p time %.3fs mean, %.3fs latest (over %llu matches)\n",
+            stats.timedMatches ? stats.totalMatchOffset / stats.timedMatches : 0.0, stats.lastMatchOffset, stats.timedMatches);
+        OutputDebugStringA(msgbuf);
+    }
+    if (convertToLab2160) {
+        snprintf(msgbuf, sizeof(msgbuf), "2160p Lab: %llu frames converted, latest %ux%u, %.3fms/frame, %llu carried over along motion vectors (%.1f%% converted anyway)\n",
+            labStats.frames, lab2160.width, lab2160.height, labStats.frames ? labStats.totalMs / labStats.frames : 0.0,
+            labStats.propagatedFrames, labStats.propagatedFrames ? labStats.propagatedConvertedSum / labStats.propagatedFrames * 100.0 : 0.0);
+        OutputDebugStringA(msgbuf);
+    }
 }
 
 int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLine, int nCmdShow)
@@ -707,8 +2070,19 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
     // be rendered in a DPI sensitive fashion.
     SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
 
+    const auto startupStart = std::chrono::high_resolution_clock::now();
+    const auto msSinceStartup = [&startupStart] {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupStart).count();
+    };
+    StartupStats startupStats;
+
     auto args = parse_command_line_args();
 
+    if (!args.edlPath.empty()) {
+        build_edit_decision_list(VIDEO_PATH_2160, VIDEO_PATH_480, args.edlPath);
+        return 0;
+    }
+
     //auto format480 = detect_format_of("../../../../480p.mp4");
     //auto format2160 = detect_format_of("../../../../2160p.mkv");
 
@@ -728,8 +2102,79 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
     {
         DX11State dx11State = dx11_init();
         g_dx11Initialized = true;
-        FFMpegPerVideoState ffmpeg480 = ffmpeg_create_decoder(dx11State, "../../../../480p.mp4");
-        FFMpegPerVideoState ffmpeg2160 = ffmpeg_create_decoder(dx11State, "../../../../2160p.mkv");
+        // Both files are usually on the same drive, so by default they take turns at it. Declared before the videos so
+        // it outlives their readers.
+        std::unique_ptr<ReadScheduler> readScheduler;
+        if (!args.separateReaders) {
+            readScheduler = std::make_unique<ReadScheduler>();
+        }
+        auto decodeOptions480 = FFMpegDecodeOptions{
+            .keyframesOnly = args.analysisMode,
+            .cpuReadback = args.trackAlignment || args.matchFingerprints || args.convertToLab,
+            .readAheadBytes = args.readAheadBytes,
+            .readsInFlight = args.readsInFlight,
+            .readScheduler = readScheduler.get(),
+            .useProbeCache = !args.reprobe,
+        };
+        auto decodeOptions2160 = FFMpegDecodeOptions{
+            .keyframesOnly = args.analysisMode,
+            .exportMotionVectors = args.motionVectors,
+            .cpuReadback = args.trackAlignment || args.matchFingerprints || args.convertToLab,
+            .readAheadBytes = args.readAheadBytes,
+            .readsInFlight = args.readsInFlight,
+            .readScheduler = readScheduler.get(),
+            .useProbeCache = !args.reprobe,
+        };
+        // Opening a file, probing it and creating its decoder is mostly waiting on the disk and the driver, so both
+        // files are opened at once. The 2160p decoder starts on its first frames as soon as it's created, since
+        // nothing about it depends on the other file; the 480p one has to wait to know which frames it'll need.
+        // Seeking (if a range was asked for) happens on the same threads, since building a keyframe index can take a
+        // pass over the whole file.
+        const bool seeking = args.start > 0.0 || args.end < std::numeric_limits<double>::infinity();
+        FFMpegPerVideoState ffmpeg480, ffmpeg2160;
+        auto create480 = std::async(std::launch::async, [&] {
+            ffmpeg480 = ffmpeg_create_decoder(dx11State, VIDEO_PATH_480, decodeOptions480);
+            if (seeking) {
+                ffmpeg480.seekTo(args.sync.to480(args.start), args.sync.to480(args.end));
+            }
+        });
+        auto create2160 = std::async(std::launch::async, [&] {
+            ffmpeg2160 = ffmpeg_create_decoder(dx11State, VIDEO_PATH_2160, decodeOptions2160);
+            if (seeking) {
+                ffmpeg2160.seekTo(args.start, args.end);
+            }
+            ffmpeg2160.startDecoding();
+            startupStats.ready2160Ms = msSinceStartup();
+        });
+        create2160.get();
+        create480.get();
+        log_input_open_stats("480p", ffmpeg480.openStats);
+        log_input_open_stats("2160p", ffmpeg2160.openStats);
+
+        CpuFrameAnalysis cpuAnalysis;
+        cpuAnalysis.trackAlignment = args.trackAlignment;
+        cpuAnalysis.matchFingerprints = args.matchFingerprints;
+        cpuAnalysis.convertToLab2160 = args.convertToLab;
+        cpuAnalysis.inverseTelecine480 = ffmpeg480.mayBeInterlaced();
+        cpuAnalysis.ivtc480.topFieldFirst = ffmpeg480.topFieldFirst();
+        cpuAnalysis.alignment.estimator = [&cpuAnalysis](const GrayImage& image480, const GrayImage& image2160) {
+            return cpuAnalysis.estimateAlignment(image480, image2160);
+        };
+
+        // The 2160p frames set the pace, each paired with the 480p frame on screen at the same moment
+        FrameSyncStats syncStats;
+        ffmpeg480.keepPassedOver = cpuAnalysis.enabled() && cpuAnalysis.inverseTelecine480;
+        if (!ffmpeg480.keepPassedOver && !args.analysisMode) {
+            // So 480p frames falling between 2160p ones needn't be decoded at all. Keyframe-only decoding has no
+            // regular 2160p frame times to go by.
+            const double period2160 = ffmpeg2160.durationInSeconds(0);
+            ffmpeg480.wanted = [sync = args.sync, period2160](double time, double duration) {
+                return is_480p_frame_needed(sync, period2160, time, duration);
+            };
+        }
+        ffmpeg480.startDecoding();
+        startupStats.ready480Ms = msSinceStartup();
+        const auto playbackStart = std::chrono::high_resolution_clock::now();
 
         ::ShowWindow(g_windowState.hWnd, SW_SHOW);
 
@@ -742,12 +2187,61 @@ int CALLBACK wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
                 ::DispatchMessage(&msg);
             }
             else {
-                ffmpeg480.readFrame(dx11State);
                 ffmpeg2160.readFrame(dx11State);
+                if (!ffmpeg2160.hasNewFrame) {
+                    // Nothing left to pair with
+                    ffmpeg480.hasNewFrame = false;
+                }
+                else if (ffmpeg2160.latest.time) {
+                    ffmpeg480.readFrameAt(dx11State, args.sync.to480(*ffmpeg2160.latest.time), syncStats);
+                }
+                else {
+                    ffmpeg480.readFrame(dx11State);
+                }
+                if (cpuAnalysis.enabled()) {
+                    cpuAnalysis.update(ffmpeg480, ffmpeg2160);
+                }
+                const bool firstFrame = startupStats.firstFrameMs == 0.0 && ffmpeg2160.hasNewFrame;
+                if (firstFrame) {
+                    startupStats.firstFrameMs = msSinceStartup();
+                }
                 dx11State.enqueueRenderAndPresentForNextFrame(ffmpeg2160.latestFrameAsRgbSrv);
+                if (firstFrame) {
+                    startupStats.firstPresentMs = msSinceStartup();
+                    log_startup_stats(startupStats);
+                }
             }
         }
 
+        log_dirty_tile_stats("480p", ffmpeg480.dirtyTiles.stats);
+        log_dirty_tile_stats("2160p", ffmpeg2160.dirtyTiles.stats);
+        log_letterbox_stats("480p", ffmpeg480.letterbox, ffmpeg480.convertedArea);
+        log_letterbox_stats("2160p", ffmpeg2160.letterbox, ffmpeg2160.convertedArea);
+        log_gpu_letterbox_stats("480p", ffmpeg480.gpuLetterbox.stats);
+        log_gpu_letterbox_stats("2160p", ffmpeg2160.gpuLetterbox.stats);
+        // Decode stats belong to the decode threads until they've stopped
+        ffmpeg480.stopDecoding();
+        ffmpeg2160.stopDecoding();
+        log_decode_queue_stats("480p", ffmpeg480);
+        log_decode_queue_stats("2160p", ffmpeg2160);
+        log_readback_stats("480p", ffmpeg480);
+        log_readback_stats("2160p", ffmpeg2160);
+        log_seek_stats("480p", ffmpeg480);
+        log_seek_stats("2160p", ffmpeg2160);
+        const double playbackSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - playbackStart).count();
+        log_read_ahead_stats("480p", ffmpeg480, playbackSeconds);
+        log_read_ahead_stats("2160p", ffmpeg2160, playbackSeconds);
+        if (readScheduler) {
+            log_read_scheduler_stats(*readScheduler);
+        }
+        log_sync_stats(syncStats, ffmpeg480.decodeStats);
+        if (ffmpeg2160.options.exportMotionVectors) {
+            log_motion_field_stats("2160p", ffmpeg2160.motionStats);
+        }
+        if (cpuAnalysis.enabled()) {
+            cpuAnalysis.logStats();
+        }
+
         // Make sure the command queue has finished all commands before closing.
         ffmpeg2160.flushAndClose();
         ffmpeg480.flushAndClose();
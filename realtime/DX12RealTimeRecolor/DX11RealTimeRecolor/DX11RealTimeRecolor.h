@@ -4,17 +4,50 @@
 #pragma once
 
 #include "Utils/windxheaders.h"
+#include "Utils/types.h"
+#include "Utils/boundedqueue.h"
+#include "Analysis/motionfield.h"
+#include "Analysis/alignmenttracker.h"
+#include "Analysis/features.h"
+#include "Analysis/phasecorrelation.h"
+#include "Analysis/pyramid.h"
+#include "Analysis/fingerprint.h"
+#include "Analysis/lab.h"
+#include "Analysis/letterbox.h"
+#include "Analysis/editdecisions.h"
+#include "Analysis/ivtc.h"
+#include "Analysis/streamsync.h"
+#include "IO/readahead.h"
+#include "IO/readscheduler.h"
+#include "IO/probecache.h"
+#include "IO/keyframeindex.h"
 
 #include <array>
 #include <chrono>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace RTR {
-    using u8 = uint8_t;
-    using u16 = uint16_t;
-    using u32 = uint32_t;
-    using u64 = uint64_t;
-
     constexpr u32 NUM_INFLIGHT_FRAMES = 2;
+    // How many decoded frames each decode thread can get ahead of the render loop
+    constexpr u32 DECODE_QUEUE_DEPTH = 4;
+    // How many video packets each demux thread can read ahead of its decoder. A couple of seconds of 2160p HEVC, so the
+    // odd slow read doesn't starve it.
+    constexpr u32 PACKET_QUEUE_DEPTH = 64;
+
+    // Frames are split into TILE_SIZE x TILE_SIZE tiles of luma for change detection. Must match TILE_SIZE in includes.hlsl.
+    constexpr u32 TILE_SIZE = 16;
+    // A tile is considered changed if any luma/chroma sample differs from the last converted frame by more than this (in raw texture units).
+    // 0 => only bit-exact static content (letterboxing, skipped blocks in P/B frames) is reused.
+    constexpr u32 TILE_CHANGE_THRESHOLD = 0;
 
     constexpr struct {
         float x, y, z, w;
@@ -41,7 +74,15 @@ namespace RTR {
 
     struct DX11ColorspaceConstantBuffer {
         DirectX::XMUINT2 texDims;
-        DirectX::XMUINT2 padding;
+        DirectX::XMUINT2 tileCounts;
+        u32 forceAllTilesDirty;
+        u32 tileChangeThreshold;
+        // Conversion shaders only touch [activeMin, activeMax), the picture inside any letterbox bars
+        DirectX::XMUINT2 activeMin;
+        DirectX::XMUINT2 activeMax;
+        // Luma above this (in raw texture units) isn't letterbox black, see letterbox_detect_comp.hlsl
+        u32 blackThreshold;
+        u32 padding;
     };
 
     struct DX11State {
@@ -60,6 +101,8 @@ namespace RTR {
         ComPtr<ID3D11PixelShader> rgb_frag;
         ComPtr<ID3D11ComputeShader> yuv_rec2020_to_cielab_comp;
         ComPtr<ID3D11ComputeShader> yuv_rec2020_to_lin_rgb_comp;
+        ComPtr<ID3D11ComputeShader> tile_change_detect_comp;
+        ComPtr<ID3D11ComputeShader> letterbox_detect_comp;
 
         ComPtr<ID3D11Buffer> quadVertexBuffer;
         ComPtr<ID3D11Buffer> quadIndexBuffer;
@@ -74,12 +117,264 @@ namespace RTR {
         ComPtr<ID3D11UnorderedAccessView> lum, chrom;
     };
 
+    struct DirtyTileStats {
+        u64 tilesConsidered = 0;
+        u64 tilesSkipped = 0;
+        // Frames whose dirty count wasn't read back, because every readback buffer was still in flight.
+        // Not in tilesConsidered, so the skipped fraction is over the frames that were counted.
+        u64 framesUncounted = 0;
+
+        double skippedFraction() const {
+            return tilesConsidered ? (double)tilesSkipped / (double)tilesConsidered : 0.0;
+        }
+    };
+
+    // Tracks which tiles of a video changed since the last frame we converted,
+    // so the conversion shaders can leave the previous output in place for static tiles.
+    struct DirtyTileTracker {
+        u32 tilesX = 0, tilesY = 0;
+        // Set whenever the previous output can't be trusted (first frame, new conversion shader, new LUT...)
+        bool forceAllDirty = true;
+
+        // Copy of the last input we actually converted, per-tile
+        DXGI_FORMAT previousFrameFormat = DXGI_FORMAT_UNKNOWN;
+        ComPtr<ID3D11Texture2D> previousLum, previousChrom;
+        ComPtr<ID3D11UnorderedAccessView> previousLumUav, previousChromUav;
+
+        // One u32 per tile, nonzero => the conversion shader should process that tile
+        ComPtr<ID3D11Buffer> tileDirty;
+        ComPtr<ID3D11UnorderedAccessView> tileDirtyUav;
+        // Single u32 counting dirty tiles, read back NUM_INFLIGHT_FRAMES frames later to avoid stalling
+        ComPtr<ID3D11Buffer> dirtyTileCount;
+        ComPtr<ID3D11UnorderedAccessView> dirtyTileCountUav;
+        std::array<ComPtr<ID3D11Buffer>, NUM_INFLIGHT_FRAMES> dirtyTileCountReadback;
+        std::array<bool, NUM_INFLIGHT_FRAMES> readbackPending = {};
+        u32 readbackIndex = 0;
+
+        DirtyTileStats stats;
+
+        void create(DX11State& dx11State, u32 width, u32 height);
+        void ensurePreviousFrameTextures(DX11State& dx11State, DXGI_FORMAT backingFormat, u32 width, u32 height);
+        void invalidate() { forceAllDirty = true; }
+        void detectChanges(DX11State& dx11State, ID3D11UnorderedAccessView* lum, ID3D11UnorderedAccessView* chrom);
+        // Reads back every finished count, oldest first
+        void collectStats(DX11State& dx11State);
+    private:
+        // Adds one pending readback to stats. False if the GPU hasn't got to it yet.
+        bool collectReadback(DX11State& dx11State, u32 index);
+    };
+
+    struct GpuLetterboxStats {
+        u64 dispatches = 0;
+        u64 readbacks = 0;
+        // Frames whose lines weren't read back, because every readback buffer was still in flight
+        u64 framesUncounted = 0;
+    };
+
+    // Finds the letterbox bars of frames that never reach system memory, where LetterboxDetector can't look.
+    // letterbox_detect_comp.hlsl flags the lit rows and columns, which are read back NUM_INFLIGHT_FRAMES frames later
+    // to avoid stalling - so the area lags the picture by a frame or two. Bars only change at shot cuts, if at all.
+    struct GpuLetterboxDetector {
+        u32 width = 0, height = 0;
+        // Per-row flags, then per-column flags: nonzero if anything in the line is above the black threshold
+        ComPtr<ID3D11Buffer> brightLines;
+        ComPtr<ID3D11UnorderedAccessView> brightLinesUav;
+        std::array<ComPtr<ID3D11Buffer>, NUM_INFLIGHT_FRAMES> brightLinesReadback;
+        std::array<bool, NUM_INFLIGHT_FRAMES> readbackPending = {};
+        u32 readbackIndex = 0;
+        // Active area of the newest frame read back that wasn't all black (fades keep the last one).
+        // Unset until the first one comes back.
+        std::optional<PixelRect> area;
+
+        GpuLetterboxStats stats;
+
+        // Flags the lit lines of lum (width x height) and queues them for reading back.
+        // Expects the colorspace constant buffer to already be bound to b0.
+        void detect(DX11State& dx11State, ID3D11UnorderedAccessView* lum, u32 width, u32 height);
+        // Reads back every finished detection, oldest first, leaving area at the newest
+        void collect(DX11State& dx11State);
+    private:
+        void create(DX11State& dx11State, u32 width, u32 height);
+        // Updates area from one pending readback. False if the GPU hasn't got to it yet.
+        bool collectReadback(DX11State& dx11State, u32 index);
+    };
+
+    // Frames decoded on the CPU get uploaded into these, so the conversion shaders can treat them like D3D11VA surfaces.
+    struct SoftwareFrameUpload {
+        AVPixelFormat format = AV_PIX_FMT_NONE;
+        u32 width = 0, height = 0;
+        // The D3D11VA surface format these textures stand in for (NV12 or P010)
+        DXGI_FORMAT equivalentHwFormat = DXGI_FORMAT_UNKNOWN;
+        ComPtr<ID3D11Texture2D> lum, chrom;
+        BackingFrameUAVs uavs;
+        // Repacking space for formats that don't match the texture layout directly (planar chroma, 10-bit samples in the low bits)
+        std::vector<u8> scratch;
+
+        void upload(DX11State& dx11State, const AVFrame* frame);
+    };
+
+    struct MotionFieldStats {
+        u64 frames = 0;
+        u64 framesWithoutVectors = 0;
+        double recomputeFractionSum = 0.0;
+
+        double meanRecomputeFraction() const {
+            return frames ? recomputeFractionSum / (double)frames : 1.0;
+        }
+    };
+
+    struct FingerprintMatchStats {
+        u64 queries = 0;
+        u64 matches = 0;
+        // 480p frames without a timestamp, which can't be given a frame number and so aren't indexed
+        u64 untimed480 = 0;
+        double totalQueryMs = 0.0;
+        double worstQueryMs = 0.0;
+        // Where the matched 480p frame is relative to the 2160p query, in seconds (480p time - 2160p time).
+        // Steps by the length of whatever was cut or added at each edit, and should hold still in between.
+        u64 timedMatches = 0;
+        double totalMatchOffset = 0.0;
+        double lastMatchOffset = 0.0;
+    };
+
+    struct LabConversionStats {
+        u64 frames = 0;
+        double totalMs = 0.0;
+        // Frames carried over from the one before along the codec's motion vectors, and how much of each had to be
+        // converted anyway
+        u64 propagatedFrames = 0;
+        double propagatedConvertedSum = 0.0;
+    };
+
     struct FfmpegInternalTextureStats {
         u32 content_width, content_height;
         u32 surface_width, surface_height;
         u32 num_surfaces;
     };
 
+    struct AVFrameDeleter {
+        void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+    };
+    using AVFramePtr = std::unique_ptr<AVFrame, AVFrameDeleter>;
+
+    struct AVPacketDeleter {
+        void operator()(AVPacket* packet) const { av_packet_free(&packet); }
+    };
+    using AVPacketPtr = std::unique_ptr<AVPacket, AVPacketDeleter>;
+
+    // What a decode thread hands the render loop
+    struct DecodedFrame {
+        AVFramePtr frame;
+        // System memory copy of frame, if frame is a hardware frame and FFMpegDecodeOptions::cpuReadback is set.
+        // Made on the decode thread by a StagingReadback.
+        AVFramePtr cpuFrame;
+        // Presentation time in seconds from the start of the stream, if the frame has one, and how long it's on screen
+        std::optional<double> time;
+        double duration = 0.0;
+
+        // The frame in system memory, or nullptr if there isn't one
+        const AVFrame* systemMemoryFrame() const {
+            if (frame && frame->format != AV_PIX_FMT_D3D11)
+                return frame.get();
+            return cpuFrame.get();
+        }
+    };
+
+    struct ReadbackStats {
+        u64 frames = 0;
+        // Polls that found the oldest copy still in flight
+        u64 notReadyPolls = 0;
+        // Times the decode thread had to wait for the oldest copy to finish: the ring was full, or the video ended
+        u64 waits = 0;
+        double waitMs = 0.0;
+        // Spent inside CopySubresourceRegion + Flush and inside Map, which is where the decode thread contends with the
+        // render thread for the immediate context's lock
+        double totalCopyMs = 0.0, worstCopyMs = 0.0;
+        double totalMapMs = 0.0, worstMapMs = 0.0;
+    };
+
+    // Reads D3D11VA frames back into system memory on the decode thread without holding up the render thread.
+    // av_hwframe_transfer_data maps its staging texture with a blocking Map(D3D11_MAP_READ), which waits for the GPU to
+    // finish the copy and everything queued before it, all while holding the immediate context's lock - so the render
+    // thread's dispatches and Present wait too. Here every frame gets its own staging texture from a small ring, and
+    // is only mapped once Map(D3D11_MAP_FLAG_DO_NOT_WAIT) says the copy is done, so each call takes the lock briefly.
+    struct StagingReadback {
+        // Copies in flight at once. Each holds on to its decoder surface until it's read back.
+        static constexpr u32 RING_SIZE = 3;
+
+        ReadbackStats stats;
+
+        bool empty() const { return count == 0; }
+        bool full() const { return count == RING_SIZE; }
+        // Queues a copy of decoded's D3D11 frame into the next staging texture. Only call when not full.
+        void start(DecodedFrame decoded);
+        // The oldest frame, with its cpuFrame filled in, if its copy has finished. If wait is set, polls until it has.
+        std::optional<DecodedFrame> finishOldest(bool wait);
+
+    private:
+        struct Slot {
+            // One slice the size and format of the decoder's texture array it was last used for
+            ComPtr<ID3D11Texture2D> staging;
+            D3D11_TEXTURE2D_DESC desc = {};
+            DecodedFrame decoded;
+        };
+        std::array<Slot, RING_SIZE> slots;
+        u32 first = 0, count = 0;
+        ComPtr<ID3D11DeviceContext> deviceContext;
+    };
+
+    struct InputOpenStats {
+        // Stream info came from the probe cache sidecar rather than avformat_find_stream_info
+        bool fromProbeCache = false;
+        // Probed, and the sidecar written for next time
+        bool probeCacheWritten = false;
+        // avformat_open_input (reading the headers), then filling in the stream info either way
+        double openMs = 0.0, streamInfoMs = 0.0;
+    };
+
+    // Milliseconds into wWinMain
+    struct StartupStats {
+        // Each decoder created (while the other one was too) and decoding
+        double ready480Ms = 0.0, ready2160Ms = 0.0;
+        // The first pair of frames converted, then on screen
+        double firstFrameMs = 0.0, firstPresentMs = 0.0;
+    };
+
+    struct SeekStats {
+        // Whether decoding started anywhere but the start of the file
+        bool seeked = false;
+        KeyframeIndexSource indexSource = KeyframeIndexSource::Sidecar;
+        u64 keyframes = 0;
+        // Loading or building the index, then seeking
+        double indexMs = 0.0, seekMs = 0.0;
+        // Seconds from the start of the stream of the keyframe decoding starts from
+        double keyframeTime = 0.0;
+    };
+
+    struct DecodeThreadStats {
+        u64 packetsSent = 0;
+        // Never queued for the decoder, because nothing would show them and nothing references them. Counted by the
+        // demux thread.
+        u64 packetsSkipped = 0;
+        u64 framesReceived = 0;
+        // Decoded (other frames referenced them) but not queued, because nothing would show them
+        u64 framesDropped = 0;
+        // Of framesReceived, the ones still inside the decoder when the file ended (how far it reorders)
+        u64 framesFlushed = 0;
+        // Decoded, but only to get from the keyframe before the start of the range to the start
+        u64 framesBeforeStart = 0;
+        u64 steps = 0;
+        u32 maxPacketsPerStep = 0, maxFramesPerStep = 0;
+    };
+
+    // One round of the decode thread: packets in until the decoder has output waiting, then every frame it has out
+    struct DecodeStep {
+        u32 packetsSent = 0;
+        u32 framesReceived = 0;
+        // The decoder is fully drained after the end of the file, or the queue was closed
+        bool finished = false;
+    };
+
     struct DecodedVideoFrame {
         AVColorSpace colorSpace;
         ComPtr<ID3D11UnorderedAccessView> lum;
@@ -87,15 +382,85 @@ namespace RTR {
         u32 content_width, content_height;
     };
 
+    struct FFMpegDecodeOptions {
+        // Only decode intra frames (skip_frame=AVDISCARD_NONKEY) and skip the loop filter on the frames we do decode.
+        // Alignment and LUT fitting don't need every frame, so analysis passes can get away with a fraction of the decode work.
+        bool keyframesOnly = false;
+        // Decode on the CPU instead of through D3D11VA. Frames are uploaded to the GPU afterwards.
+        bool softwareDecode = false;
+        // Decode in software and track the decoder's motion vectors in FFMpegPerVideoState::motionField, if the codec's
+        // decoder exports them. Cleared by ffmpeg_create_decoder otherwise (HEVC, for one), rather than paying for
+        // software decoding for nothing.
+        bool exportMotionVectors = false;
+        // Keep a system memory copy of every decoded frame for CPU-side analysis (alignment etc.)
+        bool cpuReadback = false;
+        // Read the file through a ReadAheadReader with this much buffered, or through libavformat's own file I/O if 0
+        size_t readAheadBytes = ReadAheadReader::DEFAULT_BUFFER_SIZE;
+        // How many overlapped reads it keeps going at once, 1 to read synchronously
+        u32 readsInFlight = ReadAheadReader::DEFAULT_READS_IN_FLIGHT;
+        // If set, it does the reading, taking turns with other files it reads. Otherwise the reader has its own thread.
+        ReadScheduler* readScheduler = nullptr;
+        // Take the stream info from the file's probe cache sidecar if it's up to date, rather than probing every time
+        bool useProbeCache = true;
+    };
+
     struct FFMpegPerVideoState {
+        FFMpegDecodeOptions options;
+        // UTF-8, for finding the file's sidecars
+        std::string path;
+
+        // Where input_ctx reads from, unless it does its own I/O
+        std::unique_ptr<ReadAheadReader> reader;
         AVFormatContext* input_ctx = nullptr;
         const AVCodec* decoder = nullptr;
         AVCodecContext* decoder_ctx = nullptr;
         int video_stream_index = 0;
         AVStream* video_stream = nullptr;
         AVBufferRef* hw_device_ctx = nullptr;
+        // Only touched by the demux thread once it's running
         AVPacket* packet = nullptr;
-        AVFrame* frame = nullptr;
+        // Decode thread state: a packet the decoder wasn't ready for yet, whether the demux thread has run out of
+        // packets, and whether the decoder has been told so
+        AVPacketPtr heldPacket;
+        bool inputEnded = false, flushSent = false;
+        // What skip_frame was before decodeStep started adjusting it per packet
+        AVDiscard baseSkipFrame = AVDISCARD_DEFAULT;
+        // The frame readFrame took off the queue most recently
+        DecodedFrame latest;
+        // Set by readFrame if it actually got a new frame from the decode thread
+        bool hasNewFrame = false;
+        u64 decodedFrames = 0;
+        InputOpenStats openStats;
+
+        // Demuxing runs ahead on its own thread, filling packetQueue with packets of the video stream only
+        std::unique_ptr<BoundedQueue<AVPacketPtr>> packetQueue;
+        std::thread demuxThread;
+        // Whatever stopped the demux thread early, rethrown on the decode thread once the queue runs dry
+        std::exception_ptr demuxError;
+        // Decoding runs ahead on another, filling decodeQueue
+        std::unique_ptr<BoundedQueue<DecodedFrame>> decodeQueue;
+        std::thread decodeThread;
+        // Whatever stopped the decode thread early, rethrown by readFrame once the queue runs dry
+        std::exception_ptr decodeError;
+        // Frames the decode thread is reading back before queueing them, if options.cpuReadback is set
+        StagingReadback readback;
+        // If set, frames it rejects (by time and duration, as in DecodedFrame) are dropped as early as possible: before
+        // decoding if nothing references them, before reading back and queueing otherwise. Set before startDecoding.
+        std::function<bool(double time, double duration)> wanted;
+        // Only read by the render loop once the demux and decode threads have stopped
+        DecodeThreadStats decodeStats;
+        // Only frames on screen at some point in [rangeStart, rangeEnd), in seconds from the start of the stream, are
+        // queued. Demuxing stops at rangeEnd, and starts at the keyframe before rangeStart. Set by seekTo.
+        double rangeStart = -std::numeric_limits<double>::infinity();
+        double rangeEnd = std::numeric_limits<double>::infinity();
+        SeekStats seekStats;
+
+        // Taken off the queue by readFrameAt but not on screen yet
+        std::optional<DecodedFrame> pending;
+        // Frames readFrameAt skipped over on the way to the latest one, if keepPassedOver is set (for anything that
+        // needs every frame, like inverse telecine). Only their system memory copies are kept.
+        bool keepPassedOver = false;
+        std::vector<DecodedFrame> passedOver;
 
         FfmpegInternalTextureStats stats;
 
@@ -109,13 +474,92 @@ namespace RTR {
 
         ComPtr<ID3D11Buffer> texDimConstantBuffer;
 
+        DirtyTileTracker dirtyTiles;
+        ID3D11ComputeShader* lastConversionShader = nullptr;
+
+        // Frames that are in system memory anyway get checked for letterboxing on the CPU, the rest on the GPU
+        LetterboxDetector letterbox;
+        GpuLetterboxDetector gpuLetterbox;
+        // What the latest conversion covered. Everything outside it is black in latestFrameAsRgb.
+        PixelRect convertedArea;
+
+        SoftwareFrameUpload softwareUpload;
+
+        // Which parts of the latest frame actually changed according to the codec, so per-frame analysis
+        // only has to redo work for intra-coded or badly predicted blocks.
+        MotionField motionField;
+        MotionFieldStats motionStats;
+
         ComPtr<ID3D11Texture2D> latestBackingFrame = nullptr;
         std::vector<BackingFrameUAVs> backingFrameUavs;
         void updateBackingFrame(DX11State& dx11State, ID3D11Texture2D* newBackingFrame);
 
+        // Limits decoding to frames on screen between start and end (in seconds from the start of the stream), seeking to
+        // the keyframe before start by way of the file's keyframe index. Call before startDecoding.
+        void seekTo(double start, double end);
+        // Call once the state is where it's going to stay - the thread keeps a pointer to it
+        void startDecoding();
+        void stopDecoding();
+        // Body of demuxThread. Returns at the end of the file, or once the queue is closed.
+        void demuxLoop();
+        // Body of decodeThread. Returns at the end of the video, or once the queue is closed.
+        void decodeLoop();
+        DecodeStep decodeStep();
+        // Queues frames whose readback has finished, oldest first. If wait is set, waits for all of them.
+        // False once the queue is closed.
+        bool queueReadBack(bool wait);
+        // Next packet from the demux thread into heldPacket. False at the end of the file.
+        bool takePacket();
+        // Whether nothing would show the frame in packet, going by wanted
+        bool isUnwanted(const AVPacket* packet) const;
+        // Takes the next decoded frame off the queue (waiting for it if need be) and converts it
         void readFrame(DX11State& dx11State);
+        // Takes frames off the queue up to the last one on screen at target (in seconds from the start of the stream),
+        // and converts that one. Keeps the previous frame if the next one isn't on screen yet.
+        void readFrameAt(DX11State& dx11State, double target, FrameSyncStats& syncStats);
+        // Next frame from pending or the queue, rethrowing whatever stopped the decode thread once it runs dry
+        std::optional<DecodedFrame> nextFrame();
+        void convertLatest(DX11State& dx11State);
+        std::optional<double> secondsFromStart(i64 timestamp) const;
+        // The other way around, in the stream's time_base
+        i64 timestampAt(double seconds) const;
+        // Of a frame or packet, falling back to the stream's average frame rate if it doesn't say
+        double durationInSeconds(i64 duration) const;
+        // Number of the frame presented at seconds from the start of the stream, at the average frame rate.
+        // Unlike counting decoded frames, it doesn't drift when frames are dropped, skipped or merged along the way.
+        u64 frameNumberAt(double seconds) const;
+        double timeOfFrame(u64 frameNumber) const;
+        // The latest frame in system memory, or nullptr if there isn't one (yet)
+        const AVFrame* latestCpuFrame() const;
+
+        // Same as ParsedFormat::may_be_interlaced in the DX12 version: unless the container promises progressive, assume it isn't.
+        bool mayBeInterlaced() const {
+            switch (video_stream->codecpar->field_order) {
+            case AV_FIELD_PROGRESSIVE:
+                return false;
+            case AV_FIELD_UNKNOWN:
+            default:
+                return true;
+            }
+        }
+        bool topFieldFirst() const {
+            // TT and BT are both displayed top field first, they only differ in coding order
+            switch (video_stream->codecpar->field_order) {
+            case AV_FIELD_BB:
+            case AV_FIELD_TB:
+                return false;
+            default:
+                return true;
+            }
+        }
 
         void flushAndClose() {
+            stopDecoding();
+            heldPacket.reset();
+            latest = DecodedFrame{};
+            pending.reset();
+            passedOver.clear();
+
             // If the decoder is still around, flush it
             if (decoder_ctx) {
                 packet->data = NULL;
@@ -140,9 +584,51 @@ namespace RTR {
                 avformat_free_context(input_ctx);
                 input_ctx = nullptr;
             }
+            reader.reset();
         }
     };
 
+    // Everything done on the CPU with frames read back from both videos
+    struct CpuFrameAnalysis {
+        bool trackAlignment = false;
+        bool matchFingerprints = false;
+        bool convertToLab2160 = false;
+        // DVD sources are usually telecined, which would throw off everything downstream
+        bool inverseTelecine480 = false;
+
+        InverseTelecine ivtc480;
+        // Latest analysis images. The 480p one is progressive, after inverse telecine if enabled.
+        GrayImage image480;
+        // Presentation time of the 480p frame that completed image480 (the last field, after inverse telecine)
+        std::optional<double> time480;
+        // Every 2160p consumer takes its resolution from here, rather than each downscaling the full frame
+        std::shared_ptr<const ImagePyramid> pyramid2160;
+
+        AlignmentTracker alignment;
+        // Phase correlation peaks and ORB matches from the latest estimation, and how often each had to fall back to
+        // the next estimator
+        PhaseCorrelationStats phaseCorrelationStats;
+        FeatureAlignmentStats featureStats;
+        u64 phaseCorrelationFallbacks = 0;
+        u64 featureFallbacks = 0;
+        // Every 480p frame decoded so far, by frame number from its timestamp, looked up by each new 2160p frame
+        FingerprintIndex fingerprints480;
+        FingerprintMatchStats fingerprintStats;
+        // The latest 2160p frame in Lab at (roughly) the 480p frame's pixel pitch, straight from the decoded planes.
+        // Covers lab2160Area of the frame, which leaves out any letterbox bars. If the 2160p stream has motion vectors,
+        // each frame only converts what changed since the one before (lab2160Frame, by frame number).
+        LabImage lab2160;
+        PixelRect lab2160Area;
+        std::optional<u64> lab2160Frame;
+        LabConversionStats labStats;
+
+        bool enabled() const { return trackAlignment || matchFingerprints || convertToLab2160; }
+        // Non-const because shot cuts reset the videos' letterbox detection
+        void update(FFMpegPerVideoState& video480, FFMpegPerVideoState& video2160);
+        std::optional<SimilarityTransform> estimateAlignment(const GrayImage& image480, const GrayImage& image2160);
+        void logStats() const;
+    };
+
     struct FFMpegState {
         AVHWDeviceType deviceType;
         AVPixelFormat dx11PixelFormat;
@@ -0,0 +1,167 @@
+#include "keyframeindex.h"
+#include "sidecar.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace RTR;
+
+namespace {
+    constexpr SidecarFormat KEYFRAME_INDEX_FORMAT = {
+        .magic = { 'R', 'T', 'R', 'K', 'E', 'Y', 'F', 'R' },
+        .version = KEYFRAME_INDEX_VERSION,
+        .extension = ".keyframes",
+    };
+    static_assert(std::is_trivially_copyable_v<Keyframe>);
+    // Cues that stop further than this short of the end of the stream are taken to be partial, e.g. just the clusters
+    // probing happened to read
+    constexpr double MAX_UNINDEXED_TAIL_SECONDS = 30.0;
+
+    struct IndexRecord {
+        i32 streamIndex;
+        KeyframeIndexSource source;
+        u64 count;
+    };
+
+    bool is_matroska(const AVFormatContext* ctx) {
+        return std::strstr(ctx->iformat->name, "matroska") != nullptr;
+    }
+
+    i64 stream_start(const AVStream* stream) {
+        return stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    }
+
+    bool load(const std::string& mediaPath, int streamIndex, KeyframeIndex& index) {
+        std::ifstream in;
+        IndexRecord record;
+        if (!open_sidecar(in, mediaPath, KEYFRAME_INDEX_FORMAT) || !read_pod(in, record) || record.streamIndex != streamIndex)
+            return false;
+        // Don't trust the count as far as allocating it up front
+        index.keyframes.clear();
+        Keyframe keyframe;
+        for (u64 i = 0; i < record.count; i++) {
+            if (!read_pod(in, keyframe))
+                return false;
+            index.keyframes.push_back(keyframe);
+        }
+        index.source = KeyframeIndexSource::Sidecar;
+        return true;
+    }
+
+    bool save(const std::string& mediaPath, int streamIndex, const KeyframeIndex& index) {
+        return write_sidecar(mediaPath, KEYFRAME_INDEX_FORMAT, [&](std::ostream& out) {
+            write_pod(out, IndexRecord{
+                .streamIndex = streamIndex,
+                .source = index.source,
+                .count = index.keyframes.size(),
+            });
+            out.write(reinterpret_cast<const char*>(index.keyframes.data()), index.keyframes.size() * sizeof(Keyframe));
+        });
+    }
+
+    // Matroska's index holds the keyframes' presentation times and the clusters they're in, which is exactly what
+    // seeking it again takes. It's filled from the Cues, and added to as clusters are read.
+    std::vector<Keyframe> matroska_index_of(AVStream* stream) {
+        std::vector<Keyframe> keyframes;
+        const int count = avformat_index_get_entries_count(stream);
+        for (int i = 0; i < count; i++) {
+            const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+            if (entry->flags & AVINDEX_KEYFRAME) {
+                keyframes.push_back(Keyframe{ .pts = entry->timestamp, .dts = entry->timestamp, .pos = entry->pos });
+            }
+        }
+        return keyframes;
+    }
+
+    bool covers_stream(const AVFormatContext* ctx, const AVStream* stream, const std::vector<Keyframe>& keyframes) {
+        if (keyframes.empty())
+            return false;
+        double duration = stream->duration != AV_NOPTS_VALUE ? stream->duration * av_q2d(stream->time_base) : 0.0;
+        if (duration <= 0 && ctx->duration != AV_NOPTS_VALUE) {
+            duration = ctx->duration / (double)AV_TIME_BASE;
+        }
+        return (keyframes.back().pts - stream_start(stream)) * av_q2d(stream->time_base) >= duration - MAX_UNINDEXED_TAIL_SECONDS;
+    }
+
+    // Reads every packet from the start of the file, keeping the keyframes of the stream
+    std::vector<Keyframe> scan(AVFormatContext* ctx, int streamIndex) {
+        const AVStream* stream = ctx->streams[streamIndex];
+        const i64 start = stream_start(stream);
+        int ret = avformat_seek_file(ctx, streamIndex, INT64_MIN, start, start, 0);
+        if (ret < 0)
+            throw std::runtime_error("Couldn't seek to the start of the file to index it (error " + std::to_string(ret) + ")");
+        std::vector<Keyframe> keyframes;
+        AVPacket* packet = av_packet_alloc();
+        while ((ret = av_read_frame(ctx, packet)) >= 0) {
+            if (packet->stream_index == streamIndex && (packet->flags & AV_PKT_FLAG_KEY) && packet->pts != AV_NOPTS_VALUE) {
+                keyframes.push_back(Keyframe{
+                    .pts = packet->pts,
+                    .dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts,
+                    .pos = -1,
+                });
+            }
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+        if (ret != AVERROR_EOF)
+            throw std::runtime_error("Couldn't read through the file to index it (error " + std::to_string(ret) + ")");
+        std::sort(keyframes.begin(), keyframes.end(), [](const Keyframe& a, const Keyframe& b) { return a.pts < b.pts; });
+        return keyframes;
+    }
+
+    KeyframeIndex build(AVFormatContext* ctx, int streamIndex) {
+        AVStream* stream = ctx->streams[streamIndex];
+        if (!is_matroska(ctx)) {
+            // Others index by decode time (MP4), or only index what they've read so far. Their positions aren't
+            // needed, MP4 has every sample's in its header.
+            return KeyframeIndex{ .keyframes = scan(ctx, streamIndex), .source = KeyframeIndexSource::Scan };
+        }
+
+        // Cues at the end of the file are only read on the first seek
+        const i64 start = stream_start(stream);
+        if (avformat_seek_file(ctx, streamIndex, INT64_MIN, start, start, 0) >= 0) {
+            auto keyframes = matroska_index_of(stream);
+            if (covers_stream(ctx, stream, keyframes))
+                return KeyframeIndex{ .keyframes = std::move(keyframes), .source = KeyframeIndexSource::Container };
+        }
+        // No Cues, but reading through indexes every cluster with a keyframe in it
+        scan(ctx, streamIndex);
+        return KeyframeIndex{ .keyframes = matroska_index_of(stream), .source = KeyframeIndexSource::Scan };
+    }
+}
+
+const Keyframe* KeyframeIndex::lastAtOrBefore(i64 pts) const {
+    auto after = std::upper_bound(keyframes.begin(), keyframes.end(), pts, [](i64 pts, const Keyframe& keyframe) { return pts < keyframe.pts; });
+    return after == keyframes.begin() ? nullptr : &*(after - 1);
+}
+
+const char* RTR::keyframe_index_source_name(KeyframeIndexSource source) {
+    switch (source) {
+    case KeyframeIndexSource::Sidecar:
+        return "sidecar";
+    case KeyframeIndexSource::Container:
+        return "container";
+    case KeyframeIndexSource::Scan:
+        return "scan";
+    default:
+        return "?";
+    }
+}
+
+KeyframeIndex RTR::load_or_build_keyframe_index(AVFormatContext* ctx, int streamIndex, const std::string& mediaPath) {
+    KeyframeIndex index;
+    if (!load(mediaPath, streamIndex, index)) {
+        index = build(ctx, streamIndex);
+        save(mediaPath, streamIndex, index);
+    }
+    AVStream* stream = ctx->streams[streamIndex];
+    for (const Keyframe& keyframe : index.keyframes) {
+        if (keyframe.pos >= 0) {
+            av_add_index_entry(stream, keyframe.pos, keyframe.pts, 0, 0, AVINDEX_KEYFRAME);
+        }
+    }
+    return index;
+}
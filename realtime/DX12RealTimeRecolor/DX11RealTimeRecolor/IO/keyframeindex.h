@@ -0,0 +1,53 @@
+#pragma once
+
+// Where a video stream's keyframes are, so decoding can start anywhere in the file: from the last keyframe before
+// where playback should start, throwing away the frames in between. Without one, libavformat either has to read its
+// way up to the target (Matroska without Cues) or has nothing to go on at all.
+// The index comes from the container if it carries a complete one (Matroska's Cues), from reading through the whole
+// stream once otherwise. Either way it's kept in a sidecar next to the file (<file>.keyframes) for next time.
+
+#include "../Utils/types.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace RTR {
+    // Bump whenever what's stored changes
+    constexpr u32 KEYFRAME_INDEX_VERSION = 1;
+
+    // In the stream's time_base
+    struct Keyframe {
+        i64 pts;
+        // The same as pts if the container only says that (Matroska)
+        i64 dts;
+        // Where the demuxer finds the keyframe if its own index doesn't say, or -1 if it doesn't need telling
+        i64 pos;
+    };
+
+    enum class KeyframeIndexSource : u32 {
+        Sidecar,
+        Container,
+        Scan,
+    };
+
+    struct KeyframeIndex {
+        // In presentation order
+        std::vector<Keyframe> keyframes;
+        KeyframeIndexSource source = KeyframeIndexSource::Sidecar;
+
+        // The last keyframe presented at or before pts, nullptr if there's none
+        const Keyframe* lastAtOrBefore(i64 pts) const;
+    };
+
+    const char* keyframe_index_source_name(KeyframeIndexSource source);
+
+    // Loads the index of ctx's stream streamIndex from mediaPath's sidecar, or builds it and writes the sidecar. Building
+    // it can read through the whole file, so other streams should be discarded first, and ctx needs seeking afterwards.
+    // The keyframes are handed to the demuxer's own index as well, if it needs them to seek straight there.
+    // Throws if reading through the file fails.
+    KeyframeIndex load_or_build_keyframe_index(AVFormatContext* ctx, int streamIndex, const std::string& mediaPath);
+}
@@ -0,0 +1,166 @@
+#include "probecache.h"
+#include "sidecar.h"
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <vector>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+using namespace RTR;
+
+namespace {
+    constexpr SidecarFormat PROBE_CACHE_FORMAT = {
+        .magic = { 'R', 'T', 'R', 'P', 'R', 'O', 'B', 'E' },
+        .version = PROBE_CACHE_VERSION,
+        .extension = ".probe",
+    };
+    // Nobody's extradata is anywhere near this, anything bigger means the sidecar is garbage
+    constexpr u32 MAX_EXTRADATA_SIZE = 1 << 20;
+
+    struct FormatRecord {
+        i64 start_time, duration, bit_rate;
+        u32 nb_streams;
+    };
+
+    // Everything avformat_find_stream_info fills in or corrects that anything downstream looks at
+    struct StreamRecord {
+        i32 codec_type, codec_id;
+        u32 codec_tag;
+        i32 format;
+        i64 bit_rate;
+        i32 bits_per_coded_sample, bits_per_raw_sample;
+        i32 profile, level;
+        i32 width, height;
+        AVRational sample_aspect_ratio;
+        i32 field_order, color_range, color_primaries, color_trc, color_space, chroma_location;
+        i32 video_delay;
+        i32 sample_rate;
+        AVRational avg_frame_rate, r_frame_rate;
+        i64 start_time, duration, nb_frames;
+        u32 extradata_size;
+    };
+    static_assert(std::is_trivially_copyable_v<StreamRecord>);
+
+    StreamRecord record_of(const AVStream* stream) {
+        const AVCodecParameters* par = stream->codecpar;
+        return StreamRecord{
+            .codec_type = par->codec_type,
+            .codec_id = par->codec_id,
+            .codec_tag = par->codec_tag,
+            .format = par->format,
+            .bit_rate = par->bit_rate,
+            .bits_per_coded_sample = par->bits_per_coded_sample,
+            .bits_per_raw_sample = par->bits_per_raw_sample,
+            .profile = par->profile,
+            .level = par->level,
+            .width = par->width,
+            .height = par->height,
+            .sample_aspect_ratio = par->sample_aspect_ratio,
+            .field_order = par->field_order,
+            .color_range = par->color_range,
+            .color_primaries = par->color_primaries,
+            .color_trc = par->color_trc,
+            .color_space = par->color_space,
+            .chroma_location = par->chroma_location,
+            .video_delay = par->video_delay,
+            .sample_rate = par->sample_rate,
+            .avg_frame_rate = stream->avg_frame_rate,
+            .r_frame_rate = stream->r_frame_rate,
+            .start_time = stream->start_time,
+            .duration = stream->duration,
+            .nb_frames = stream->nb_frames,
+            .extradata_size = par->extradata ? (u32)par->extradata_size : 0,
+        };
+    }
+
+    void apply(AVStream* stream, const StreamRecord& record, const std::vector<u8>& extradata) {
+        AVCodecParameters* par = stream->codecpar;
+        par->codec_tag = record.codec_tag;
+        par->format = record.format;
+        par->bit_rate = record.bit_rate;
+        par->bits_per_coded_sample = record.bits_per_coded_sample;
+        par->bits_per_raw_sample = record.bits_per_raw_sample;
+        par->profile = record.profile;
+        par->level = record.level;
+        par->width = record.width;
+        par->height = record.height;
+        par->sample_aspect_ratio = record.sample_aspect_ratio;
+        par->field_order = (AVFieldOrder)record.field_order;
+        par->color_range = (AVColorRange)record.color_range;
+        par->color_primaries = (AVColorPrimaries)record.color_primaries;
+        par->color_trc = (AVColorTransferCharacteristic)record.color_trc;
+        par->color_space = (AVColorSpace)record.color_space;
+        par->chroma_location = (AVChromaLocation)record.chroma_location;
+        par->video_delay = record.video_delay;
+        par->sample_rate = record.sample_rate;
+        stream->avg_frame_rate = record.avg_frame_rate;
+        stream->r_frame_rate = record.r_frame_rate;
+        stream->start_time = record.start_time;
+        stream->duration = record.duration;
+        stream->nb_frames = record.nb_frames;
+
+        // Probing can pull extradata out of the bitstream when the container doesn't carry it
+        const bool sameExtradata = par->extradata && (size_t)par->extradata_size == extradata.size()
+            && std::memcmp(par->extradata, extradata.data(), extradata.size()) == 0;
+        if (!extradata.empty() && !sameExtradata) {
+            u8* copy = (u8*)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!copy)
+                return;
+            std::memcpy(copy, extradata.data(), extradata.size());
+            av_freep(&par->extradata);
+            par->extradata = copy;
+            par->extradata_size = (int)extradata.size();
+        }
+    }
+}
+
+bool RTR::load_probe_cache(AVFormatContext* ctx, const std::string& mediaPath) {
+    // Has to agree with what avformat_open_input found, as well as being for this copy of the file
+    std::ifstream in;
+    FormatRecord format;
+    if (!open_sidecar(in, mediaPath, PROBE_CACHE_FORMAT) || !read_pod(in, format) || format.nb_streams != ctx->nb_streams)
+        return false;
+
+    // Read it all before touching ctx, so a truncated or mismatched sidecar leaves it alone
+    std::vector<StreamRecord> records(format.nb_streams);
+    std::vector<std::vector<u8>> extradata(format.nb_streams);
+    for (u32 i = 0; i < format.nb_streams; i++) {
+        const AVCodecParameters* par = ctx->streams[i]->codecpar;
+        if (!read_pod(in, records[i]) || records[i].codec_type != par->codec_type || records[i].codec_id != par->codec_id
+            || records[i].extradata_size > MAX_EXTRADATA_SIZE)
+            return false;
+        extradata[i].resize(records[i].extradata_size);
+        if (!in.read(reinterpret_cast<char*>(extradata[i].data()), extradata[i].size()))
+            return false;
+    }
+
+    ctx->start_time = format.start_time;
+    ctx->duration = format.duration;
+    ctx->bit_rate = format.bit_rate;
+    for (u32 i = 0; i < format.nb_streams; i++) {
+        apply(ctx->streams[i], records[i], extradata[i]);
+    }
+    return true;
+}
+
+bool RTR::save_probe_cache(const AVFormatContext* ctx, const std::string& mediaPath) {
+    return write_sidecar(mediaPath, PROBE_CACHE_FORMAT, [ctx](std::ostream& out) {
+        write_pod(out, FormatRecord{
+            .start_time = ctx->start_time,
+            .duration = ctx->duration,
+            .bit_rate = ctx->bit_rate,
+            .nb_streams = ctx->nb_streams,
+        });
+        for (unsigned int i = 0; i < ctx->nb_streams; i++) {
+            const StreamRecord record = record_of(ctx->streams[i]);
+            write_pod(out, record);
+            if (record.extradata_size) {
+                out.write(reinterpret_cast<const char*>(ctx->streams[i]->codecpar->extradata), record.extradata_size);
+            }
+        }
+    });
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Remembering what avformat_find_stream_info worked out about a file, in a sidecar next to it (<file>.probe), so later
+// runs can skip it. Finding stream info reads and decodes the start of every stream in the file, which for a UHD remux
+// with a dozen audio and subtitle tracks takes seconds, all before the first frame.
+// Besides being for the same copy of the file, the sidecar is checked against the streams avformat_open_input found, so
+// a stale one just gets probed over.
+
+#include "../Utils/types.h"
+
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace RTR {
+    // Bump whenever what's stored changes
+    constexpr u32 PROBE_CACHE_VERSION = 1;
+
+    // Fills in the stream info of ctx, just opened from mediaPath, from the sidecar: codec parameters (extradata
+    // included), frame rates, start times and durations. False if there's no sidecar or it doesn't match the file,
+    // in which case ctx is left as it was and still needs avformat_find_stream_info.
+    bool load_probe_cache(AVFormatContext* ctx, const std::string& mediaPath);
+    // Writes the stream info of ctx, opened from mediaPath and through avformat_find_stream_info, to the sidecar.
+    // False if it couldn't be written, which only means the next run probes again.
+    bool save_probe_cache(const AVFormatContext* ctx, const std::string& mediaPath);
+}
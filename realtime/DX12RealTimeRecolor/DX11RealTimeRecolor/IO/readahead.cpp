@@ -0,0 +1,336 @@
+#include "readahead.h"
+#include "readscheduler.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+using namespace RTR;
+
+namespace {
+    std::wstring widen(const std::string& utf8) {
+        const int length = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, nullptr, 0);
+        std::wstring wide(length > 0 ? length - 1 : 0, L'\0');
+        if (length > 1) {
+            MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, wide.data(), length);
+        }
+        return wide;
+    }
+
+    int read_callback(void* opaque, u8* buf, int size) {
+        return static_cast<ReadAheadReader*>(opaque)->read(buf, size);
+    }
+
+    i64 seek_callback(void* opaque, i64 offset, int whence) {
+        return static_cast<ReadAheadReader*>(opaque)->seek(offset, whence);
+    }
+}
+
+ReadAheadReader::ReadAheadReader(const std::string& path, size_t bufferSize, u32 readsInFlight, ReadScheduler* scheduler)
+    : readsInFlight(std::max(readsInFlight, 1u)), scheduler(scheduler),
+    ring((std::max(bufferSize, CHUNK_SIZE) + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE) {
+    // Sequential scan has the cache manager read ahead further and drop pages behind us, the Windows take on
+    // madvise(MADV_SEQUENTIAL)
+    const std::wstring widePath = widen(path);
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    if (this->readsInFlight > 1) {
+        handle = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, nullptr);
+        overlapped = handle != INVALID_HANDLE_VALUE;
+    }
+    if (!overlapped) {
+        handle = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Couldn't open " + path + " (error " + std::to_string(GetLastError()) + ")");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size)) {
+        const DWORD sizeError = GetLastError();
+        CloseHandle(handle);
+        throw std::runtime_error("Couldn't get the size of " + path + " (error " + std::to_string(sizeError) + ")");
+    }
+    file = handle;
+    fileSize = size.QuadPart;
+    stats.overlapped = overlapped;
+
+    u8* ioBuffer = (u8*)av_malloc(IO_BUFFER_SIZE);
+    avio = ioBuffer ? avio_alloc_context(ioBuffer, IO_BUFFER_SIZE, 0, this, read_callback, nullptr, seek_callback) : nullptr;
+    if (!avio) {
+        av_free(ioBuffer);
+        CloseHandle(handle);
+        throw std::bad_alloc();
+    }
+    if (overlapped) {
+        // Each read in flight gets its own event, so reads on the one handle can be told apart
+        for (u32 i = 0; i < this->readsInFlight; i++) {
+            events.push_back(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+        }
+    }
+
+    if (scheduler) {
+        scheduler->add(this);
+    }
+    else {
+        fillThread = std::thread([this] { fillLoop(); });
+    }
+}
+
+ReadAheadReader::~ReadAheadReader() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    spaceFree.notify_all();
+    dataReady.notify_all();
+    if (scheduler) {
+        // Waits out a run on this reader, if there is one
+        scheduler->remove(this);
+    }
+    else {
+        fillThread.join();
+    }
+    for (void* event : events) {
+        CloseHandle((HANDLE)event);
+    }
+    // The buffer may have been reallocated by libavformat since
+    av_freep(&avio->buffer);
+    avio_context_free(&avio);
+    CloseHandle((HANDLE)file);
+}
+
+ReadAheadStats ReadAheadReader::getStats() const {
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void ReadAheadReader::setByteRate(double bytesPerSecond) {
+    std::lock_guard lock(mutex);
+    if (bytesPerSecond > 0) {
+        byteRate = bytesPerSecond;
+    }
+}
+
+bool ReadAheadReader::hasSpace() const {
+    return !stopping && !atEnd && !error && filled < fileSize && filled - position + (i64)CHUNK_SIZE <= (i64)ring.size();
+}
+
+void ReadAheadReader::spaceChanged() {
+    if (scheduler) {
+        scheduler->poke();
+    }
+    else {
+        spaceFree.notify_one();
+    }
+}
+
+std::optional<double> ReadAheadReader::bufferedSeconds(i64 runBytes) const {
+    std::lock_guard lock(mutex);
+    if (!hasSpace() || (i64)ring.size() - (filled - position) < std::min(runBytes, fileSize - filled))
+        return std::nullopt;
+    return (double)(filled - position) / byteRate;
+}
+
+i64 ReadAheadReader::runBytesFor(double seconds) const {
+    std::lock_guard lock(mutex);
+    return std::clamp((i64)(seconds * byteRate), (i64)CHUNK_SIZE, (i64)ring.size() / 2);
+}
+
+void ReadAheadReader::fillLoop() {
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            spaceFree.wait(lock, [&] { return stopping || hasSpace(); });
+            if (stopping)
+                return;
+        }
+        fillRun(std::numeric_limits<i64>::max());
+    }
+}
+
+i64 ReadAheadReader::fillRun(i64 maxBytes) {
+    struct PendingRead {
+        OVERLAPPED at;
+        i64 offset;
+        DWORD length;
+        // Filled in straight away for synchronous reads, or if an overlapped read failed rather than going pending
+        bool done;
+        DWORD got, readError;
+        double ms;
+    };
+    const i64 ringSize = (i64)ring.size();
+    const u32 maxInFlight = overlapped ? readsInFlight : 1;
+    // Reads complete in the order they were issued as far as we're concerned: the oldest is always the one waited on,
+    // so the ring fills front to back
+    std::vector<PendingRead> slots(maxInFlight);
+    for (u32 i = 0; i < maxInFlight; i++) {
+        slots[i].at.hEvent = overlapped ? (HANDLE)events[i] : nullptr;
+    }
+    u32 first = 0, inFlight = 0;
+
+    const auto waitFor = [&](PendingRead& read) {
+        if (read.done)
+            return;
+        auto start = std::chrono::high_resolution_clock::now();
+        read.readError = GetOverlappedResult((HANDLE)file, &read.at, &read.got, TRUE) ? (DWORD)ERROR_SUCCESS : GetLastError();
+        read.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        read.done = true;
+    };
+
+    i64 issued, requested = 0, runBytes = 0;
+    u64 runGeneration;
+    {
+        std::lock_guard lock(mutex);
+        issued = filled;
+        runGeneration = generation;
+        stats.runs++;
+    }
+    while (true) {
+        u32 newReads = 0;
+        {
+            std::lock_guard lock(mutex);
+            if (stopping || generation != runGeneration)
+                break;
+            // The demuxer only touches [position, filled), so reads can go anywhere in the rest of the ring
+            while (inFlight < maxInFlight && requested < maxBytes && !atEnd && !error && issued < fileSize && issued - position + (i64)CHUNK_SIZE <= ringSize) {
+                auto& read = slots[(first + inFlight) % maxInFlight];
+                read.offset = issued;
+                // Reads never wrap around the end of the ring
+                read.length = (DWORD)std::min({ (i64)CHUNK_SIZE, ringSize - issued % ringSize, fileSize - issued });
+                issued += read.length;
+                requested += read.length;
+                inFlight++;
+                newReads++;
+            }
+            stats.maxReadsInFlight = std::max(stats.maxReadsInFlight, inFlight);
+        }
+        if (inFlight == 0)
+            break;
+
+        for (u32 i = inFlight - newReads; i < inFlight; i++) {
+            auto& read = slots[(first + i) % maxInFlight];
+            read.at.Internal = read.at.InternalHigh = 0;
+            read.at.Offset = (DWORD)read.offset;
+            read.at.OffsetHigh = (DWORD)(read.offset >> 32);
+            read.done = false;
+            read.got = 0;
+            read.readError = ERROR_SUCCESS;
+            read.ms = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            const BOOL ok = ReadFile((HANDLE)file, ring.data() + read.offset % ringSize, read.length, overlapped ? nullptr : &read.got, &read.at);
+            if (!overlapped || (!ok && GetLastError() != ERROR_IO_PENDING)) {
+                read.readError = ok ? ERROR_SUCCESS : GetLastError();
+                read.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                read.done = true;
+            }
+        }
+
+        auto& oldest = slots[first];
+        waitFor(oldest);
+        first = (first + 1) % maxInFlight;
+        inFlight--;
+
+        std::lock_guard lock(mutex);
+        stats.reads++;
+        stats.readMs += oldest.ms;
+        // After a seek, the end or an error, anything else is moot
+        if (generation != runGeneration || atEnd || error)
+            continue;
+        if (oldest.readError == ERROR_SUCCESS || oldest.readError == ERROR_HANDLE_EOF) {
+            filled += oldest.got;
+            runBytes += oldest.got;
+            stats.bytesRead += oldest.got;
+            // Short only if the file shrank since it was opened
+            atEnd = filled >= fileSize || oldest.got < oldest.length;
+        }
+        else {
+            error = oldest.readError;
+        }
+        dataReady.notify_all();
+    }
+
+    // Reads can't be abandoned while the kernel might still write into the ring
+    for (u32 i = 0; i < inFlight; i++) {
+        auto& read = slots[(first + i) % maxInFlight];
+        if (!read.done) {
+            CancelIoEx((HANDLE)file, &read.at);
+            waitFor(read);
+        }
+    }
+    return runBytes;
+}
+
+int ReadAheadReader::read(u8* buf, int size) {
+    std::unique_lock lock(mutex);
+    if (position == filled && !atEnd && !error) {
+        auto start = std::chrono::high_resolution_clock::now();
+        dataReady.wait(lock, [&] { return position < filled || atEnd || error || stopping; });
+        stats.stalls++;
+        stats.stallMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    if (position == filled)
+        return error ? AVERROR(EIO) : AVERROR_EOF;
+
+    // Up to the end of the ring at most, libavformat comes back for the rest
+    const size_t offset = (size_t)(position % (i64)ring.size());
+    const size_t n = std::min({ (size_t)size, (size_t)(filled - position), ring.size() - offset });
+    // Reads only ever land outside [position, filled), so the copy doesn't need the lock
+    lock.unlock();
+    std::memcpy(buf, ring.data() + offset, n);
+    lock.lock();
+    position += (i64)n;
+    stats.bytesDelivered += n;
+    lock.unlock();
+    spaceChanged();
+    return (int)n;
+}
+
+i64 ReadAheadReader::seek(i64 offset, int whence) {
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE)
+        return fileSize;
+
+    i64 target;
+    {
+        std::lock_guard lock(mutex);
+        switch (whence) {
+        case SEEK_SET:
+            target = offset;
+            break;
+        case SEEK_CUR:
+            target = position + offset;
+            break;
+        case SEEK_END:
+            target = fileSize + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+        }
+        if (target < 0)
+            return AVERROR(EINVAL);
+
+        if (target >= position && target <= filled) {
+            // Already buffered, just skip ahead
+            position = target;
+        }
+        else {
+            stats.seeks++;
+            generation++;
+            position = filled = target;
+            atEnd = false;
+            error = 0;
+        }
+    }
+    spaceChanged();
+    return target;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+// Reading source media through a big read-ahead buffer, which a thread of its own keeps filled with large sequential
+// reads. UHD Blu-ray remuxes run at 60-100 Mbit/s, and libavformat's file protocol reads 32KB at a time as the demuxer
+// asks for it, so every hiccup of a spinning disk or network share would land on the demux thread.
+// Reads are overlapped, several at a time, so the storage always has the next few queued up rather than idling between
+// one read completing and the next being issued. If the file can't be opened for overlapped I/O they're made one at a
+// time instead.
+
+#include "../Utils/types.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+namespace RTR {
+    struct ReadScheduler;
+
+    struct ReadAheadStats {
+        // Whether reads were overlapped, and the most that were ever in flight at once
+        bool overlapped = false;
+        u32 maxReadsInFlight = 0;
+        // Read from the file, and handed on to the demuxer
+        u64 bytesRead = 0, bytesDelivered = 0;
+        u64 reads = 0;
+        // Stretches of back to back reads
+        u64 runs = 0;
+        // Time the fill thread spent waiting on reads
+        double readMs = 0.0;
+        // How often (and for how long) the demuxer found the buffer empty and had to wait on the file
+        u64 stalls = 0;
+        double stallMs = 0.0;
+        // Seeks outside what was buffered, which throw the read-ahead away
+        u64 seeks = 0;
+    };
+
+    struct ReadAheadReader {
+        static constexpr size_t DEFAULT_BUFFER_SIZE = 64 << 20;
+        // Size of each read from the file. The buffer is a whole number of these.
+        static constexpr size_t CHUNK_SIZE = 4 << 20;
+        // How much libavformat asks for at a time
+        static constexpr int IO_BUFFER_SIZE = 256 << 10;
+        static constexpr u32 DEFAULT_READS_IN_FLIGHT = 4;
+        // Assumed until setByteRate says otherwise: the top end of UHD Blu-ray
+        static constexpr double DEFAULT_BYTE_RATE = 100e6 / 8;
+
+        // path is UTF-8. Throws if the file can't be opened. With readsInFlight of 1, reads are never overlapped.
+        // With a scheduler, it does the reading instead of a thread of the reader's own.
+        explicit ReadAheadReader(const std::string& path, size_t bufferSize = DEFAULT_BUFFER_SIZE, u32 readsInFlight = DEFAULT_READS_IN_FLIGHT,
+            ReadScheduler* scheduler = nullptr);
+        ~ReadAheadReader();
+        ReadAheadReader(const ReadAheadReader&) = delete;
+        ReadAheadReader& operator=(const ReadAheadReader&) = delete;
+
+        // For AVFormatContext::pb before avformat_open_input. Stays owned by the reader, so the format context must be
+        // freed first.
+        AVIOContext* ioContext() const { return avio; }
+        ReadAheadStats getStats() const;
+        // How fast the demuxer is expected to consume the file, e.g. from AVFormatContext::bit_rate
+        void setByteRate(double bytesPerSecond);
+
+        // The AVIOContext callbacks
+        int read(u8* buf, int size);
+        i64 seek(i64 offset, int whence);
+
+        // For a ReadScheduler. Seconds of the stream buffered ahead of the demuxer, or nothing unless there's room for
+        // runBytes more (or for the rest of the file, if that's less).
+        std::optional<double> bufferedSeconds(i64 runBytes) const;
+        // Bytes of the stream that take seconds to play, at least one read's worth and at most half the buffer
+        i64 runBytesFor(double seconds) const;
+        // Reads up to maxBytes (in whole reads) at the end of what's buffered, for as long as there's room. Returns
+        // how much was read. Stops early if the demuxer seeks elsewhere or the reader is being destroyed.
+        i64 fillRun(i64 maxBytes);
+
+    private:
+        void* file; // HANDLE
+        bool overlapped = false;
+        u32 readsInFlight;
+        // One per read in flight, if overlapped
+        std::vector<void*> events;
+        ReadScheduler* scheduler;
+        i64 fileSize = 0;
+        std::vector<u8> ring;
+        AVIOContext* avio = nullptr;
+        std::thread fillThread;
+
+        mutable std::mutex mutex;
+        std::condition_variable dataReady, spaceFree;
+        // File offsets. The demuxer has read up to position, and the ring holds [position, filled).
+        i64 position = 0, filled = 0;
+        // Bumped by every seek that throws the ring away, so a read in flight at the time gets thrown away too
+        u64 generation = 0;
+        bool atEnd = false, stopping = false;
+        // Win32 error code that stopped reading, until the next seek
+        u32 error = 0;
+        double byteRate = DEFAULT_BYTE_RATE;
+        ReadAheadStats stats;
+
+        // Call with the lock held
+        bool hasSpace() const;
+        // Lets whoever does the reading know there may be room (or a new place) to read into
+        void spaceChanged();
+        void fillLoop();
+    };
+}
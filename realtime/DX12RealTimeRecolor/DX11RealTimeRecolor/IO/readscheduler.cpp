@@ -0,0 +1,87 @@
+#include "readscheduler.h"
+#include "readahead.h"
+
+#include <algorithm>
+
+using namespace RTR;
+
+ReadScheduler::ReadScheduler() : thread([this] { run(); }) {}
+
+ReadScheduler::~ReadScheduler() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+}
+
+ReadSchedulerStats ReadScheduler::getStats() const {
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void ReadScheduler::add(ReadAheadReader* reader) {
+    {
+        std::lock_guard lock(mutex);
+        readers.push_back(reader);
+        pokes++;
+    }
+    wakeup.notify_all();
+}
+
+void ReadScheduler::remove(ReadAheadReader* reader) {
+    std::unique_lock lock(mutex);
+    readers.erase(std::remove(readers.begin(), readers.end(), reader), readers.end());
+    // The reader is already stopping, so a run on it won't be long
+    runDone.wait(lock, [&] { return current != reader; });
+    if (previous == reader) {
+        previous = nullptr;
+    }
+}
+
+void ReadScheduler::poke() {
+    {
+        std::lock_guard lock(mutex);
+        pokes++;
+    }
+    wakeup.notify_all();
+}
+
+void ReadScheduler::run() {
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+        const u64 seen = pokes;
+        // Whichever is closest to running dry, of those with room for a whole run. Waiting for that much room rather
+        // than topping up a read at a time is what keeps the runs long. Readers are only ever locked after the
+        // scheduler, never before.
+        ReadAheadReader* next = nullptr;
+        i64 nextRunBytes = 0;
+        double leastBuffered = 0.0;
+        for (ReadAheadReader* reader : readers) {
+            const i64 runBytes = reader->runBytesFor(RUN_SECONDS);
+            const auto buffered = reader->bufferedSeconds(runBytes);
+            if (buffered && (!next || *buffered < leastBuffered)) {
+                next = reader;
+                nextRunBytes = runBytes;
+                leastBuffered = *buffered;
+            }
+        }
+        if (!next) {
+            wakeup.wait(lock, [&] { return stopping || pokes != seen; });
+            continue;
+        }
+
+        current = next;
+        stats.runs++;
+        if (previous && previous != next) {
+            stats.switches++;
+        }
+        lock.unlock();
+        next->fillRun(nextRunBytes);
+        lock.lock();
+        previous = next;
+        current = nullptr;
+        runDone.notify_all();
+    }
+}
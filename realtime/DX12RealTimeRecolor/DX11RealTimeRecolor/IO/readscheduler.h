@@ -0,0 +1,57 @@
+#pragma once
+
+// One I/O thread reading for several ReadAheadReaders, for source files that share a disk. Two readers each streaming
+// their own file would interleave small reads of both and have the heads seeking back and forth between them. This
+// serves one file at a time, in runs of a couple of seconds of its stream, always topping up whichever has the least
+// buffered (in seconds, so the 480p file doesn't hog the disk just because its bytes go further).
+
+#include "../Utils/types.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RTR {
+    struct ReadAheadReader;
+
+    struct ReadSchedulerStats {
+        u64 runs = 0;
+        // Runs on a different file than the one before, each costing a seek
+        u64 switches = 0;
+    };
+
+    struct ReadScheduler {
+        // Seconds of a stream read per run. Longer runs mean fewer seeks between files, but a reader can't buffer more
+        // than fits its ring either way.
+        static constexpr double RUN_SECONDS = 2.0;
+
+        ReadScheduler();
+        ~ReadScheduler();
+        ReadScheduler(const ReadScheduler&) = delete;
+        ReadScheduler& operator=(const ReadScheduler&) = delete;
+
+        ReadSchedulerStats getStats() const;
+
+        // Called by readers as they're created and destroyed. remove waits for a run on the reader to stop.
+        void add(ReadAheadReader* reader);
+        void remove(ReadAheadReader* reader);
+        // Called by readers when there may be something new to do
+        void poke();
+
+    private:
+        mutable std::mutex mutex;
+        std::condition_variable wakeup, runDone;
+        std::vector<ReadAheadReader*> readers;
+        // What a run is in progress on, if anything
+        ReadAheadReader* current = nullptr;
+        ReadAheadReader* previous = nullptr;
+        // Bumped by every poke, so one that comes in while the thread is looking around isn't lost
+        u64 pokes = 0;
+        bool stopping = false;
+        ReadSchedulerStats stats;
+        std::thread thread;
+
+        void run();
+    };
+}
@@ -0,0 +1,72 @@
+#include "sidecar.h"
+
+#include <cstring>
+#include <fstream>
+
+using namespace RTR;
+
+namespace {
+    std::filesystem::path sidecar_path(const std::string& mediaPath, const SidecarFormat& format) {
+        return path_from_utf8(mediaPath + format.extension);
+    }
+}
+
+std::filesystem::path RTR::path_from_utf8(const std::string& utf8) {
+    return std::filesystem::path(std::u8string(reinterpret_cast<const char8_t*>(utf8.data()), utf8.size()));
+}
+
+std::optional<SidecarKey> RTR::sidecar_key_of(const std::string& mediaPath) {
+    std::error_code error;
+    const auto path = path_from_utf8(mediaPath);
+    const auto size = std::filesystem::file_size(path, error);
+    if (error)
+        return std::nullopt;
+    const auto modified = std::filesystem::last_write_time(path, error);
+    if (error)
+        return std::nullopt;
+    return SidecarKey{ .size = size, .modified = (i64)modified.time_since_epoch().count() };
+}
+
+bool RTR::open_sidecar(std::ifstream& in, const std::string& mediaPath, const SidecarFormat& format) {
+    const auto key = sidecar_key_of(mediaPath);
+    if (!key)
+        return false;
+    in.open(sidecar_path(mediaPath, format), std::ios::binary);
+    if (!in)
+        return false;
+    char magic[sizeof(format.magic)];
+    u32 version;
+    SidecarKey cachedKey;
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, format.magic, sizeof(magic)) == 0
+        && read_pod(in, version) && version == format.version
+        && read_pod(in, cachedKey) && cachedKey == *key;
+}
+
+bool RTR::write_sidecar(const std::string& mediaPath, const SidecarFormat& format, const std::function<void(std::ostream&)>& writeBody) {
+    const auto key = sidecar_key_of(mediaPath);
+    if (!key)
+        return false;
+    const auto path = sidecar_path(mediaPath, format);
+    auto tempPath = path;
+    tempPath += ".tmp";
+    bool written;
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(format.magic, sizeof(format.magic));
+        write_pod(out, format.version);
+        write_pod(out, *key);
+        writeBody(out);
+        written = (bool)out.flush();
+    }
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(tempPath, path, error);
+    }
+    if (!written || error) {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
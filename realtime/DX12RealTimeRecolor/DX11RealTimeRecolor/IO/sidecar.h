@@ -0,0 +1,53 @@
+#pragma once
+
+// Small files of what was worked out about a media file, kept next to it (<file>.probe and so on) so later runs don't
+// have to work it out again. Each starts with a magic number, a version and the media file's size and modification
+// time, so one from an older build or an older copy of the file is just ignored.
+
+#include "../Utils/types.h"
+
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+
+namespace RTR {
+    struct SidecarKey {
+        u64 size;
+        i64 modified;
+        friend bool operator==(const SidecarKey&, const SidecarKey&) = default;
+    };
+
+    struct SidecarFormat {
+        // Tells the kinds of sidecar apart, e.g. "RTRPROBE"
+        char magic[8];
+        // Bump whenever what's stored changes
+        u32 version;
+        // Appended to the media file's path
+        const char* extension;
+    };
+
+    // Both UTF-8
+    std::filesystem::path path_from_utf8(const std::string& utf8);
+    std::optional<SidecarKey> sidecar_key_of(const std::string& mediaPath);
+
+    // Opens mediaPath's sidecar for reading, positioned after its header. False if there's none, or it's for another
+    // version or a different copy of the media file.
+    bool open_sidecar(std::ifstream& in, const std::string& mediaPath, const SidecarFormat& format);
+    // Writes mediaPath's sidecar, the header then whatever writeBody puts after it. Written to the side and renamed into
+    // place, so a run that's killed halfway doesn't leave half a sidecar. False if it couldn't be written.
+    bool write_sidecar(const std::string& mediaPath, const SidecarFormat& format, const std::function<void(std::ostream&)>& writeBody);
+
+    // Sidecars are only ever read back by the same build, so plain structs are written as they are
+    template<typename T>
+    bool read_pod(std::istream& in, T& value) {
+        return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void write_pod(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+}
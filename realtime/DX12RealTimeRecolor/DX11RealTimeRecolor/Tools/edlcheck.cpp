@@ -0,0 +1,132 @@
+// Synthetic check of align_cuts, away from any video files: builds a 480p cut of random fingerprints, derives a
+// 2160p cut from it with known edits, aligns the two and reports how many 2160p frames were mapped to the right 480p
+// frame (or to none).
+// The fingerprints are random rather than from real frames, and each 2160p copy has a few hash bits flipped to stand
+// in for the different encode, so this checks the guide path and the banded DTW, not how well real frames fingerprint.
+//
+// The 2160p cut is the 480p one with
+//  - a 3000-frame insertion (scenes the 480p cut doesn't have),
+//  - a 10000-frame removal (scenes only the 480p cut has),
+//  - a held frame every 1000 frames after the removal (frame rate conversion duplicates),
+// which comes to about 143k frames, a feature film at 24fps.
+//
+// Exits with 1 if fewer than MIN_CORRECT_FRACTION of frames are mapped correctly.
+
+#include "../Analysis/editdecisions.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace RTR;
+
+namespace {
+    constexpr u64 FRAMES_480 = 150000;
+    // 2160p follows 480p up to INSERT_AT, then has INSERTED_FRAMES of its own, then follows 480p again up to
+    // REMOVED_FROM, skips to REMOVED_TO and holds every HOLD_INTERVAL-th frame from there on
+    constexpr u64 INSERT_AT = 40000;
+    constexpr u64 INSERTED_FRAMES = 3000;
+    constexpr u64 REMOVED_FROM = 100000;
+    constexpr u64 REMOVED_TO = 110000;
+    constexpr u64 HOLD_INTERVAL = 1000;
+    // Hash bits flipped between the two cuts' fingerprints of the same frame
+    constexpr u32 ENCODE_NOISE_BITS = 3;
+
+    constexpr double MIN_CORRECT_FRACTION = 0.999;
+
+    struct SyntheticCuts {
+        std::vector<FrameFingerprint> fingerprints2160, fingerprints480;
+        // Per 2160p frame, the 480p frame it was made from or -1 if it was inserted
+        std::vector<i64> truth;
+    };
+
+    SyntheticCuts make_cuts(u64 seed) {
+        std::mt19937_64 rng(seed);
+        std::normal_distribution<float> normal;
+        const auto random_fingerprint = [&]() {
+            FrameFingerprint fp;
+            fp.hash = rng();
+            fp.informative = true;
+            // Same normalization as fingerprint_of: zero mean, unit variance
+            float mean = 0;
+            for (float& t : fp.thumbnail) {
+                t = normal(rng);
+                mean += t;
+            }
+            mean /= (float)fp.thumbnail.size();
+            float variance = 0;
+            for (float& t : fp.thumbnail) {
+                t -= mean;
+                variance += t * t;
+            }
+            const float stddev = std::sqrt(variance / (float)fp.thumbnail.size());
+            for (float& t : fp.thumbnail) {
+                t /= stddev;
+            }
+            return fp;
+        };
+
+        SyntheticCuts cuts;
+        cuts.fingerprints480.reserve(FRAMES_480);
+        for (u64 i = 0; i < FRAMES_480; i++) {
+            cuts.fingerprints480.push_back(random_fingerprint());
+        }
+
+        const auto copy_of = [&](u64 frame480) {
+            FrameFingerprint fp = cuts.fingerprints480[frame480];
+            for (u32 k = 0; k < ENCODE_NOISE_BITS; k++) {
+                fp.hash ^= 1ull << (rng() % 64);
+            }
+            cuts.fingerprints2160.push_back(fp);
+            cuts.truth.push_back((i64)frame480);
+        };
+        for (u64 i = 0; i < INSERT_AT; i++) {
+            copy_of(i);
+        }
+        for (u64 i = 0; i < INSERTED_FRAMES; i++) {
+            cuts.fingerprints2160.push_back(random_fingerprint());
+            cuts.truth.push_back(-1);
+        }
+        for (u64 i = INSERT_AT; i < REMOVED_FROM; i++) {
+            copy_of(i);
+        }
+        for (u64 i = REMOVED_TO; i < FRAMES_480; i++) {
+            copy_of(i);
+            if (i % HOLD_INTERVAL == 0) {
+                copy_of(i);
+            }
+        }
+        return cuts;
+    }
+}
+
+int main() {
+    const auto cuts = make_cuts(3);
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto edl = align_cuts(cuts.fingerprints2160, cuts.fingerprints480);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    u64 correct = 0;
+    for (size_t i = 0; i < cuts.truth.size(); i++) {
+        correct += edl.frame480For2160[i] == cuts.truth[i] ? 1 : 0;
+    }
+    const double correctFraction = (double)correct / (double)cuts.truth.size();
+
+    printf("%zu 2160p frames against %zu 480p frames: %llu correct (%.2f%%), %zu segments, %.1fs\n",
+        cuts.fingerprints2160.size(), cuts.fingerprints480.size(), correct, correctFraction * 100.0, edl.segments.size(), seconds);
+    printf("%llu anchors, %llu cells evaluated, %.1fMB of backpointers\n",
+        edl.stats.anchors, edl.stats.cellsEvaluated, edl.stats.backpointerBytes / (1024.0 * 1024.0));
+    for (const auto& segment : edl.segments) {
+        if (segment.start480 >= 0) {
+            printf("  2160p %llu-%llu -> 480p %lld-%lld\n", segment.start2160, segment.start2160 + segment.length - 1,
+                segment.start480, segment.start480 + (i64)segment.length - 1);
+        }
+        else {
+            printf("  2160p %llu-%llu -> -\n", segment.start2160, segment.start2160 + segment.length - 1);
+        }
+    }
+    return correctFraction >= MIN_CORRECT_FRACTION ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Fixed capacity FIFO for handing work between threads. push blocks while the queue is full and pop while it's empty,
+// so a fast producer can't run arbitrarily far ahead of its consumer (or out of decoder surfaces).
+// close() wakes everyone up: pushes fail from then on, and pops drain whatever is left before failing too.
+
+#include "types.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace RTR {
+    struct BoundedQueueStats {
+        u64 pushes = 0;
+        // How often (and for how long) each side had to wait for the other
+        u64 fullWaits = 0, emptyWaits = 0;
+        double fullWaitMs = 0.0, emptyWaitMs = 0.0;
+    };
+
+    template<typename T>
+    struct BoundedQueue {
+        explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        // False if the queue was closed, in which case value is dropped
+        bool push(T value) {
+            std::unique_lock lock(mutex);
+            if (!closed && items.size() >= capacity) {
+                auto start = std::chrono::high_resolution_clock::now();
+                notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+                stats.fullWaits++;
+                stats.fullWaitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            if (closed)
+                return false;
+            items.push_back(std::move(value));
+            stats.pushes++;
+            notEmpty.notify_one();
+            return true;
+        }
+
+        // Nothing once the queue is closed and empty
+        std::optional<T> pop() {
+            std::unique_lock lock(mutex);
+            if (!closed && items.empty()) {
+                auto start = std::chrono::high_resolution_clock::now();
+                notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+                stats.emptyWaits++;
+                stats.emptyWaitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            return takeFront();
+        }
+
+        // Nothing if the queue is empty right now
+        std::optional<T> tryPop() {
+            std::lock_guard lock(mutex);
+            return takeFront();
+        }
+
+        void close() {
+            std::lock_guard lock(mutex);
+            closed = true;
+            notFull.notify_all();
+            notEmpty.notify_all();
+        }
+
+        bool isClosed() const {
+            std::lock_guard lock(mutex);
+            return closed;
+        }
+
+        size_t size() const {
+            std::lock_guard lock(mutex);
+            return items.size();
+        }
+
+        BoundedQueueStats getStats() const {
+            std::lock_guard lock(mutex);
+            return stats;
+        }
+
+        const size_t capacity;
+
+    private:
+        mutable std::mutex mutex;
+        std::condition_variable notFull, notEmpty;
+        std::deque<T> items;
+        bool closed = false;
+        BoundedQueueStats stats;
+
+        // Call with the lock held
+        std::optional<T> takeFront() {
+            if (items.empty())
+                return std::nullopt;
+            std::optional<T> value(std::move(items.front()));
+            items.pop_front();
+            notFull.notify_one();
+            return value;
+        }
+    };
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// x64 always has SSE2, so that's the baseline for hand-vectorized CPU analysis code.
+// Everything using intrinsics keeps a scalar path for other targets (ARM64 Windows).
+#if defined(_M_X64) || defined(__SSE2__)
+#define RTR_SSE2 1
+#include <emmintrin.h>
+#else
+#define RTR_SSE2 0
+#endif
@@ -25,6 +25,7 @@ using ComPtr = Microsoft::WRL::ComPtr<T>;
 
 // DirectX 11 specific headers.
 #include <d3d11.h>
+#include <d3d11_4.h> // ID3D11Multithread
 
 // include the Direct3D Library file
 #pragma comment (lib, "d3d11.lib")
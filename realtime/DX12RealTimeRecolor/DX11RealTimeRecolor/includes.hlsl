@@ -1,3 +1,11 @@
+// Must match RTR::TILE_SIZE in DX11RealTimeRecolor.h
+#define TILE_SIZE 16
+
+uint tile_index(uint2 pixel, uint2 tileCounts) {
+	uint2 tile = pixel / TILE_SIZE;
+	return tile.y * tileCounts.x + tile.x;
+}
+
 // Derived from https://msdn.microsoft.com/en-us/library/windows/desktop/dd206750(v=vs.85).aspx
 // Section: Converting 8-bit YUV to RGB888
 // Converts BT.601 YUV to RGB
@@ -31,10 +39,10 @@ float rec2020_linearize(float e_prime) {
 	else {
 		// E' = alpha * pow(E, 0.45) - (alpha - 1)
 		// alpha * pow(E, 0.45) = E' + alpha - 1
-		// pow(E, 0.45) = (E' + alpha - 1) * alpha
+		// pow(E, 0.45) = (E' + alpha - 1) / alpha
 		// 1/0.45 = 2.22223
-		// E = pow(pow(E, 0.45), 2.22223) = pow((E' + alpha - 1) * alpha, 2.22223)
-		return pow((e_prime + alpha - 1) * alpha, 2.22223);
+		// E = pow(pow(E, 0.45), 2.22223) = pow((E' + alpha - 1) / alpha, 2.22223)
+		return pow((e_prime + alpha - 1) / alpha, 2.22223);
 	}
 }
 
@@ -96,7 +104,7 @@ float cielab_f(float t) {
 }
 
 static const float3 xyz_reference_white = float3(0.95048, 1.00, 1.088840);
-float xyz_to_cielab(float3 xyz) {
+float3 xyz_to_cielab(float3 xyz) {
 	float f_x = cielab_f(xyz.x / xyz_reference_white.x);
 	float f_y = cielab_f(xyz.y / xyz_reference_white.y);
 	float f_z = cielab_f(xyz.z / xyz_reference_white.z);
@@ -0,0 +1,48 @@
+// Flags every row and column of luma with anything brighter than blackThreshold, for frames that never reach system
+// memory. brightLines holds the rows, then the columns; it's cleared to zero beforehand and read back later, where
+// active_area_of_lines turns it into the rectangle inside the letterbox bars.
+// Dispatched with one thread group per tile.
+
+RWTexture2DArray<uint> ySource: t0;
+RWStructuredBuffer<uint> brightLines : t1;
+
+cbuffer CONSTANTS: register(b0) {
+	uint2 texDims;
+	uint2 tileCounts;
+	uint forceAllTilesDirty;
+	uint tileChangeThreshold;
+	uint2 activeMin;
+	uint2 activeMax;
+	// In raw texture units, so already shifted up for 10-bit
+	uint blackThreshold;
+}
+
+#include "includes.hlsl"
+
+groupshared uint rowBright[TILE_SIZE];
+groupshared uint columnBright[TILE_SIZE];
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint3 GTid : SV_GroupThreadID, uint3 DTid : SV_DispatchThreadID) {
+	if (GTid.y == 0) {
+		columnBright[GTid.x] = 0;
+	}
+	if (GTid.x == 0) {
+		rowBright[GTid.y] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (all(DTid.xy < texDims) && ySource.Load(uint4(DTid.x, DTid.y, 0, 0)) > blackThreshold) {
+		InterlockedOr(rowBright[GTid.y], 1);
+		InterlockedOr(columnBright[GTid.x], 1);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Only lit lines are written, so most of the frame (and all of the bars) costs no buffer traffic
+	if (GTid.y == 0 && columnBright[GTid.x] && DTid.x < texDims.x) {
+		InterlockedOr(brightLines[texDims.y + DTid.x], 1);
+	}
+	if (GTid.x == 0 && rowBright[GTid.y] && DTid.y < texDims.y) {
+		InterlockedOr(brightLines[DTid.y], 1);
+	}
+}
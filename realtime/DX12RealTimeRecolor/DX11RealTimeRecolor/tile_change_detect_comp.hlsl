@@ -0,0 +1,73 @@
+// Compares each TILE_SIZE x TILE_SIZE tile of a freshly decoded frame against a copy of the last frame we converted.
+// Unchanged tiles are marked clean, and the conversion shaders skip them - leaving the previous output in place.
+// Dispatched with one thread group per tile.
+
+RWTexture2DArray<uint> ySource: t0;
+RWTexture2DArray<uint2> uvSource: t1;
+RWTexture2D<uint> yPrevious : t2;
+RWTexture2D<uint2> uvPrevious : t3;
+RWStructuredBuffer<uint> tileDirty : t4;
+RWStructuredBuffer<uint> dirtyTileCount : t5;
+
+cbuffer CONSTANTS: register(b0) {
+	uint2 texDims;
+	uint2 tileCounts;
+	uint forceAllTilesDirty;
+	uint tileChangeThreshold;
+}
+
+#include "includes.hlsl"
+
+groupshared uint tileChanged;
+
+bool sample_changed(uint current, uint previous) {
+	return (uint)abs((int)current - (int)previous) > tileChangeThreshold;
+}
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint3 Gid : SV_GroupID, uint3 GTid : SV_GroupThreadID, uint3 DTid : SV_DispatchThreadID) {
+	if (all(GTid.xy == 0)) {
+		tileChanged = forceAllTilesDirty;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	bool ownsLuma = all(DTid.xy < texDims);
+	// Chroma is subsampled 2x2, so one in four threads is responsible for a chroma sample
+	bool ownsChroma = ownsLuma && all((DTid.xy & 1) == 0);
+	uint2 uvPos = DTid.xy / 2;
+
+	uint y = 0;
+	uint2 uv = uint2(0, 0);
+	if (ownsLuma) {
+		y = ySource.Load(uint4(DTid.x, DTid.y, 0, 0));
+		if (sample_changed(y, yPrevious[DTid.xy])) {
+			InterlockedOr(tileChanged, 1);
+		}
+	}
+	if (ownsChroma) {
+		uv = uvSource.Load(uint4(uvPos.x, uvPos.y, 0, 0));
+		uint2 uvPrev = uvPrevious[uvPos];
+		if (sample_changed(uv.x, uvPrev.x) || sample_changed(uv.y, uvPrev.y)) {
+			InterlockedOr(tileChanged, 1);
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Only remember the input for tiles we're about to convert.
+	// If we updated clean tiles too, changes under the threshold could accumulate without ever being converted.
+	if (tileChanged) {
+		if (ownsLuma) {
+			yPrevious[DTid.xy] = y;
+		}
+		if (ownsChroma) {
+			uvPrevious[uvPos] = uv;
+		}
+	}
+
+	if (all(GTid.xy == 0)) {
+		tileDirty[Gid.y * tileCounts.x + Gid.x] = tileChanged;
+		if (tileChanged) {
+			InterlockedAdd(dirtyTileCount[0], 1);
+		}
+	}
+}
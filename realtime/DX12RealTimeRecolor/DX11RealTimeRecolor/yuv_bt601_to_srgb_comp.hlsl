@@ -15,18 +15,27 @@
 RWTexture2DArray<uint> ySource: t0;
 RWTexture2DArray<uint2> uvSource: t1;
 RWTexture2D<float4> srgb : t2;
+// Nonzero for tiles which changed since the last frame, see tile_change_detect_comp.hlsl
+RWStructuredBuffer<uint> tileDirty : t3;
 
 cbuffer CONSTANTS: register(b0) {
 	uint2 texDims;
+	uint2 tileCounts;
+	uint forceAllTilesDirty;
+	uint tileChangeThreshold;
+	// Dispatched over just this rectangle (inside any letterbox bars), see DX11ColorspaceConstantBuffer
+	uint2 activeMin;
+	uint2 activeMax;
 }
 
 #include "includes.hlsl"
 
 [numthreads(1, 1, 1)]
 void main(uint3 DTid : SV_DispatchThreadID) {
-	if (all(DTid.xy < texDims)) {
-		float y = ySource.Load(uint4(DTid.x, DTid.y, 0, 0)) / 255.0;
-		float2 uv = uvSource.Load(uint4(DTid.x / 2, DTid.y / 2, 0, 0)) / 255.0;
-		srgb[DTid.xy] = float4(yuv_bt601_to_srgb(float3(y, uv.x, uv.y)), 1.f);
+	uint2 pixel = DTid.xy + activeMin;
+	if (all(pixel < activeMax) && tileDirty[tile_index(pixel, tileCounts)]) {
+		float y = ySource.Load(uint4(pixel.x, pixel.y, 0, 0)) / 255.0;
+		float2 uv = uvSource.Load(uint4(pixel.x / 2, pixel.y / 2, 0, 0)) / 255.0;
+		srgb[pixel] = float4(yuv_bt601_to_srgb(float3(y, uv.x, uv.y)), 1.f);
 	}
 }
@@ -15,23 +15,32 @@
 RWTexture2DArray<uint> ySource: t0;
 RWTexture2DArray<uint2> uvSource: t1;
 RWTexture2D<float4> labDst : t2;
+// Nonzero for tiles which changed since the last frame, see tile_change_detect_comp.hlsl
+RWStructuredBuffer<uint> tileDirty : t3;
 
 cbuffer CONSTANTS: register(b0) {
 	uint2 texDims;
+	uint2 tileCounts;
+	uint forceAllTilesDirty;
+	uint tileChangeThreshold;
+	// Dispatched over just this rectangle (inside any letterbox bars), see DX11ColorspaceConstantBuffer
+	uint2 activeMin;
+	uint2 activeMax;
 }
 
 #include "includes.hlsl"
 
 [numthreads(1, 1, 1)]
 void main(uint3 DTid : SV_DispatchThreadID) {
-	if (all(DTid.xy < texDims)) {
-		uint y = ySource.Load(uint4(DTid.x, DTid.y, 0, 0)) >> 6;
-		uint2 uv = uvSource.Load(uint4(DTid.x / 2, DTid.y / 2, 0, 0)) >> 6;
+	uint2 pixel = DTid.xy + activeMin;
+	if (all(pixel < activeMax) && tileDirty[tile_index(pixel, tileCounts)]) {
+		uint y = ySource.Load(uint4(pixel.x, pixel.y, 0, 0)) >> 6;
+		uint2 uv = uvSource.Load(uint4(pixel.x / 2, pixel.y / 2, 0, 0)) >> 6;
 
 		float3 linear_rgb = yuv_rec2020_10bit_to_linear_rgb(y, uv);
 		float3 xyz = linear_rgb_to_xyz(linear_rgb);
 		float3 lab = xyz_to_cielab(xyz);
 
-		labDst[DTid.xy] = float4(lab, 1.0);
+		labDst[pixel] = float4(lab, 1.0);
 	}
 }